@@ -24,17 +24,22 @@ for plugin in "${PLUGINS[@]}"; do
     SO_NAME="libOrthancPython.so"
     # Use separate Dockerfile for Python plugin
     DOCKERFILE="../Dockerfile.python"
+    BUILD_CONTEXT="."
+    BUILD_ARGS=()
   else
     PLUGIN_NAME_CAMEL=$(echo "$plugin" | sed -E 's/(^|-)([a-z])/\U\2/g')
     OUTPUT_PATH="./lib${PLUGIN_NAME_CAMEL}.so"
     SO_NAME="lib${PLUGIN_NAME_CAMEL}.so"
     # Use normal Dockerfile for other plugins
     DOCKERFILE="../Dockerfile.builder"
+    # Build from the parent directory so the image also gets common/
+    BUILD_CONTEXT=".."
+    BUILD_ARGS=(--build-arg "PLUGIN=$plugin")
   fi
   
   IMAGE_NAME="orthanc-${plugin}"
 
-  docker build $PLATFORM_OPTION -f "$DOCKERFILE" -t "$IMAGE_NAME" .
+  docker build $PLATFORM_OPTION -f "$DOCKERFILE" "${BUILD_ARGS[@]}" -t "$IMAGE_NAME" "$BUILD_CONTEXT"
 
   docker rm -f "$CONTAINER_NAME" || true
   docker create --name "$CONTAINER_NAME" "$IMAGE_NAME"
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <limits>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Order in which queued studies are exported and queued archives are uploaded. Shared by
+// ExportPlugin and FilesenderPlugin from deployment/plugin/common; both plugins run in one
+// Orthanc and read the same environment:
+//   SCHEDULER_POLICY      fifo | sjf (default) | priority
+//   SCHEDULER_AGING_RATE  bytes/s a waiting job gains on the ones behind it (10 MiB/s)
+//   SCHEDULER_PRIORITY    class levels for "priority", lower first, e.g. "CR=0,DX=0,AET:ER_SCU=0,MR=2";
+//                         a class is a modality or AET:<sender>, unlisted classes come last
+//   SCHEDULER_LEVEL_WAIT  seconds of waiting after which a job under "priority" moves up one
+//                         level (600), so a steady stream of level 0 does not starve the
+//                         levels behind it; 0 keeps the levels strict
+struct SchedulerConfig {
+    enum Policy {
+        Policy_Fifo,
+        Policy_ShortestFirst,  // smallest estimated size first, with aging
+        Policy_Priority        // lowest class level first, shortest first within a level
+    };
+
+    Policy policy = Policy_ShortestFirst;
+    uint64_t agingRate = 10485760;
+    std::map<std::string, int> levels;
+    int64_t levelWaitMs = 600000;
+
+    static SchedulerConfig FromEnvironment() {
+        SchedulerConfig config;
+        const char* policy = std::getenv("SCHEDULER_POLICY");
+        if (policy && std::string(policy) == "fifo") {
+            config.policy = Policy_Fifo;
+        } else if (policy && std::string(policy) == "priority") {
+            config.policy = Policy_Priority;
+        }
+        const char* rate = std::getenv("SCHEDULER_AGING_RATE");
+        if (rate && *rate) {
+            config.agingRate = std::strtoull(rate, nullptr, 10);
+        }
+        const char* levelWait = std::getenv("SCHEDULER_LEVEL_WAIT");
+        if (levelWait && *levelWait) {
+            config.levelWaitMs = static_cast<int64_t>(std::strtoull(levelWait, nullptr, 10)) * 1000;
+        }
+        const char* levels = std::getenv("SCHEDULER_PRIORITY");
+        std::string rules = levels ? levels : "";
+        for (size_t start = 0; start < rules.size();) {
+            size_t end = rules.find(',', start);
+            if (end == std::string::npos) end = rules.size();
+            std::string rule = rules.substr(start, end - start);
+            size_t eq = rule.find('=');
+            if (eq != std::string::npos && eq > 0) {
+                config.levels[rule.substr(0, eq)] = std::atoi(rule.c_str() + eq + 1);
+            }
+            start = end + 1;
+        }
+        return config;
+    }
+
+    const char* PolicyName() const {
+        return policy == Policy_Fifo ? "fifo" : (policy == Policy_Priority ? "priority" : "sjf");
+    }
+
+    bool HasAetRules() const {
+        for (const auto& level : levels) {
+            if (level.first.compare(0, 4, "AET:") == 0) return true;
+        }
+        return false;
+    }
+
+    int Level(const std::string& cls) const {
+        auto it = levels.find(cls);
+        return it == levels.end() ? UNLISTED : it->second;
+    }
+
+    // Position of the level of cls among the configured ones, the unit of SCHEDULER_LEVEL_WAIT:
+    // with "CR=0,MR=2" CR is 0, MR 1 and unlisted classes 2
+    int Rank(const std::string& cls) const {
+        int level = Level(cls);
+        std::set<int> below;
+        for (const auto& entry : levels) {
+            if (entry.second < level) below.insert(entry.second);
+        }
+        return static_cast<int>(below.size());
+    }
+
+    // The class that decides the level of a study: its sender if that has a rule, else
+    // its modality with the lowest level, else the first one
+    std::string Classify(const std::vector<std::string>& modalities, const std::string& aet) const {
+        if (!aet.empty() && levels.count("AET:" + aet)) {
+            return "AET:" + aet;
+        }
+        std::string best;
+        for (const auto& modality : modalities) {
+            if (best.empty() || Level(modality) < Level(best)) best = modality;
+        }
+        return best.empty() ? "other" : best;
+    }
+
+    // Latency label: the class under "priority", a size band otherwise
+    std::string Label(const std::string& cls, uint64_t bytes) const {
+        if (policy == Policy_Priority) {
+            return cls.empty() ? "other" : cls;
+        }
+        return bytes < 104857600 ? "small" : (bytes < 1073741824 ? "medium" : "large");
+    }
+
+    static const int UNLISTED = 1000;
+};
+
+// Not synchronized, the owning queue holds its lock. Aging lowers every waiting job's
+// cost by agingRate per second, which never changes their relative order, so the cost is
+// fixed at Push as bytes + agingRate * enqueue time and jobs stay in an ordered map.
+// Moving up a level with the wait does change the order between levels, so under
+// "priority" Pop compares the first job of each level with the longest waiting one.
+template <typename Job>
+class JobScheduler {
+public:
+    explicit JobScheduler(const SchedulerConfig& config = SchedulerConfig())
+        : config_(config) {
+    }
+
+    void Configure(const SchedulerConfig& config) { config_ = config; }
+    const SchedulerConfig& Config() const { return config_; }
+
+    // queuedAt: steady clock ms the job has been waiting since, if it waited elsewhere first
+    void Push(Job job, uint64_t bytes, const std::string& cls, int64_t queuedAt = -1) {
+        int64_t now = queuedAt >= 0 ? queuedAt : NowMs();
+        int level = config_.policy == SchedulerConfig::Policy_Priority ? config_.Rank(cls) : 0;
+        double cost = 0;
+        if (config_.policy != SchedulerConfig::Policy_Fifo) {
+            cost = static_cast<double>(bytes) + static_cast<double>(config_.agingRate) * (now - epoch_) / 1000.0;
+        }
+        Entry entry{ std::move(job), config_.Label(cls, bytes), now };
+        auto it = jobs_.emplace(Key(level, cost, sequence_), std::move(entry));
+        arrivals_.emplace(std::make_pair(level, sequence_++), it);
+    }
+
+    bool Empty() const { return jobs_.empty(); }
+    size_t Size() const { return jobs_.size(); }
+
+    // Next job with its latency label and the ms it waited
+    Job Pop(std::string& label, int64_t& waitedMs) {
+        int64_t now = NowMs();
+        auto first = jobs_.begin();
+        if (config_.policy == SchedulerConfig::Policy_Priority && config_.levelWaitMs > 0) {
+            first = Next(now);
+        }
+        Job job = std::move(first->second.job);
+        label = first->second.label;
+        waitedMs = now - first->second.queuedAt;
+        arrivals_.erase(std::make_pair(std::get<0>(first->first), std::get<2>(first->first)));
+        jobs_.erase(first);
+        return job;
+    }
+
+    // Removes and returns all waiting jobs
+    std::vector<Job> Drain() {
+        std::vector<Job> jobs;
+        for (auto& entry : jobs_) {
+            jobs.push_back(std::move(entry.second.job));
+        }
+        jobs_.clear();
+        arrivals_.clear();
+        return jobs;
+    }
+
+    // Steady clock ms, the time base of queuedAt
+    static int64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    typedef std::tuple<int, double, uint64_t> Key;  // level, cost, arrival
+
+    struct Entry {
+        Job job;
+        std::string label;
+        int64_t queuedAt;  // steady clock ms
+    };
+
+    typedef typename std::multimap<Key, Entry>::iterator Position;
+
+    // Level a job has reached by waiting, below 0 once it waited past the first level
+    int64_t Effective(Position job, int64_t now) const {
+        return std::get<0>(job->first) - (now - job->second.queuedAt) / config_.levelWaitMs;
+    }
+
+    // The job with the lowest level reached, the cheapest among equals. Within a level
+    // that is its first job or the one waiting longest, so only those are compared.
+    Position Next(int64_t now) {
+        Position best = jobs_.begin();
+        for (Position head = jobs_.begin(); head != jobs_.end();) {
+            int level = std::get<0>(head->first);
+            Position oldest = arrivals_.lower_bound(std::make_pair(level, uint64_t(0)))->second;
+            for (Position candidate : { head, oldest }) {
+                int64_t effective = Effective(candidate, now);
+                int64_t bestEffective = Effective(best, now);
+                if (effective < bestEffective || (effective == bestEffective && std::get<1>(candidate->first) < std::get<1>(best->first))) {
+                    best = candidate;
+                }
+            }
+            head = jobs_.lower_bound(Key(level + 1, -std::numeric_limits<double>::infinity(), 0));
+        }
+        return best;
+    }
+
+    SchedulerConfig config_;
+    std::multimap<Key, Entry> jobs_;
+    std::map<std::pair<int, uint64_t>, Position> arrivals_;  // level, arrival
+    int64_t epoch_ = NowMs();
+    uint64_t sequence_ = 0;
+};
+
+// Queue wait per latency label over the last jobs, for tuning the policy; not synchronized
+class ClassLatency {
+public:
+    struct Summary {
+        int64_t median = 0;
+        int64_t max = 0;
+        size_t count = 0;
+    };
+
+    Summary Record(const std::string& label, int64_t waitedMs) {
+        std::deque<int64_t>& samples = samples_[label];
+        samples.push_back(waitedMs);
+        if (samples.size() > WINDOW) samples.pop_front();
+
+        std::vector<int64_t> sorted(samples.begin(), samples.end());
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        Summary summary;
+        summary.median = sorted[sorted.size() / 2];
+        summary.max = *std::max_element(sorted.begin(), sorted.end());
+        summary.count = sorted.size();
+        return summary;
+    }
+
+    // "AET:ER_SCU" -> "aet_er_scu", for metric names
+    static std::string MetricSuffix(const std::string& label) {
+        std::string suffix;
+        for (char c : label) {
+            suffix += std::isalnum(static_cast<unsigned char>(c)) ? static_cast<char>(std::tolower(static_cast<unsigned char>(c))) : '_';
+        }
+        return suffix;
+    }
+
+private:
+    static const size_t WINDOW = 100;
+    std::map<std::string, std::deque<int64_t>> samples_;
+};
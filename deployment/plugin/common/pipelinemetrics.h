@@ -0,0 +1,80 @@
+#pragma once
+
+#include <OrthancCPlugin.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Counters and latency histograms of the pipeline for /tools/metrics-prometheus. Hot paths
+// only do relaxed atomic adds; the values are handed to Orthanc from the plugin's
+// refresh-metrics callback, when the metrics are scraped. Orthanc metrics are a name and a
+// float, so a histogram is published as cumulative <name>_le_<ms> buckets with <name>_count
+// and <name>_sum. Shared by the plugins from deployment/plugin/common.
+class MetricCounter {
+public:
+    void Add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+    void Publish(OrthancPluginContext* context, const std::string& name) const {
+        OrthancPluginSetMetricsValue(context, name.c_str(), static_cast<float>(Value()), OrthancPluginMetricsType_Default);
+    }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 12;
+    static constexpr int64_t BOUNDS_MS[BUCKETS] = { 10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 300000 };
+
+    void Observe(int64_t ms) {
+        size_t bucket = 0;
+        while (bucket < BUCKETS && ms > BOUNDS_MS[bucket]) bucket++;
+        counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+        sumMs_.fetch_add(static_cast<uint64_t>(ms > 0 ? ms : 0), std::memory_order_relaxed);
+    }
+
+    void Publish(OrthancPluginContext* context, const std::string& name) const {
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+            cumulative += counts_[bucket].load(std::memory_order_relaxed);
+            OrthancPluginSetMetricsValue(context, (name + "_le_" + std::to_string(BOUNDS_MS[bucket])).c_str(),
+                                         static_cast<float>(cumulative), OrthancPluginMetricsType_Default);
+        }
+        cumulative += counts_[BUCKETS].load(std::memory_order_relaxed);
+        OrthancPluginSetMetricsValue(context, (name + "_count").c_str(), static_cast<float>(cumulative), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(context, (name + "_sum").c_str(), static_cast<float>(sumMs_.load(std::memory_order_relaxed)),
+                                     OrthancPluginMetricsType_Default);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS + 1> counts_{};  // the last one is above every bound
+    std::atomic<uint64_t> sumMs_{0};
+};
+
+// Observes the time until it goes out of scope, or until Stop
+class StageTimer {
+public:
+    explicit StageTimer(LatencyHistogram& histogram)
+        : histogram_(&histogram), start_(std::chrono::steady_clock::now()) {
+    }
+
+    ~StageTimer() { Stop(); }
+
+    int64_t Stop() {
+        int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_).count();
+        if (histogram_) {
+            histogram_->Observe(ms);
+            histogram_ = nullptr;
+        }
+        return ms;
+    }
+
+private:
+    LatencyHistogram* histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Per-study tracing across the plugins. ExportPlugin assigns a trace id when a study
+// becomes stable; it travels to QueuePlugin in the /send request and to FilesenderPlugin in
+// the mapping log. Every stage records a span into a bounded in-memory ring and appends it
+// as one JSON line to <TRACE_DIR>/<plugin>.trace.jsonl, rotated to .1 at TRACE_FILE_MB.
+// ExportPlugin merges the files of all plugins for /pipeline/trace. Shared by the plugins
+// from deployment/plugin/common.
+//   TRACE_DIR         directory of the span files, empty for the ring only (/logs/trace)
+//   TRACE_RING_SPANS  spans kept in memory per plugin (4096)
+//   TRACE_FILE_MB     size at which a span file is rotated (16)
+struct TraceSpan {
+    std::string trace;
+    std::string process;   // plugin that recorded the span
+    std::string name;      // stage
+    std::string subject;   // study id or archive name
+    int64_t startUs = 0;   // system clock, comparable across plugins
+    int64_t endUs = 0;
+    uint64_t bytes = 0;
+    std::string outcome;   // "ok" or why the stage failed
+
+    // One line of the span file
+    std::string ToJson() const {
+        return "{\"trace\": \"" + Escape(trace) + "\", \"process\": \"" + Escape(process) + "\", \"name\": \"" + Escape(name) +
+               "\", \"subject\": \"" + Escape(subject) + "\", \"start_us\": " + std::to_string(startUs) +
+               ", \"end_us\": " + std::to_string(endUs) + ", \"bytes\": " + std::to_string(bytes) +
+               ", \"outcome\": \"" + Escape(outcome) + "\"}";
+    }
+
+    static std::string Escape(const std::string& value) {
+        std::string escaped;
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                escaped += ' ';
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+};
+
+class TraceLog {
+public:
+    explicit TraceLog(const std::string& process)
+        : process_(process) {
+    }
+
+    ~TraceLog() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    void Configure(const std::string& dir, size_t ringSpans, uint64_t maxFileBytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dir_ = dir;
+        ringSpans_ = ringSpans > 0 ? ringSpans : 1;
+        maxFileBytes_ = maxFileBytes;
+        if (fd_ >= 0) close(fd_);
+        fd_ = -1;
+        if (!dir_.empty()) {
+            mkdir(dir_.c_str(), 0755);
+            fd_ = open(Path().c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            struct stat st;
+            fileBytes_ = fd_ >= 0 && fstat(fd_, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+        }
+    }
+
+    void ConfigureFromEnvironment() {
+        const char* dir = std::getenv("TRACE_DIR");
+        const char* ring = std::getenv("TRACE_RING_SPANS");
+        const char* fileMb = std::getenv("TRACE_FILE_MB");
+        Configure(dir ? dir : "/logs/trace", ring && *ring ? std::strtoul(ring, nullptr, 10) : 4096,
+                  (fileMb && *fileMb ? std::strtoull(fileMb, nullptr, 10) : 16) << 20);
+    }
+
+    const std::string& Directory() const { return dir_; }
+    bool FileEnabled() const { return fd_ >= 0; }
+
+    // Spans without a trace id (archives from before tracing) are dropped
+    void Record(TraceSpan span) {
+        if (span.trace.empty()) return;
+        span.process = process_;
+        std::string line = span.ToJson() + "\n";
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring_.push_back(std::move(span));
+        if (ring_.size() > ringSpans_) ring_.pop_front();
+
+        if (fd_ < 0) return;
+        if (maxFileBytes_ > 0 && fileBytes_ + line.size() > maxFileBytes_) {
+            close(fd_);
+            rename(Path().c_str(), (Path() + ".1").c_str());
+            fd_ = open(Path().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+            fileBytes_ = 0;
+            if (fd_ < 0) return;
+        }
+        // Diagnostics only: one write per line keeps lines whole, no fsync
+        if (write(fd_, line.data(), line.size()) == static_cast<ssize_t>(line.size())) {
+            fileBytes_ += line.size();
+        }
+    }
+
+    // Spans of trace in the ring, all of them for an empty trace
+    std::vector<TraceSpan> Recent(const std::string& trace = "") const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<TraceSpan> spans;
+        for (const auto& span : ring_) {
+            if (trace.empty() || span.trace == trace) spans.push_back(span);
+        }
+        return spans;
+    }
+
+    static std::string NewTraceId() {
+        static thread_local std::mt19937_64 random(std::random_device{}() ^
+                                                   static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+        char id[17];
+        snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(random()));
+        return id;
+    }
+
+    static int64_t NowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::string Path() const { return dir_ + "/" + process_ + ".trace.jsonl"; }
+
+    std::string process_;
+    std::string dir_;
+    size_t ringSpans_ = 4096;
+    uint64_t maxFileBytes_ = 0;
+    uint64_t fileBytes_ = 0;
+    int fd_ = -1;
+    mutable std::mutex mutex_;
+    std::deque<TraceSpan> ring_;
+};
+
+// Records a span when it goes out of scope; outcome stays "error" unless Finish is called,
+// so early returns and exceptions show up as failed stages
+class TraceScope {
+public:
+    TraceScope(TraceLog& log, const std::string& trace, const std::string& name, const std::string& subject)
+        : log_(&log) {
+        span_.trace = trace;
+        span_.name = name;
+        span_.subject = subject;
+        span_.startUs = TraceLog::NowUs();
+        span_.outcome = "error";
+    }
+
+    ~TraceScope() { Finish(span_.outcome); }
+
+    void SetBytes(uint64_t bytes) { span_.bytes = bytes; }
+
+    void Finish(const std::string& outcome = "ok") {
+        if (!log_) return;
+        span_.outcome = outcome;
+        span_.endUs = TraceLog::NowUs();
+        log_->Record(span_);
+        log_ = nullptr;
+    }
+
+private:
+    TraceLog* log_;
+    TraceSpan span_;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "jobscheduler.h"
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Export queue in front of the workers. Up to capacity studies are ordered by the
+// scheduler policy; the ones beyond wait in arrival order in an overflow list and move
+// up as workers take jobs. Push never blocks, so Orthanc's change callback returns at
+// once even while every worker is paused on export credits during an upload outage; an
+// overflow entry is only the study's small job record. Not synchronized, the owning
+// queue holds its lock.
+template <typename Job>
+class AdmissionQueue {
+public:
+    void Configure(const SchedulerConfig& config, size_t capacity) {
+        scheduled_.Configure(config);
+        capacity_ = capacity > 0 ? capacity : 1;
+    }
+
+    const SchedulerConfig& Config() const { return scheduled_.Config(); }
+    size_t Capacity() const { return capacity_; }
+
+    // False if the job went to the overflow list. queuedAt as for JobScheduler::Push.
+    bool Push(Job job, uint64_t bytes, const std::string& cls, int64_t queuedAt = -1) {
+        if (queuedAt < 0) queuedAt = JobScheduler<Job>::NowMs();
+        if (overflow_.empty() && scheduled_.Size() < capacity_) {
+            scheduled_.Push(std::move(job), bytes, cls, queuedAt);
+            return true;
+        }
+        overflow_.push_back(Overflowed{ std::move(job), bytes, cls, queuedAt });
+        return false;
+    }
+
+    bool Empty() const { return scheduled_.Empty(); }
+    size_t Scheduled() const { return scheduled_.Size(); }
+    size_t Overflow() const { return overflow_.size(); }
+
+    // Next job by the policy with its latency label and the ms it waited, overflow time
+    // included; the oldest overflow job takes the freed place
+    Job Pop(std::string& label, int64_t& waitedMs) {
+        Job job = scheduled_.Pop(label, waitedMs);
+        if (!overflow_.empty()) {
+            Overflowed& next = overflow_.front();
+            scheduled_.Push(std::move(next.job), next.bytes, next.cls, next.queuedAt);
+            overflow_.pop_front();
+        }
+        return job;
+    }
+
+    // Removes and returns all waiting jobs
+    std::vector<Job> Drain() {
+        std::vector<Job> jobs = scheduled_.Drain();
+        for (auto& entry : overflow_) {
+            jobs.push_back(std::move(entry.job));
+        }
+        overflow_.clear();
+        return jobs;
+    }
+
+private:
+    struct Overflowed {
+        Job job;
+        uint64_t bytes;
+        std::string cls;
+        int64_t queuedAt;  // steady clock ms
+    };
+
+    JobScheduler<Job> scheduled_;
+    std::deque<Overflowed> overflow_;
+    size_t capacity_ = 1;
+};
@@ -0,0 +1,121 @@
+#include "descriptionscan.h"
+
+#include <algorithm>
+
+namespace {
+    // ASCII classes as std::regex sees them in the "C" locale
+    bool IsWord(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    bool IsEmailChar(char c) {
+        return IsWord(c) || c == '.' || c == '-';
+    }
+
+    bool IsSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    // Domain of an email whose '@' is at text[at]: the longest run of email characters
+    // that ends in '.' followed by word characters. Returns the end of the match, 0 if none.
+    size_t MatchDomain(std::string_view text, size_t at) {
+        size_t runEnd = at + 1;
+        while (runEnd < text.size() && IsEmailChar(text[runEnd])) runEnd++;
+
+        // Backtrack to the last dot with at least one domain character before it
+        for (size_t dot = runEnd - 1; dot > at + 1; --dot) {
+            if (text[dot] == '.' && dot + 1 < runEnd && IsWord(text[dot + 1])) {
+                size_t end = dot + 1;
+                while (end < runEnd && IsWord(text[end])) end++;
+                return end;
+            }
+        }
+        return 0;
+    }
+
+    // pw\s*=\s*([^\s]+) anchored at text[at]. Sets the value bounds on a match.
+    bool MatchPassword(std::string_view text, size_t at, size_t& valueBegin, size_t& end) {
+        if (text.compare(at, 2, "pw") != 0) return false;
+        size_t i = at + 2;
+        while (i < text.size() && IsSpace(text[i])) i++;
+        if (i >= text.size() || text[i] != '=') return false;
+        i++;
+        while (i < text.size() && IsSpace(text[i])) i++;
+        valueBegin = i;
+        while (i < text.size() && !IsSpace(text[i])) i++;
+        end = i;
+        return end > valueBegin;
+    }
+
+    // Removes every pw= token in place, left to right like regex_replace
+    void RemovePasswords(std::string& text) {
+        std::string_view view(text);
+        size_t out = 0;
+        size_t i = 0;
+        while (i < view.size()) {
+            size_t valueBegin, end;
+            if (view[i] == 'p' && MatchPassword(view, i, valueBegin, end)) {
+                i = end;
+                continue;
+            }
+            text[out++] = view[i++];
+        }
+        text.resize(out);
+    }
+}
+
+void ScanDescription(std::string_view text, DescriptionTokens& tokens, std::string* cleaned) {
+    tokens.emails.clear();
+    tokens.password = std::string_view();
+    if (cleaned) cleaned->clear();
+
+    size_t runStart = 0;  // start of the current run of email characters
+    size_t copyFrom = 0;  // text not yet copied to cleaned
+    bool passwordFound = false;
+
+    size_t i = 0;
+    while (i < text.size()) {
+        char c = text[i];
+
+        if (!passwordFound && c == 'p') {
+            size_t valueBegin, end;
+            if (MatchPassword(text, i, valueBegin, end)) {
+                tokens.password = text.substr(valueBegin, end - valueBegin);
+                passwordFound = true;
+            }
+        }
+
+        if (c == '@' && runStart < i) {
+            size_t end = MatchDomain(text, i);
+            if (end != 0) {
+                std::string_view email = text.substr(runStart, end - runStart);
+                if (std::find(tokens.emails.begin(), tokens.emails.end(), email) == tokens.emails.end()) {
+                    tokens.emails.push_back(email);
+                }
+                if (cleaned) cleaned->append(text.data() + copyFrom, runStart - copyFrom);
+                copyFrom = end;
+
+                // The next match starts after this one, the password may still begin inside it
+                for (size_t p = i + 1; !passwordFound && p < end; ++p) {
+                    size_t valueBegin, pwEnd;
+                    if (text[p] == 'p' && MatchPassword(text, p, valueBegin, pwEnd)) {
+                        tokens.password = text.substr(valueBegin, pwEnd - valueBegin);
+                        passwordFound = true;
+                    }
+                }
+                i = runStart = end;
+                continue;
+            }
+        }
+
+        i++;
+        if (!IsEmailChar(c)) runStart = i;
+    }
+
+    if (cleaned) {
+        cleaned->append(text.data() + copyFrom, text.size() - copyFrom);
+        RemovePasswords(*cleaned);
+        cleaned->erase(0, cleaned->find_first_not_of(" \t"));
+        cleaned->erase(cleaned->find_last_not_of(" \t") + 1);
+    }
+}
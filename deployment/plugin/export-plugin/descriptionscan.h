@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Recipient and password tokens of a StudyDescription, found without std::regex.
+// Matches what the former patterns matched:
+//   email     ([\w\.-]+@[\w\.-]+\.\w+)
+//   password  pw\s*=\s*([^\s]+)
+struct DescriptionTokens {
+    std::vector<std::string_view> emails;  // distinct, in order of appearance; views into the scanned text
+    std::string_view password;             // value of the first pw= token, empty if none
+};
+
+// One pass over text. Nothing is allocated for descriptions without an email.
+// cleaned, if given, receives the text with all emails, then all pw= tokens removed,
+// trimmed of spaces and tabs.
+void ScanDescription(std::string_view text, DescriptionTokens& tokens, std::string* cleaned = nullptr);
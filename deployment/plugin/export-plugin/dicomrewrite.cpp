@@ -0,0 +1,249 @@
+#include "dicomrewrite.h"
+
+#include <cstring>
+#include <map>
+
+namespace {
+    const uint32_t UNDEFINED_LENGTH = 0xffffffff;
+    const uint32_t ITEM = 0xfffee000;
+    const uint32_t ITEM_DELIMITER = 0xfffee00d;
+    const uint32_t SEQUENCE_DELIMITER = 0xfffee0dd;
+
+    uint16_t Read16(const uint8_t* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    uint32_t Read32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    void Put16(std::string& out, uint16_t v) {
+        out.push_back(static_cast<char>(v & 0xff));
+        out.push_back(static_cast<char>(v >> 8));
+    }
+
+    void Put32(std::string& out, uint32_t v) {
+        Put16(out, static_cast<uint16_t>(v & 0xffff));
+        Put16(out, static_cast<uint16_t>(v >> 16));
+    }
+
+    bool IsLongFormVr(const uint8_t* vr) {
+        static const char* const LONG_VRS[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV" };
+        for (const char* v : LONG_VRS) {
+            if (vr[0] == v[0] && vr[1] == v[1]) return true;
+        }
+        return false;
+    }
+
+    struct Element {
+        uint32_t tag;
+        uint32_t length;
+        size_t headerSize;
+        bool nestedImplicit;  // content of an undefined-length UN is implicit VR
+    };
+
+    class Walker {
+    public:
+        Walker(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+        bool ReadHeader(size_t pos, bool explicitVr, Element& e) const {
+            if (pos + 8 > size_) return false;
+            e.tag = (static_cast<uint32_t>(Read16(data_ + pos)) << 16) | Read16(data_ + pos + 2);
+            e.nestedImplicit = !explicitVr;
+
+            if (!explicitVr || (e.tag >> 16) == 0xfffe) {
+                e.length = Read32(data_ + pos + 4);
+                e.headerSize = 8;
+            } else if (IsLongFormVr(data_ + pos + 4)) {
+                if (pos + 12 > size_) return false;
+                e.nestedImplicit = data_[pos + 4] == 'U' && data_[pos + 5] == 'N';
+                e.length = Read32(data_ + pos + 8);
+                e.headerSize = 12;
+            } else {
+                e.length = Read16(data_ + pos + 6);
+                e.headerSize = 8;
+            }
+            return true;
+        }
+
+        // Returns the position after the element, or 0 on malformed input
+        size_t Skip(size_t pos, bool explicitVr, int depth = 0) const {
+            Element e;
+            if (depth > 32 || !ReadHeader(pos, explicitVr, e)) return 0;
+            pos += e.headerSize;
+            if (e.length != UNDEFINED_LENGTH) {
+                return e.length <= size_ - pos ? pos + e.length : 0;
+            }
+
+            // Undefined length: sequence or encapsulated pixel data, made of items
+            bool nestedExplicit = explicitVr && !e.nestedImplicit;
+            for (;;) {
+                Element item;
+                if (!ReadHeader(pos, false, item)) return 0;
+                pos += 8;
+                if (item.tag == SEQUENCE_DELIMITER) return pos;
+                if (item.tag != ITEM) return 0;
+                if (item.length != UNDEFINED_LENGTH) {
+                    if (item.length > size_ - pos) return 0;
+                    pos += item.length;
+                    continue;
+                }
+                for (;;) {
+                    Element nested;
+                    if (!ReadHeader(pos, false, nested)) return 0;
+                    if (nested.tag == ITEM_DELIMITER) {
+                        pos += 8;
+                        break;
+                    }
+                    pos = Skip(pos, nestedExplicit, depth + 1);
+                    if (pos == 0) return 0;
+                }
+            }
+        }
+
+    private:
+        const uint8_t* data_;
+        size_t size_;
+    };
+
+    void EncodeElement(const TagValue& tag, bool explicitVr, std::string& out) {
+        std::string value = tag.value;
+        if (value.size() % 2 != 0) value.push_back(' ');
+
+        Put16(out, tag.group);
+        Put16(out, tag.element);
+        if (explicitVr) {
+            out.append(tag.vr, 2);
+            Put16(out, static_cast<uint16_t>(value.size()));
+        } else {
+            Put32(out, static_cast<uint32_t>(value.size()));
+        }
+        out += value;
+    }
+
+    // Whether values can be written as they are under the instance's Specific Character Set:
+    // ASCII keeps its meaning under every character set, other text only under ISO_IR 192
+    bool WritableUnder(const std::string& charset, const std::vector<TagValue>& tags) {
+        bool ascii = true;
+        for (const auto& tag : tags) {
+            for (char c : tag.value) {
+                ascii = ascii && static_cast<unsigned char>(c) < 0x80;
+            }
+        }
+        std::string trimmed = charset;
+        trimmed.erase(trimmed.find_last_not_of(std::string("\0 ", 2)) + 1);
+        return ascii || trimmed == "ISO_IR 192";
+    }
+}
+
+std::string ReadTransferSyntax(const uint8_t* data, size_t size) {
+    if (size < 132 || memcmp(data + 128, "DICM", 4) != 0) return "";
+
+    Walker walker(data, size);
+    size_t pos = 132;
+    Element e;
+    while (walker.ReadHeader(pos, true, e) && (e.tag >> 16) == 0x0002) {
+        size_t next = walker.Skip(pos, true);
+        if (next == 0) break;
+        if (e.tag == 0x00020010) {
+            std::string uid(reinterpret_cast<const char*>(data + pos + e.headerSize), e.length);
+            uid.erase(uid.find_last_not_of(std::string("\0 ", 2)) + 1);
+            return uid;
+        }
+        pos = next;
+    }
+    return "";
+}
+
+bool IsCompressedTransferSyntax(const std::string& uid) {
+    return uid.compare(0, 20, "1.2.840.10008.1.2.4.") == 0 ||
+           uid == "1.2.840.10008.1.2.5" ||
+           uid == "1.2.840.10008.1.2.1.99";
+}
+
+bool RewriteTags(const uint8_t* data, size_t size, const std::vector<TagValue>& tags, std::string& out) {
+    if (size < 132 || memcmp(data + 128, "DICM", 4) != 0) return false;
+
+    std::string syntax = ReadTransferSyntax(data, size);
+    if (syntax.empty() || syntax == "1.2.840.10008.1.2.2" || syntax == "1.2.840.10008.1.2.1.99") return false;
+    bool explicitVr = syntax != "1.2.840.10008.1.2";
+
+    // Skip the file meta group, always explicit VR little endian
+    Walker walker(data, size);
+    size_t pos = 132;
+    Element e;
+    while (walker.ReadHeader(pos, true, e) && (e.tag >> 16) == 0x0002) {
+        pos = walker.Skip(pos, true);
+        if (pos == 0) return false;
+    }
+
+    out.clear();
+    out.reserve(size + 128);
+    size_t copyFrom = 0;
+    size_t next = 0;
+    std::map<uint16_t, size_t> groupLengthPos;  // position of the UL value in out
+    std::map<uint16_t, long> groupDelta;
+    std::string charset;     // (0008,0005), read before the first tag is written
+    bool charsetChecked = false;
+
+    auto key = [&](size_t i) { return (static_cast<uint32_t>(tags[i].group) << 16) | tags[i].element; };
+    auto insert = [&](size_t i, size_t oldSize) {
+        if (!charsetChecked) {
+            if (!WritableUnder(charset, tags)) return false;
+            charsetChecked = true;
+        }
+        size_t before = out.size();
+        EncodeElement(tags[i], explicitVr, out);
+        groupDelta[tags[i].group] += static_cast<long>(out.size() - before) - static_cast<long>(oldSize);
+        return true;
+    };
+
+    while (next < tags.size() && pos < size) {
+        if (!walker.ReadHeader(pos, explicitVr, e)) return false;
+        size_t end = walker.Skip(pos, explicitVr);
+        if (end == 0) return false;
+
+        while (next < tags.size() && key(next) < e.tag) {
+            out.append(reinterpret_cast<const char*>(data + copyFrom), pos - copyFrom);
+            copyFrom = pos;
+            if (!insert(next++, 0)) return false;
+        }
+
+        if (next < tags.size() && key(next) == e.tag) {
+            out.append(reinterpret_cast<const char*>(data + copyFrom), pos - copyFrom);
+            if (!insert(next++, end - pos)) return false;
+            copyFrom = end;
+        } else if (e.tag == 0x00080005) {
+            charset.assign(reinterpret_cast<const char*>(data + pos + e.headerSize), e.length);
+        } else if ((e.tag & 0xffff) == 0 && e.length == 4) {
+            groupLengthPos[static_cast<uint16_t>(e.tag >> 16)] = out.size() + (pos - copyFrom) + e.headerSize;
+        }
+        pos = end;
+    }
+
+    out.append(reinterpret_cast<const char*>(data + copyFrom), size - copyFrom);
+    while (next < tags.size()) {
+        if (!insert(next++, 0)) return false;
+    }
+
+    for (const auto& g : groupLengthPos) {
+        auto delta = groupDelta.find(g.first);
+        if (delta == groupDelta.end() || delta->second == 0) continue;
+        uint32_t length = Read32(reinterpret_cast<const uint8_t*>(out.data() + g.second)) + static_cast<uint32_t>(delta->second);
+        std::string encoded;
+        Put32(encoded, length);
+        out.replace(g.second, 4, encoded);
+    }
+    return true;
+}
+
+std::string TruncateUtf8(const std::string& value, size_t maxChars) {
+    size_t chars = 0;
+    for (size_t i = 0; i < value.size(); ++i) {
+        // Continuation bytes (10xxxxxx) belong to the character before
+        if ((static_cast<unsigned char>(value[i]) & 0xc0) != 0x80 && chars++ == maxChars) {
+            return value.substr(0, i);
+        }
+    }
+    return value;
+}
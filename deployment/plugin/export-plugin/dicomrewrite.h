@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Byte-level helpers on DICOM Part 10 files, without a DICOM toolkit
+
+// Transfer syntax UID from the file meta group (0002,0010), empty if absent
+std::string ReadTransferSyntax(const uint8_t* data, size_t size);
+
+// JPEG family (baseline to JPEG 2000, JPEG-LS, MPEG, HEVC, JPEG XL, HTJ2K), RLE and deflated syntaxes
+bool IsCompressedTransferSyntax(const std::string& uid);
+
+struct TagValue {
+    uint16_t group;
+    uint16_t element;
+    const char* vr;     // short-form string VR, e.g. "LO"
+    std::string value;  // unpadded
+};
+
+// Replaces, or inserts if missing, top-level string elements of an implicit or
+// explicit VR little endian file. Tags must be sorted. Group length elements of
+// the touched groups are kept consistent. Values are UTF-8 and written as they
+// are: values with non-ASCII characters need a file declaring ISO_IR 192, and
+// tags must come after (0008,0005). Returns false for non-ASCII values under
+// other character sets, for big endian or deflated files and for input it
+// cannot walk.
+bool RewriteTags(const uint8_t* data, size_t size, const std::vector<TagValue>& tags, std::string& out);
+
+// At most maxChars characters of a UTF-8 string, never cutting a multi-byte sequence
+std::string TruncateUtf8(const std::string& value, size_t maxChars);
@@ -1,6 +1,17 @@
 #define HAS_ORTHANC_EXCEPTION 1
 
 #include <OrthancCPlugin.h>
+#include "zipwriter.h"
+#include "dicomrewrite.h"
+#include "descriptionscan.h"
+#include "mappinglog.h"
+#include "jobscheduler.h"
+#include "admission.h"
+#include "flowcontrol.h"
+#include "pipelinemetrics.h"
+#include "tracing.h"
+#include "tracemerge.h"
+#include "orthancrest.h"
 #include <json/value.h>
 #include <json/reader.h>
 #include <json/writer.h>
@@ -9,83 +20,97 @@
 #include <string>
 #include <sstream>
 #include <cctype>
+#include <cmath>
 #include <chrono>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <algorithm>
 #include <set>
-#include <regex>
+#include <map>
+#include <memory>
+#include <functional>
+#include <tuple>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstring>
 #include <iomanip>
 
-const std::regex EMAIL_REGEX(R"(([\w\.-]+@[\w\.-]+\.\w+))");
-const std::regex PASSWORD_REGEX(R"(pw\s*=\s*([^\s]+))");
+// Only needed for the HTTP transport
 std::string GetOrthancUrl() {
     const char* envUrl = std::getenv("ORTHANC_URL");
-    if (!envUrl) {
-        throw std::runtime_error("Umgebungsvariable ORTHANC_URL nicht gesetzt!");
-    }
-    return std::string(envUrl);
+    return envUrl ? std::string(envUrl) : std::string();
 }
 const std::string ORTHANC_URL = GetOrthancUrl();
 
+static int GetEnvInt(const char* name, int defaultValue) {
+    const char* value = std::getenv(name);
+    if (!value || !*value) return defaultValue;
+    try {
+        return std::stoi(value);
+    } catch (const std::exception&) {
+        return defaultValue;
+    }
+}
+
 OrthancPluginContext* globalContext = NULL;
-std::set<std::string> activeStudies;
+std::set<std::string> activeStudies;  // queued or running
 std::mutex mutex;
+std::unique_ptr<DeflatePool> deflatePool;  // null: single-threaded compression
 
-// libcurl callback
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-    ((std::string*)userp)->append((char*)contents, size * nmemb);
-    return size * nmemb;
-}
+// Export stage of the pipeline metrics, published by OnRefreshMetrics
+struct ExportMetrics {
+    LatencyHistogram metadata;  // study and patient lookup
+    LatencyHistogram modify;    // /modify of the description, EXPORT_TAG_REWRITE=modify only
+    LatencyHistogram archive;   // writing the encrypted ZIP
+    LatencyHistogram encrypt;   // ZipCrypto part of archive
+    LatencyHistogram enqueue;   // /send to QueuePlugin
+    LatencyHistogram total;     // stable study to archive queued
+    MetricCounter exported;
+    MetricCounter archiveBytes;
+    MetricCounter failedMetadata;
+    MetricCounter failedModify;
+    MetricCounter failedArchive;
+    MetricCounter failedCommit;
+    MetricCounter failedEnqueue;
+};
+ExportMetrics exportMetrics;
 
-// HTTP functions
-std::string httpGet(const std::string& url) {
-    CURL* curl = curl_easy_init();
-    std::string response;
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-    }
-    return response;
-}
+// Spans of the export stages, see tracing.h
+TraceLog tracer("ExportPlugin");
+
+// Orthanc REST API, in-process unless EXPORT_REST_TRANSPORT=http and ORTHANC_URL are set
+OrthancRest rest;
 
-std::string httpPost(const std::string& url, const std::string& data, const std::string& contentType, bool acceptDicom = false) {
-    CURL* curl = curl_easy_init();
-    std::string response;
-    if (curl) {
-        struct curl_slist* headers = nullptr;
-        headers = curl_slist_append(headers, ("Content-Type: " + contentType).c_str());
-        if (acceptDicom) headers = curl_slist_append(headers, "Accept: application/dicom");
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
-        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, data.size());
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        curl_easy_perform(curl);
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-    }
-    return response;
+// Peak resident set size of the Orthanc process in MB
+static long PeakRssMb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+    return usage.ru_maxrss / 1024;
 }
 
-void httpDelete(const std::string& url) {
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_perform(curl);
-        curl_easy_cleanup(curl);
-    }
+// Wall clock in ms since epoch, comparable across plugins
+static int64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+// Value of the first "ID": "..." member of a REST answer
 std::string extractId(const std::string& json) {
-    std::regex re("\"ID\"\\s*:\\s*\"([^\"]+)\"");
-    std::smatch match;
-    return std::regex_search(json, match, re) ? match[1].str() : "";
+    for (size_t pos = json.find("\"ID\""); pos != std::string::npos; pos = json.find("\"ID\"", pos + 1)) {
+        size_t i = json.find_first_not_of(" \t\r\n", pos + 4);
+        if (i == std::string::npos || json[i] != ':') continue;
+        i = json.find_first_not_of(" \t\r\n", i + 1);
+        if (i == std::string::npos || json[i] != '"') continue;
+        size_t end = json.find('"', i + 1);
+        if (end != std::string::npos && end > i + 1) return json.substr(i + 1, end - i - 1);
+    }
+    return "";
 }
 
 static std::string Sanitize(const std::string& input) {
@@ -98,22 +123,6 @@ static std::string Sanitize(const std::string& input) {
     return result;
 }
 
-// Extract ALL emails from text dynamically
-std::vector<std::string> extractAllEmails(const std::string& text) {
-    std::vector<std::string> emails;
-    std::sregex_iterator start(text.begin(), text.end(), EMAIL_REGEX);
-    std::sregex_iterator end;
-    
-    for (std::sregex_iterator it = start; it != end; ++it) {
-        std::string email = it->str(1);
-        // avoid duplicate
-        if (std::find(emails.begin(), emails.end(), email) == emails.end()) {
-            emails.push_back(email);
-        }
-    }
-    return emails;
-}
-
 //  Clean StudyDescription
 bool CleanStudyDescriptionOnly(const std::string& studyId, const std::string& cleanDescription, std::string& newStudyIdOut) {
     Json::Value payload;
@@ -122,97 +131,397 @@ bool CleanStudyDescriptionOnly(const std::string& studyId, const std::string& cl
     payload["Force"] = true;
 
     Json::StreamWriterBuilder writer;
-    std::string modifyResponse = httpPost(ORTHANC_URL + "/studies/" + studyId + "/modify", 
-                                         Json::writeString(writer, payload), "application/json");
+    std::string modifyResponse = rest.Post("/studies/" + studyId + "/modify", Json::writeString(writer, payload));
     
     newStudyIdOut = extractId(modifyResponse);
     return !newStudyIdOut.empty();
 }
-// Support multiple emails
-bool UpdateMappingFileAtomic(const std::string& filename, const std::vector<std::string>& emails) {
-    std::string tempMappingFile = "/exports/.mapping_temp.json";
-    std::string finalMappingFile = "/exports/mapping.json";
-    
-    std::vector<std::string> existingEntries;
-    std::ifstream existingFile(finalMappingFile);
-    if (existingFile.is_open()) {
-        std::string line;
-        while (std::getline(existingFile, line)) {
-            if (!line.empty()) {
-                existingEntries.push_back(line);
-            }
-        }
-        existingFile.close();
+// Write archives straight into /mailqueue instead of /exports, so QueuePlugin has nothing to move
+bool writeToQueue = false;
+
+// Compression policy: entries that will not shrink are stored instead of deflated
+enum CompressionPolicy {
+    Policy_Auto,     // by transfer syntax, then by sampled entropy
+    Policy_Deflate,
+    Policy_Store
+};
+CompressionPolicy compressionPolicy = Policy_Auto;
+double storeEntropyThreshold = 7.5;  // bits per byte
+
+struct PolicyStats {
+    size_t storedBySyntax = 0;
+    size_t storedByEntropy = 0;
+};
+
+// Shannon entropy over a few windows spread over the second half, where pixel data lives
+double SampleEntropy(const uint8_t* data, size_t size) {
+    const size_t window = 16 * 1024;
+    const size_t offsets[] = { size / 2, size * 7 / 10, size * 9 / 10 };
+    size_t histogram[256] = { 0 };
+    size_t total = 0;
+    for (size_t offset : offsets) {
+        size_t n = std::min(window, size - offset);
+        for (size_t i = 0; i < n; ++i) histogram[data[offset + i]]++;
+        total += n;
     }
-    
-    std::ofstream tempMapping(tempMappingFile);
-    if (!tempMapping.is_open()) {
-        OrthancPluginLogError(globalContext, "Failed to create temp mapping file");
-        return false;
+    if (total == 0) return 0;
+
+    double entropy = 0;
+    for (size_t count : histogram) {
+        if (count == 0) continue;
+        double p = static_cast<double>(count) / total;
+        entropy -= p * std::log2(p);
     }
-    
-    // Write existing entries
-    for (const auto& entry : existingEntries) {
-        tempMapping << entry << "\n";
+    return entropy;
+}
+
+ZipWriter::Method ChooseCompression(const void* dicom, size_t size, PolicyStats& stats) {
+    switch (compressionPolicy) {
+        case Policy_Store:
+            return ZipWriter::Method_Store;
+        case Policy_Deflate:
+            return ZipWriter::Method_Deflate;
+        default:
+            break;
     }
-    
-    // Create separate entry for each email
-    for (const auto& email : emails) {
-        tempMapping << "{\"file\": \"" << filename << "\", \"email\": \"" << email << "\"}\n";
+
+    const uint8_t* data = static_cast<const uint8_t*>(dicom);
+    if (IsCompressedTransferSyntax(ReadTransferSyntax(data, size))) {
+        stats.storedBySyntax++;
+        return ZipWriter::Method_Store;
     }
-    tempMapping.close();
-    
-    if (rename(tempMappingFile.c_str(), finalMappingFile.c_str()) != 0) {
-        OrthancPluginLogError(globalContext, "Failed to update mapping file atomically");
-        std::remove(tempMappingFile.c_str());
-        return false;
+    if (size >= 256 * 1024 && SampleEntropy(data, size) >= storeEntropyThreshold) {
+        stats.storedByEntropy++;
+        return ZipWriter::Method_Store;
     }
-    
-    return true;
+    return ZipWriter::Method_Deflate;
 }
 
-// Dynamic send function for multiple recipients
-void sendToAllRecipients(const std::string& studyId, const std::string& finalFilename, const std::vector<std::string>& emails) {
-    for (size_t i = 0; i < emails.size(); ++i) {
-        const std::string& email = emails[i];
-        
-        std::string payload = "studyId=" + studyId + "&file=" + finalFilename + "&email=" + email;
-        
-        OrthancPluginLogInfo(globalContext, ("Calling QueuePlugin for recipient " + std::to_string(i+1) + "/" + std::to_string(emails.size()) + ": " + email).c_str());
-        
-        std::string queueUrl = ORTHANC_URL + "/send";
-        std::string curlCmd = "curl -X POST "
-                             "-H \"Content-Type: application/x-www-form-urlencoded\" "
-                             "-d \"" + payload + "\" "
-                             "\"" + queueUrl + "\" "
-                             "--max-time 30 --retry 3 --retry-delay 1 -v";
-        
-        OrthancPluginLogInfo(globalContext, ("Executing curl command: " + curlCmd).c_str());
-        
-        int curlResult = system(curlCmd.c_str());
-        if (curlResult != 0) {
-            OrthancPluginLogError(globalContext, ("QueuePlugin call failed for " + email + " with code: " + std::to_string(curlResult)).c_str());
-        } else {
-            OrthancPluginLogInfo(globalContext, ("QueuePlugin call completed successfully for: " + email).c_str());
+struct ArchiveEntry {
+    std::string instanceId;
+    std::string name;
+    std::string modality;
+};
+
+// Flat archive layout: one <series>_<label>_<instance>.dcm entry per instance, ordered by series and instance number
+std::vector<ArchiveEntry> ListArchiveEntries(const std::string& studyId) {
+    std::vector<ArchiveEntry> result;
+    Json::CharReaderBuilder reader;
+    std::string errs;
+
+    Json::Value series;
+    std::istringstream ss(rest.Get("/studies/" + studyId + "/series"));
+    if (!Json::parseFromStream(reader, ss, &series, &errs) || !series.isArray()) return result;
+
+    Json::Value instances;
+    std::istringstream is(rest.Get("/studies/" + studyId + "/instances"));
+    if (!Json::parseFromStream(reader, is, &instances, &errs) || !instances.isArray()) return result;
+
+    struct SeriesInfo {
+        int number;
+        std::string label;
+        std::string modality;
+    };
+    std::map<std::string, SeriesInfo> seriesById;
+    for (const auto& s : series) {
+        const Json::Value& tags = s["MainDicomTags"];
+        std::string modality = tags.get("Modality", "").asString();
+        std::string label = tags.get("SeriesDescription", "").asString();
+        if (label.empty()) label = modality.empty() ? "series" : modality;
+        seriesById[s["ID"].asString()] = SeriesInfo{ std::atoi(tags.get("SeriesNumber", "0").asString().c_str()), Sanitize(label), modality };
+    }
+
+    struct SortKey {
+        int series;
+        std::string seriesId;
+        int instance;
+        std::string instanceId;
+        bool operator<(const SortKey& o) const {
+            return std::tie(series, seriesId, instance, instanceId) < std::tie(o.series, o.seriesId, o.instance, o.instanceId);
         }
-        
-        if (i < emails.size() - 1) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    };
+    std::vector<SortKey> keys;
+    for (const auto& i : instances) {
+        std::string seriesId = i["ParentSeries"].asString();
+        keys.push_back(SortKey{ seriesById[seriesId].number, seriesId,
+                                std::atoi(i["MainDicomTags"].get("InstanceNumber", "0").asString().c_str()), i["ID"].asString() });
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::set<std::string> usedNames;
+    for (const auto& key : keys) {
+        std::ostringstream name;
+        name << std::setfill('0') << std::setw(3) << key.series << "_" << seriesById[key.seriesId].label << "_"
+             << std::setw(5) << key.instance;
+        std::string candidate = name.str() + ".dcm";
+        for (int n = 2; usedNames.count(candidate); ++n) {
+            candidate = name.str() + "_" + std::to_string(n) + ".dcm";
         }
+        usedNames.insert(candidate);
+        result.push_back(ArchiveEntry{ key.instanceId, candidate, seriesById[key.seriesId].modality });
     }
+    return result;
 }
 
-// Main export function with race condition fixes and multi-email support
-void ExportStudy(const std::string& studyId) {
+// Instance bytes, owned either by the Orthanc core or by the plugin (rewritten instances)
+struct DicomData {
+    OrthancPluginMemoryBuffer buffer{ nullptr, 0 };
+    std::string bytes;
+
+    ~DicomData() {
+        if (buffer.data) OrthancPluginFreeMemoryBuffer(globalContext, &buffer);
+    }
+
+    const void* Data() const { return buffer.data ? buffer.data : bytes.data(); }
+    size_t Size() const { return buffer.data ? buffer.size : bytes.size(); }
+};
+typedef std::shared_ptr<DicomData> DicomBuffer;
+
+// StudyDescription and StudyID are either set by /studies/{id}/modify, which stores
+// a full copy of the study, or rewritten in each instance on its way into the archive.
+// Stream is opt-in since it deletes the study that Orthanc would otherwise keep cleaned.
+enum TagRewriteMode {
+    TagRewrite_Modify,
+    TagRewrite_Stream
+};
+TagRewriteMode tagRewriteMode = TagRewrite_Modify;
+
+std::vector<TagValue> CleanedStudyTags(const std::string& cleanDescription) {
+    return {
+        TagValue{ 0x0008, 0x1030, "LO", TruncateUtf8(cleanDescription, 64) },
+        TagValue{ 0x0020, 0x0010, "SH", TruncateUtf8(cleanDescription, 16) }
+    };
+}
+
+// Rewrites the tags in the instance bytes; files the byte-level rewriter cannot walk
+// or whose character set it cannot write go through /instances/{id}/modify, which converts
+// the values and answers the modified file without storing it
+bool RewriteInstance(DicomBuffer& dicom, const std::string& instanceId, const std::vector<TagValue>& tags) {
+    DicomBuffer rewritten = std::make_shared<DicomData>();
+    if (RewriteTags(static_cast<const uint8_t*>(dicom->Data()), dicom->Size(), tags, rewritten->bytes)) {
+        dicom = rewritten;
+        return true;
+    }
+
+    Json::Value payload;
+    for (const auto& tag : tags) {
+        payload["Replace"][tag.group == 0x0008 ? "StudyDescription" : "StudyID"] = tag.value;
+    }
+    payload["Force"] = true;
+    Json::StreamWriterBuilder writer;
+    rewritten->bytes = rest.Post("/instances/" + instanceId + "/modify", Json::writeString(writer, payload));
+    if (rewritten->bytes.empty()) return false;
+    dicom = rewritten;
+    return true;
+}
+
+// Optional lossless transcoding before archiving, configured per modality
+std::map<std::string, std::string> transcodeSyntaxByModality;
+std::unique_ptr<TaskPool> transcodePool;
+size_t transcodeInFlight = 0;  // instances queued ahead of the zip writer
+
+struct TranscodeStats {
+    std::atomic<size_t> instances{0};
+    std::atomic<size_t> failures{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+};
+
+// Returns the transcoded instance, or the source if transcoding fails or does not shrink it
+DicomBuffer TranscodeInstance(const DicomBuffer& source, const std::string& syntax, TranscodeStats& stats) {
+    OrthancPluginDicomInstance* instance = OrthancPluginTranscodeDicomInstance(globalContext, source->Data(), source->Size(), syntax.c_str());
+    DicomBuffer result = std::make_shared<DicomData>();
+    bool ok = instance != nullptr &&
+              OrthancPluginSerializeDicomInstance(globalContext, &result->buffer, instance) == OrthancPluginErrorCode_Success;
+    if (instance) OrthancPluginFreeDicomInstance(globalContext, instance);
+
+    stats.instances++;
+    stats.bytesIn += source->Size();
+    if (!ok || result->Size() >= source->Size()) {
+        if (!ok) stats.failures++;
+        stats.bytesOut += source->Size();
+        return source;
+    }
+    stats.bytesOut += result->Size();
+    return result;
+}
+
+static std::string TranscodeSyntaxAlias(const std::string& name) {
+    if (name == "jpeg-ls") return "1.2.840.10008.1.2.4.80";
+    if (name == "jpeg2000") return "1.2.840.10008.1.2.4.90";
+    if (name == "jpeg-lossless") return "1.2.840.10008.1.2.4.70";
+    if (name == "rle") return "1.2.840.10008.1.2.5";
+    return name;
+}
+
+// EXPORT_TRANSCODE="CT:jpeg-ls,MR:jpeg2000" (aliases or transfer syntax UIDs)
+void ParseTranscodeConfig(const std::string& config) {
+    std::istringstream ss(config);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == item.size()) continue;
+        transcodeSyntaxByModality[item.substr(0, colon)] = TranscodeSyntaxAlias(item.substr(colon + 1));
+    }
+}
+
+// Builds the password-protected archive in one pass, one instance in memory at a time.
+// rewriteTags, if set, are applied to every instance on the way into the archive.
+bool WriteStudyArchive(const std::string& studyId, const std::string& path, const std::string& password,
+                       const std::vector<TagValue>* rewriteTags = nullptr) {
+    StageTimer archiveTimer(exportMetrics.archive);
+    std::vector<ArchiveEntry> entries = ListArchiveEntries(studyId);
+    if (entries.empty()) {
+        OrthancPluginLogWarning(globalContext, ("No instances found for study " + studyId).c_str());
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    // Appears under path only once complete and fsync'd
+    FileSink sink(path, true);
+    if (!sink.IsOpen()) {
+        OrthancPluginLogError(globalContext, ("Failed to create file: " + path).c_str());
+        return false;
+    }
+
+    ZipWriter zip(sink, password);
+    size_t threads = deflatePool ? deflatePool->Threads() : 1;
+    PolicyStats policyStats;
+    TranscodeStats transcodeStats;
+    bool ok = true;
     {
-        std::lock_guard<std::mutex> lock(mutex);
-        if (activeStudies.find(studyId) != activeStudies.end()) {
-            OrthancPluginLogInfo(globalContext, ("Export already in progress for study: " + studyId).c_str());
-            return;
+        // At most two instances per compression thread are held in memory
+        ParallelZipWriter writer(zip, deflatePool.get(), 2 * threads);
+
+        // Instances waiting for transcoding, in archive order
+        std::deque<std::pair<const ArchiveEntry*, std::future<DicomBuffer>>> pending;
+        auto writeFront = [&]() {
+            const ArchiveEntry* entry = pending.front().first;
+            DicomBuffer dicom = pending.front().second.get();
+            pending.pop_front();
+            ZipWriter::Method method = ChooseCompression(dicom->Data(), dicom->Size(), policyStats);
+            if (!writer.Add(entry->name, dicom->Data(), dicom->Size(), [dicom]() mutable { dicom.reset(); }, method)) {
+                OrthancPluginLogError(globalContext, ("Failed to add " + entry->name + " to " + path).c_str());
+                return false;
+            }
+            return true;
+        };
+
+        for (const auto& entry : entries) {
+            DicomBuffer dicom = std::make_shared<DicomData>();
+            if (OrthancPluginGetDicomForInstance(globalContext, &dicom->buffer, entry.instanceId.c_str()) != OrthancPluginErrorCode_Success) {
+                OrthancPluginLogError(globalContext, ("Failed to read instance " + entry.instanceId).c_str());
+                ok = false;
+                break;
+            }
+            if (rewriteTags && !RewriteInstance(dicom, entry.instanceId, *rewriteTags)) {
+                OrthancPluginLogError(globalContext, ("Failed to rewrite study tags of instance " + entry.instanceId).c_str());
+                ok = false;
+                break;
+            }
+
+            auto syntax = transcodeSyntaxByModality.find(entry.modality);
+            if (transcodePool && syntax != transcodeSyntaxByModality.end() &&
+                !IsCompressedTransferSyntax(ReadTransferSyntax(static_cast<const uint8_t*>(dicom->Data()), dicom->Size()))) {
+                std::string target = syntax->second;
+                pending.emplace_back(&entry, transcodePool->Submit([dicom, target, &transcodeStats] {
+                    return TranscodeInstance(dicom, target, transcodeStats);
+                }));
+            } else {
+                std::promise<DicomBuffer> ready;
+                ready.set_value(dicom);
+                pending.emplace_back(&entry, ready.get_future());
+            }
+
+            while (ok && pending.size() > transcodeInFlight) {
+                ok = writeFront();
+            }
+            if (!ok) break;
         }
-        activeStudies.insert(studyId);
+        while (ok && !pending.empty()) {
+            ok = writeFront();
+        }
+        // Transcoding tasks still reference transcodeStats
+        for (auto& p : pending) p.second.wait();
+
+        ok = ok && writer.Flush();
     }
-    
+
+    ok = ok && zip.Finish();
+    if (!ok) sink.Abort();
+    ok = sink.Close() && ok;
+    if (!ok) {
+        std::remove(path.c_str());
+        return false;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    exportMetrics.encrypt.Observe(static_cast<int64_t>(zip.EncryptSeconds() * 1000));
+    exportMetrics.archiveBytes.Add(sink.BytesWritten());
+    std::ostringstream rate;
+    rate << std::fixed << std::setprecision(1) << zip.EntryCount() << " instances, " << (zip.UncompressedBytes() / 1048576.0) << " MB -> "
+         << (sink.BytesWritten() / 1048576.0) << " MB in " << seconds << " s ("
+         << (seconds > 0 ? zip.UncompressedBytes() / 1048576.0 / seconds : 0.0) << " MB/s, " << threads
+         << " compression threads), peak RSS " << PeakRssMb() << " MB";
+    OrthancPluginLogInfo(globalContext, ("Archive written to " + path + ": " + rate.str()).c_str());
+
+    std::ostringstream compression;
+    compression << std::fixed << std::setprecision(2)
+                << "ratio " << (zip.CompressedBytes() > 0 ? static_cast<double>(zip.UncompressedBytes()) / zip.CompressedBytes() : 0.0)
+                << ", deflate CPU " << zip.DeflateCpuSeconds() << " s, " << zip.StoredEntries() << "/" << zip.EntryCount()
+                << " entries stored (" << policyStats.storedBySyntax << " by transfer syntax, " << policyStats.storedByEntropy << " by entropy)";
+    OrthancPluginLogInfo(globalContext, ("Compression for " + path + ": " + compression.str()).c_str());
+
+    if (transcodeStats.instances > 0) {
+        std::ostringstream transcoding;
+        transcoding << std::fixed << std::setprecision(1) << transcodeStats.instances << " instances, "
+                    << (transcodeStats.bytesIn / 1048576.0) << " MB -> " << (transcodeStats.bytesOut / 1048576.0) << " MB (saved "
+                    << ((transcodeStats.bytesIn - transcodeStats.bytesOut) / 1048576.0) << " MB, "
+                    << (seconds > 0 ? transcodeStats.bytesIn / 1048576.0 / seconds : 0.0) << " MB/s), "
+                    << transcodeStats.failures << " kept in original syntax";
+        OrthancPluginLogInfo(globalContext, ("Transcoding for " + path + ": " + transcoding.str()).c_str());
+    }
+    return true;
+}
+
+// One record per archive, the uploader looks archives up by file name
+MappingLog mappingLog("/exports/mapping.json", "/mailqueue");
+
+// Durability points for published archives, instead of a global sync()
+GroupCommit exportsDirectoryCommit;
+GroupCommit queueDirectoryCommit;
+
+// Hands the archive to QueuePlugin's /send route once for all recipients (they are in
+// the mapping log). In-process through the plugin SDK, so no shell, curl process or
+// loopback HTTP; /send answers OK again for an archive it has already queued.
+bool EnqueueArchive(const std::string& studyId, const std::string& finalFilename, const std::vector<std::string>& emails,
+                    const std::string& trace) {
+    std::string recipients;
+    for (const auto& email : emails) {
+        recipients += (recipients.empty() ? "" : ",") + email;
+    }
+    std::string payload = "studyId=" + studyId + "&file=" + finalFilename + "&email=" + recipients + "&trace=" + trace;
+    TraceScope span(tracer, trace, "enqueue", finalFilename);
+
+    auto start = std::chrono::steady_clock::now();
+    bool ok = rest.PostForm("/send", payload) == "OK";
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    exportMetrics.enqueue.Observe(micros / 1000);
+
+    if (!ok) {
+        OrthancPluginLogError(globalContext, ("QueuePlugin /send failed for " + finalFilename).c_str());
+        return false;
+    }
+    span.Finish();
+    OrthancPluginLogInfo(globalContext, ("Queued " + finalFilename + " for " + std::to_string(emails.size()) + " recipients in " +
+                                         std::to_string(micros) + " us (" + rest.TransportName() + ")").c_str());
+    return true;
+}
+
+// Main export function with race condition fixes and multi-email support
+// activeStudies entry is taken by ExportQueue::Enqueue; cls is the scheduling class and trace
+// the trace id, both passed on to the uploader
+void ExportStudy(const std::string& studyId, int64_t stableAt, const std::string& cls, const std::string& trace) {
     // Cleanup guard for activeStudies
     struct ActiveStudyGuard {
         std::string studyId;
@@ -222,22 +531,28 @@ void ExportStudy(const std::string& studyId) {
         }
     } guard{studyId};
     
+    OrthancRest::ThreadStats() = OrthancRest::Stats();
+    TraceScope exportSpan(tracer, trace, "export", studyId);
+    StageTimer metadataTimer(exportMetrics.metadata);
+    TraceScope metadataSpan(tracer, trace, "metadata", studyId);
+    
     // Get study info
-    std::string studyResponse = httpGet(ORTHANC_URL + "/studies/" + studyId);
-    if (studyResponse.empty()) return;
-
+    std::string studyResponse = rest.Get("/studies/" + studyId);
     Json::Value studyInfo;
     Json::CharReaderBuilder reader;
     std::string errs;
     std::istringstream s(studyResponse);
-    if (!Json::parseFromStream(reader, s, &studyInfo, &errs)) return;
+    if (studyResponse.empty() || !Json::parseFromStream(reader, s, &studyInfo, &errs)) {
+        exportMetrics.failedMetadata.Add();
+        return;
+    }
 
     std::string description = studyInfo["MainDicomTags"].get("StudyDescription", "").asString();
     
     // Get original patient info
     std::string originalPatientId = "Unknown";
     if (studyInfo.isMember("ParentPatient")) {
-        std::string patientResponse = httpGet(ORTHANC_URL + "/patients/" + studyInfo["ParentPatient"].asString());
+        std::string patientResponse = rest.Get("/patients/" + studyInfo["ParentPatient"].asString());
         if (!patientResponse.empty()) {
             Json::Value patientInfo;
             std::istringstream ps(patientResponse);
@@ -248,25 +563,24 @@ void ExportStudy(const std::string& studyId) {
     }
 
     std::string studyDate = studyInfo["MainDicomTags"].get("StudyDate", "nodate").asString();
+    metadataTimer.Stop();
+    metadataSpan.Finish();
 
-    // Extract all emails and password dynamically
-    std::vector<std::string> emails = extractAllEmails(description);
-    std::smatch pwMatch;
-    std::string password = std::regex_search(description, pwMatch, PASSWORD_REGEX) ? pwMatch.str(1) : "default123";
+    // Extract all emails, the password and the cleaned description in one scan
+    DescriptionTokens tokens;
+    std::string cleanedDescription;
+    ScanDescription(description, tokens, &cleanedDescription);
+    std::vector<std::string> emails(tokens.emails.begin(), tokens.emails.end());
+    std::string password = tokens.password.empty() ? "default123" : std::string(tokens.password);
     
     if (emails.empty()) {
         OrthancPluginLogError(globalContext, "No email found in StudyDescription");
+        exportSpan.Finish("no recipients");
         return;
     }
 
     OrthancPluginLogInfo(globalContext, ("Found " + std::to_string(emails.size()) + " email recipients").c_str());
 
-    // Clean description first (for filename calculation)
-    std::string cleanedDescription = std::regex_replace(description, EMAIL_REGEX, "");
-    cleanedDescription = std::regex_replace(cleanedDescription, PASSWORD_REGEX, "");
-    cleanedDescription.erase(0, cleanedDescription.find_first_not_of(" \t"));
-    cleanedDescription.erase(cleanedDescription.find_last_not_of(" \t") + 1);
-
     // Add timestamp for unique filenames
     auto now = std::chrono::system_clock::now();
     auto time_t = std::chrono::system_clock::to_time_t(now);
@@ -277,101 +591,488 @@ void ExportStudy(const std::string& studyId) {
     timestampStr << "_" << std::setfill('0') << std::setw(3) << ms.count();
 
     std::string filenameBase = Sanitize(originalPatientId) + "_" + Sanitize(studyDate) + "_" + Sanitize(cleanedDescription) + "_" + timestampStr.str();
-    std::string tempZipPath = "/exports/." + filenameBase + "_temp.zip";
-    std::string finalZipPath = "/exports/" + filenameBase + ".zip";
     std::string finalFilename = filenameBase + ".zip";
+    std::string finalZipPath = (writeToQueue ? "/mailqueue/" : "/exports/") + finalFilename;
 
     std::string newStudyId;
-    if (!CleanStudyDescriptionOnly(studyId, cleanedDescription, newStudyId)) {
-        OrthancPluginLogError(globalContext, "Study description cleaning failed");
-        return;
-    }
-
-    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
-    
-    // Download ZIP from cleaned study
-    std::string zipData = httpGet(ORTHANC_URL + "/studies/" + newStudyId + "/archive");
-    
-    // Fallback to original if necessary
-    if (zipData.empty()) {
-        OrthancPluginLogWarning(globalContext, "Cleaned study ZIP failed, using original");
-        zipData = httpGet(ORTHANC_URL + "/studies/" + studyId + "/archive");
-    }
-    
-    if (zipData.empty()) {
-        OrthancPluginLogError(globalContext, "Failed to create ZIP archive");
-        return;
+    if (tagRewriteMode == TagRewrite_Modify) {
+        StageTimer modifyTimer(exportMetrics.modify);
+        TraceScope modifySpan(tracer, trace, "modify", studyId);
+        bool cleaned = CleanStudyDescriptionOnly(studyId, cleanedDescription, newStudyId);
+        modifyTimer.Stop();
+        if (!cleaned) {
+            OrthancPluginLogError(globalContext, "Study description cleaning failed");
+            exportMetrics.failedModify.Add();
+            return;
+        }
+        modifySpan.Finish();
     }
 
-    std::ofstream tempFile(tempZipPath, std::ios::binary);
-    if (!tempFile) {
-        OrthancPluginLogError(globalContext, "Failed to create temp ZIP file");
-        return;
+    bool written = false;
+    TraceScope archiveSpan(tracer, trace, "archive", finalFilename);
+    if (tagRewriteMode == TagRewrite_Stream) {
+        // Write encrypted ZIP of the study, cleaning the tags while streaming
+        std::vector<TagValue> cleanedTags = CleanedStudyTags(cleanedDescription);
+        written = WriteStudyArchive(studyId, finalZipPath, password, &cleanedTags);
+    } else {
+        // /modify answers once the cleaned study is stored, it can be read right away
+        // Write encrypted ZIP of cleaned study
+        written = WriteStudyArchive(newStudyId, finalZipPath, password);
+        
+        // Fallback to original if necessary
+        if (!written) {
+            OrthancPluginLogWarning(globalContext, "Cleaned study ZIP failed, using original");
+            written = WriteStudyArchive(studyId, finalZipPath, password);
+        }
     }
-    tempFile << zipData;
-    tempFile.close();
-    
-    sync();
-
-    // Create encrypted ZIP with ZipCrypto
-    std::string compressCmd = "7z a -tzip -mem=ZipCrypto -p'" + password + "' \"" + finalZipPath + "\" \"" + tempZipPath + "\"";
     
-    if (system(compressCmd.c_str()) != 0) {
+    if (!written) {
         OrthancPluginLogError(globalContext, "Failed to create encrypted ZIP");
-        std::remove(tempZipPath.c_str());
+        exportMetrics.failedArchive.Add();
         return;
     }
+    struct stat archive;
+    uint64_t archiveBytes = stat(finalZipPath.c_str(), &archive) == 0 ? static_cast<uint64_t>(archive.st_size) : 0;
+    archiveSpan.SetBytes(archiveBytes);
+    archiveSpan.Finish();
+    exportSpan.SetBytes(archiveBytes);
 
-    std::remove(tempZipPath.c_str());
-    
-    sync();
-    
-    // Delete original study after successful ZIP creation
-    if (!newStudyId.empty()) {
-        httpDelete(ORTHANC_URL + "/studies/" + studyId);
+    // The archive data is fsync'd by FileSink; its directory entry must be durable
+    // before the study is deleted. Workers finishing together share one flush.
+    GroupCommit& directoryCommit = writeToQueue ? queueDirectoryCommit : exportsDirectoryCommit;
+    TraceScope syncSpan(tracer, trace, "sync", finalFilename);
+    if (!directoryCommit.Commit([&finalZipPath] { return SyncDirectory(finalZipPath); })) {
+        OrthancPluginLogError(globalContext, ("Failed to sync directory of " + finalZipPath).c_str());
+        exportMetrics.failedCommit.Add();
+        return;
     }
+    syncSpan.Finish();
 
     // Update mapping for all emails
-    if (!UpdateMappingFileAtomic(finalFilename, emails)) {
+    TraceScope mappingSpan(tracer, trace, "mapping", finalFilename);
+    if (!mappingLog.Append(finalFilename, emails, stableAt, cls, trace)) {
         OrthancPluginLogError(globalContext, "Failed to update mapping file");
+        exportMetrics.failedCommit.Add();
         return;
     }
+    mappingSpan.Finish();
 
-    sync();
-    
-    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    // Hand the archive to the queue, the uploader reads the recipients from the mapping log
+    if (!EnqueueArchive(studyId, finalFilename, emails, trace)) {
+        exportMetrics.failedEnqueue.Add();
+        return;
+    }
 
-    // Send to all recipients dynamically
-    sendToAllRecipients(studyId, finalFilename, emails);
+    // Delete the original study only once the archive is recorded and queued, so a failure
+    // up to here leaves it in Orthanc. In stream mode no cleaned copy exists, and the
+    // original still carries recipients and password: Orthanc keeps no copy of the study.
+    // With EXPORT_TAG_REWRITE=modify, the default, the cleaned copy stays.
+    if (!newStudyId.empty() || tagRewriteMode == TagRewrite_Stream) {
+        TraceScope deleteSpan(tracer, trace, "delete", studyId);
+        deleteSpan.Finish(rest.Delete("/studies/" + studyId) ? "ok" : "error");
+    }
+    exportMetrics.exported.Add();
+    exportMetrics.total.Observe(NowMs() - stableAt);
+    exportSpan.Finish();
 
-    OrthancPluginLogInfo(globalContext, ("Export completed successfully: " + finalFilename + " for " + std::to_string(emails.size()) + " recipients").c_str());
+    OrthancPluginLogInfo(globalContext, ("Export completed successfully: " + finalFilename + " for " + std::to_string(emails.size()) + " recipients, " +
+                                         std::to_string(NowMs() - stableAt) + " ms after the study became stable").c_str());
+    const OrthancRest::Stats& restStats = OrthancRest::ThreadStats();
+    OrthancPluginLogInfo(globalContext, ("REST overhead for " + finalFilename + ": " + std::to_string(restStats.calls) + " calls, " +
+                                         std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(restStats.elapsed).count()) + " ms (" +
+                                         rest.TransportName() + ")").c_str());
 }
 
-// Callback for study processing
-OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
-                                        OrthancPluginResourceType resourceType,
-                                        const char* resourceId) {
-    if (changeType == OrthancPluginChangeType_StableStudy && resourceType == OrthancPluginResourceType_Study) {
-        std::string studyId(resourceId);
-        
-        // Check for email in description
-        std::string studyResponse = httpGet(ORTHANC_URL + "/studies/" + studyId);
-        if (studyResponse.empty()) return OrthancPluginErrorCode_Plugin;
-
+// Worker side of the StableStudy event: filter studies without recipients, then export
+void ProcessStableStudy(const std::string& studyId, int64_t stableAt, const std::string& cls, const std::string& trace) {
+    std::string studyResponse = rest.Get("/studies/" + studyId);
+    bool exportable = false;
+    if (!studyResponse.empty()) {
         Json::Value studyInfo;
         Json::CharReaderBuilder reader;
         std::string errs;
         std::istringstream s(studyResponse);
-        if (!Json::parseFromStream(reader, s, &studyInfo, &errs)) return OrthancPluginErrorCode_Plugin;
+        if (Json::parseFromStream(reader, s, &studyInfo, &errs) && studyInfo.get("IsStable", false).asBool()) {
+            std::string description = studyInfo["MainDicomTags"].get("StudyDescription", "").asString();
+            DescriptionTokens tokens;
+            ScanDescription(description, tokens);
+            if (!tokens.emails.empty()) {
+                OrthancPluginLogInfo(globalContext, ("New study detected - processing for " + std::to_string(tokens.emails.size()) + " recipients").c_str());
+                exportable = true;
+            }
+        }
+    }
+
+    if (exportable) {
+        ExportStudy(studyId, stableAt, cls, trace);
+    } else {
+        std::lock_guard<std::mutex> lock(mutex);
+        activeStudies.erase(studyId);
+    }
+}
+
+// Size and scheduling class of a study before it is queued: the uncompressed size from
+// /statistics (also the credits its export takes), and under the priority policy the
+// modalities and sending AET
+void EstimateStudy(const std::string& studyId, const SchedulerConfig& config, uint64_t& bytes, std::string& cls) {
+    Json::CharReaderBuilder reader;
+    std::string errs;
+    bytes = 0;
+    cls.clear();
+
+    Json::Value statistics;
+    std::istringstream stats(rest.Get("/studies/" + studyId + "/statistics"));
+    if (Json::parseFromStream(reader, stats, &statistics, &errs)) {
+        bytes = std::strtoull(statistics.get("UncompressedSize", "0").asString().c_str(), nullptr, 10);
+    }
+
+    if (config.policy == SchedulerConfig::Policy_Priority) {
+        Json::Value series;
+        std::istringstream ss(rest.Get("/studies/" + studyId + "/series"));
+        std::vector<std::string> modalities;
+        std::string aet;
+        if (Json::parseFromStream(reader, ss, &series, &errs) && series.isArray()) {
+            for (const auto& s : series) {
+                std::string modality = s["MainDicomTags"].get("Modality", "").asString();
+                if (!modality.empty() && std::find(modalities.begin(), modalities.end(), modality) == modalities.end()) {
+                    modalities.push_back(modality);
+                }
+            }
+            if (config.HasAetRules() && series.size() > 0 && series[0]["Instances"].size() > 0) {
+                aet = rest.Get("/instances/" + series[0]["Instances"][0].asString() + "/metadata/RemoteAET");
+            }
+        }
+        cls = config.Classify(modalities, aet);
+    }
+}
+
+// Backlog between export and upload, see flowcontrol.h
+ExportCredits exportCredits("/exports", "/mailqueue");
+
+// Job queue feeding a fixed pool of export workers, in the order of the scheduler policy
+// for the first EXPORT_QUEUE_CAPACITY studies and in arrival order beyond (AdmissionQueue).
+// Studies are sized by an estimator thread before they are scheduled, so Orthanc's change
+// callback makes no REST calls. A worker holds its study until the export credits allow
+// writing the archive.
+class ExportQueue {
+public:
+    static const int CREDIT_POLL_MS = 2000;  // uploads return credits through the file system
+
+    void Start(size_t workers, size_t capacity, const SchedulerConfig& scheduling) {
+        stopping_ = false;
+        jobs_.Configure(scheduling, capacity);
+        for (size_t i = 0; i < workers; ++i) {
+            workers_.emplace_back(&ExportQueue::WorkerLoop, this);
+        }
+        estimator_ = std::thread(&ExportQueue::EstimatorLoop, this);
+        PublishMetrics();
+    }
+
+    void Stop() {
+        size_t dropped = 0;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            stopping_ = true;
+            dropped = jobs_.Drain().size() + arrived_.size();
+            arrived_.clear();
+        }
+        exportCredits.Stop();
+        notEmpty_.notify_all();
+        notEstimated_.notify_all();
+        if (estimator_.joinable()) estimator_.join();
+        for (auto& worker : workers_) {
+            if (worker.joinable()) worker.join();
+        }
+        workers_.clear();
+        if (dropped > 0) {
+            OrthancPluginLogWarning(globalContext, ("Export queue stopped with " + std::to_string(dropped) + " pending studies").c_str());
+        }
+    }
+
+    // Returns false if the study is already queued or running. Never waits, neither for
+    // the size estimate nor for a free slot (see AdmissionQueue).
+    bool Enqueue(const std::string& studyId) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (activeStudies.find(studyId) != activeStudies.end()) {
+                return false;
+            }
+            activeStudies.insert(studyId);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            if (stopping_) {
+                std::lock_guard<std::mutex> activeLock(mutex);
+                activeStudies.erase(studyId);
+                return false;
+            }
+            // The study's trace starts here, at the StableStudy event
+            arrived_.push_back(Arrival{ Job{ studyId, NowMs(), "", 0, TraceLog::NewTraceId() }, JobScheduler<Job>::NowMs() });
+        }
+        notEstimated_.notify_one();
+        return true;
+    }
+
+private:
+    struct Job {
+        std::string studyId;
+        int64_t stableAt;  // ms since epoch
+        std::string cls;
+        uint64_t bytes;    // estimated archive size
+        std::string trace;
+    };
+
+    struct Arrival {
+        Job job;
+        int64_t queuedAt;  // steady clock ms, the queue wait counts from here
+    };
+
+    // Sizes and classifies arrived studies in arrival order and schedules them
+    void EstimatorLoop() {
+        for (;;) {
+            Arrival arrival;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex_);
+                notEstimated_.wait(lock, [this] { return stopping_ || !arrived_.empty(); });
+                if (stopping_) return;
+                arrival = std::move(arrived_.front());
+                arrived_.pop_front();
+            }
+            Job& job = arrival.job;
+            TraceScope estimateSpan(tracer, job.trace, "estimate", job.studyId);
+            EstimateStudy(job.studyId, jobs_.Config(), job.bytes, job.cls);
+            estimateSpan.SetBytes(job.bytes);
+            estimateSpan.Finish();
+            Schedule(std::move(job), arrival.queuedAt);
+        }
+    }
+
+    void Schedule(Job job, int64_t queuedAt) {
+        std::string studyId = job.studyId;
+        std::string trace = job.trace;
+        std::string cls = job.cls;
+        uint64_t bytes = job.bytes;
+        size_t depth;
+        size_t overflow;
+        bool scheduled;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            if (stopping_) {
+                std::lock_guard<std::mutex> activeLock(mutex);
+                activeStudies.erase(studyId);
+                return;
+            }
+            scheduled = jobs_.Push(std::move(job), bytes, cls, queuedAt);
+            queuedBytes_ += bytes;
+            depth = jobs_.Scheduled();
+            overflow = jobs_.Overflow();
+        }
+        notEmpty_.notify_one();
+
+        if (!scheduled && overflow == 1) {
+            OrthancPluginLogWarning(globalContext, ("Export queue full (" + std::to_string(jobs_.Capacity()) + "), further studies wait in arrival order").c_str());
+        }
+        OrthancPluginLogInfo(globalContext, ("Queued study " + studyId + " (trace " + trace + ", " + std::to_string(bytes / 1048576) + " MB" +
+                                             (cls.empty() ? "" : ", class " + cls) +
+                                             ", queue " + std::to_string(depth) + "/" + std::to_string(jobs_.Capacity()) +
+                                             (overflow > 0 ? " + " + std::to_string(overflow) + " overflow" : "") +
+                                             ", busy workers " + std::to_string(busy_.load()) + "/" + std::to_string(workers_.size()) + ")").c_str());
+        PublishMetrics();
+    }
+
+    void WorkerLoop() {
+        for (;;) {
+            Job job;
+            std::string label;
+            int64_t waited;
+            ClassLatency::Summary wait;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex_);
+                notEmpty_.wait(lock, [this] { return stopping_ || !jobs_.Empty(); });
+                if (stopping_) return;
+                job = jobs_.Pop(label, waited);
+                queuedBytes_ -= job.bytes;
+                wait = latency_.Record(label, waited);
+                busy_++;
+            }
+            PublishMetrics();
+            TraceSpan queued;
+            queued.trace = job.trace;
+            queued.name = "queue_wait";
+            queued.subject = job.studyId;
+            queued.endUs = TraceLog::NowUs();
+            queued.startUs = queued.endUs - waited * 1000;
+            queued.bytes = job.bytes;
+            queued.outcome = "ok";
+            tracer.Record(queued);
+            OrthancPluginLogInfo(globalContext, ("Study " + job.studyId + " waited " + std::to_string(waited) + " ms in the export queue (" + label +
+                                                 ": median " + std::to_string(wait.median) + " ms, max " + std::to_string(wait.max) + " ms over " +
+                                                 std::to_string(wait.count) + ")").c_str());
+            OrthancPluginSetMetricsValue(globalContext, ("export_queue_wait_ms_" + ClassLatency::MetricSuffix(label)).c_str(),
+                                         static_cast<float>(wait.median), OrthancPluginMetricsType_Default);
+
+            TraceScope creditsSpan(tracer, job.trace, "credits", job.studyId);
+            if (!AcquireCredits(job)) {
+                creditsSpan.Finish("stopped");
+                std::lock_guard<std::mutex> lock(mutex);
+                activeStudies.erase(job.studyId);
+                busy_--;
+                return;
+            }
+            creditsSpan.Finish();
 
-        if (!studyInfo.get("IsStable", false).asBool()) return OrthancPluginErrorCode_Success;
+            try {
+                ProcessStableStudy(job.studyId, job.stableAt, job.cls, job.trace);
+            } catch (const std::exception& e) {
+                OrthancPluginLogError(globalContext, ("Export of study " + job.studyId + " failed: " + e.what()).c_str());
+                std::lock_guard<std::mutex> lock(mutex);
+                activeStudies.erase(job.studyId);
+            }
+            exportCredits.Release(job.bytes);
+
+            busy_--;
+            PublishMetrics();
+        }
+    }
+
+    // Waits until the archive of job fits the backlog limits and free space; false when stopping
+    bool AcquireCredits(const Job& job) {
+        ExportCredits::Usage usage;
+        std::string blockedBy;
+        auto pausedAt = std::chrono::steady_clock::now();
+        bool paused = false;
+        while (!exportCredits.TryAcquire(job.bytes, usage, blockedBy)) {
+            if (!paused) {
+                paused = true;
+                paused_++;
+                OrthancPluginLogWarning(globalContext, ("Export of study " + job.studyId + " (" + std::to_string(job.bytes / 1048576) +
+                                                        " MB) paused: " + blockedBy).c_str());
+                PublishCredits(usage);
+            }
+            if (!exportCredits.Wait(CREDIT_POLL_MS)) {
+                paused_--;
+                PublishCredits(usage);
+                return false;
+            }
+        }
+        if (paused) {
+            paused_--;
+            OrthancPluginLogWarning(globalContext, ("Export of study " + job.studyId + " resumed after " +
+                                                    std::to_string(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - pausedAt).count()) +
+                                                    " s, " + std::to_string(usage.files) + " archives / " + std::to_string(usage.bytes / 1048576) +
+                                                    " MB pending upload").c_str());
+        }
+        PublishCredits(usage);
+        return true;
+    }
+
+    void PublishCredits(const ExportCredits::Usage& usage) {
+        OrthancPluginSetMetricsValue(globalContext, "export_backlog_files", static_cast<float>(usage.files), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_backlog_mb", static_cast<float>(usage.bytes / 1048576), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_disk_free_mb", static_cast<float>(usage.freeBytes / 1048576), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_workers_paused", static_cast<float>(paused_.load()), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_backlog_scans", static_cast<float>(exportCredits.Scans()), OrthancPluginMetricsType_Default);
+    }
+
+    void PublishMetrics() {
+        size_t depth;
+        size_t overflow;
+        uint64_t bytes;
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            depth = jobs_.Scheduled();
+            overflow = jobs_.Overflow();
+            bytes = queuedBytes_;
+        }
+        OrthancPluginSetMetricsValue(globalContext, "export_queue_depth", static_cast<float>(depth), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_queue_overflow", static_cast<float>(overflow), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_queue_mb", static_cast<float>(bytes / 1048576), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "export_workers_busy", static_cast<float>(busy_.load()), OrthancPluginMetricsType_Default);
+    }
+
+    std::mutex queueMutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notEstimated_;
+    std::deque<Arrival> arrived_;  // not estimated yet
+    std::thread estimator_;
+    AdmissionQueue<Job> jobs_;
+    uint64_t queuedBytes_ = 0;  // estimated, of the studies in jobs_
+    ClassLatency latency_;
+    std::vector<std::thread> workers_;
+    std::atomic<int> busy_{0};
+    std::atomic<int> paused_{0};
+    bool stopping_ = false;
+};
+
+ExportQueue exportQueue;
+
+// Called by Orthanc before it answers /tools/metrics and /tools/metrics-prometheus
+void OnRefreshMetrics() {
+    exportMetrics.metadata.Publish(globalContext, "export_stage_metadata_ms");
+    exportMetrics.modify.Publish(globalContext, "export_stage_modify_ms");
+    exportMetrics.archive.Publish(globalContext, "export_stage_archive_ms");
+    exportMetrics.encrypt.Publish(globalContext, "export_stage_encrypt_ms");
+    exportMetrics.enqueue.Publish(globalContext, "export_stage_enqueue_ms");
+    exportMetrics.total.Publish(globalContext, "export_study_latency_ms");
+    exportMetrics.exported.Publish(globalContext, "export_studies_total");
+    exportMetrics.archiveBytes.Publish(globalContext, "export_archive_bytes_total");
+    exportMetrics.failedMetadata.Publish(globalContext, "export_failures_metadata_total");
+    exportMetrics.failedModify.Publish(globalContext, "export_failures_modify_total");
+    exportMetrics.failedArchive.Publish(globalContext, "export_failures_archive_total");
+    exportMetrics.failedCommit.Publish(globalContext, "export_failures_commit_total");
+    exportMetrics.failedEnqueue.Publish(globalContext, "export_failures_enqueue_total");
+}
+
+// GET /pipeline/trace/{trace id or study id}: the spans of all plugins as a Chrome trace
+OrthancPluginErrorCode OnTraceRoute(OrthancPluginRestOutput* output, const char* /*url*/, const OrthancPluginHttpRequest* request) {
+    if (request->method != OrthancPluginHttpMethod_Get) {
+        OrthancPluginSendMethodNotAllowed(globalContext, output, "GET");
+        return OrthancPluginErrorCode_Success;
+    }
+    std::vector<Json::Value> spans = LoadTraceSpans(tracer, request->groups[0]);
+    if (spans.empty()) {
+        OrthancPluginSendHttpStatusCode(globalContext, output, 404);
+        return OrthancPluginErrorCode_Success;
+    }
+    std::string answer = ChromeTrace(spans);
+    OrthancPluginAnswerBuffer(globalContext, output, answer.data(), answer.size(), "application/json");
+    return OrthancPluginErrorCode_Success;
+}
 
-        std::string description = studyInfo["MainDicomTags"].get("StudyDescription", "").asString();
-        std::vector<std::string> emails = extractAllEmails(description);
-        if (emails.empty()) return OrthancPluginErrorCode_Success;
+// GET /pipeline/traces: the recent exports of this plugin with their trace ids
+OrthancPluginErrorCode OnTracesRoute(OrthancPluginRestOutput* output, const char* /*url*/, const OrthancPluginHttpRequest* request) {
+    if (request->method != OrthancPluginHttpMethod_Get) {
+        OrthancPluginSendMethodNotAllowed(globalContext, output, "GET");
+        return OrthancPluginErrorCode_Success;
+    }
+    Json::Value traces(Json::arrayValue);
+    for (const auto& span : tracer.Recent()) {
+        if (span.name != "export") continue;
+        Json::Value trace;
+        trace["trace"] = span.trace;
+        trace["study"] = span.subject;
+        trace["started_at"] = static_cast<Json::Int64>(span.startUs / 1000);
+        trace["duration_ms"] = static_cast<Json::Int64>((span.endUs - span.startUs) / 1000);
+        trace["bytes"] = static_cast<Json::UInt64>(span.bytes);
+        trace["outcome"] = span.outcome;
+        traces.append(trace);
+    }
+    Json::StreamWriterBuilder writer;
+    std::string answer = Json::writeString(writer, traces);
+    OrthancPluginAnswerBuffer(globalContext, output, answer.data(), answer.size(), "application/json");
+    return OrthancPluginErrorCode_Success;
+}
 
-        OrthancPluginLogInfo(globalContext, ("New study detected - processing for " + std::to_string(emails.size()) + " recipients").c_str());
-        ExportStudy(studyId);
+// Callback for study processing: only enqueue, the export runs on the worker pool
+OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
+                                        OrthancPluginResourceType resourceType,
+                                        const char* resourceId) {
+    if (changeType == OrthancPluginChangeType_StableStudy && resourceType == OrthancPluginResourceType_Study) {
+        std::string studyId(resourceId);
+        if (!exportQueue.Enqueue(studyId)) {
+            OrthancPluginLogInfo(globalContext, ("Export already queued or in progress for study: " + studyId).c_str());
+        }
     }
     return OrthancPluginErrorCode_Success;
 }
@@ -382,14 +1083,95 @@ extern "C" {
         globalContext = context;
         curl_global_init(CURL_GLOBAL_DEFAULT);
         
-        system("mkdir -p /exports");
-        
-        OrthancPluginLogInfo(context, "ExportPlugin started");
+        if (mkdir("/exports", 0755) != 0 && errno != EEXIST) {
+            OrthancPluginLogError(context, ("Cannot create /exports: " + std::string(strerror(errno))).c_str());
+        }
+
+        rest.Configure(context, "");
+        const char* transport = std::getenv("EXPORT_REST_TRANSPORT");
+        if (transport && std::string(transport) == "http") {
+            if (ORTHANC_URL.empty()) {
+                OrthancPluginLogWarning(context, "EXPORT_REST_TRANSPORT=http but ORTHANC_URL is not set, using in-process REST API");
+            } else {
+                rest.Configure(context, ORTHANC_URL);
+            }
+        }
+
+        int workers = std::max(1, GetEnvInt("EXPORT_WORKERS", 2));
+        int capacity = std::max(1, GetEnvInt("EXPORT_QUEUE_CAPACITY", 64));
+        const char* toQueue = std::getenv("EXPORT_WRITE_TO_QUEUE");
+        if (toQueue && (std::string(toQueue) == "1" || std::string(toQueue) == "true")) {
+            writeToQueue = true;
+            mkdir("/mailqueue", 0755);
+        }
+
+        const char* rewrite = std::getenv("EXPORT_TAG_REWRITE");
+        if (rewrite && std::string(rewrite) == "stream") {
+            tagRewriteMode = TagRewrite_Stream;
+        }
+
+        const char* policy = std::getenv("EXPORT_COMPRESSION_POLICY");
+        if (policy && std::string(policy) == "deflate") {
+            compressionPolicy = Policy_Deflate;
+        } else if (policy && std::string(policy) == "store") {
+            compressionPolicy = Policy_Store;
+        }
+        const char* entropy = std::getenv("EXPORT_STORE_ENTROPY");
+        if (entropy && *entropy) {
+            storeEntropyThreshold = std::atof(entropy);
+        }
+
+        const char* transcode = std::getenv("EXPORT_TRANSCODE");
+        if (transcode && *transcode) {
+            ParseTranscodeConfig(transcode);
+        }
+        if (!transcodeSyntaxByModality.empty()) {
+            int transcodeThreads = std::max(1, GetEnvInt("EXPORT_TRANSCODE_THREADS", 2));
+            transcodePool.reset(new TaskPool(transcodeThreads));
+            transcodeInFlight = std::max(1, GetEnvInt("EXPORT_TRANSCODE_IN_FLIGHT", 2 * transcodeThreads));
+            for (const auto& m : transcodeSyntaxByModality) {
+                OrthancPluginLogInfo(context, ("Transcoding " + m.first + " instances to " + m.second).c_str());
+            }
+        }
+
+        int compressionThreads = std::max(1, GetEnvInt("EXPORT_COMPRESSION_THREADS", 1));
+        if (compressionThreads > 1) {
+            deflatePool.reset(new DeflatePool(compressionThreads));
+        }
+        ExportCredits::Limits credits;
+        credits.maxFiles = std::max(1, GetEnvInt("EXPORT_MAX_PENDING_FILES", static_cast<int>(credits.maxFiles)));
+        credits.maxBytes = static_cast<uint64_t>(std::max(1, GetEnvInt("EXPORT_MAX_PENDING_MB", static_cast<int>(credits.maxBytes >> 20)))) << 20;
+        credits.lowWatermark = static_cast<uint64_t>(std::max(0, GetEnvInt("EXPORT_DISK_LOW_WATERMARK_MB", static_cast<int>(credits.lowWatermark >> 20)))) << 20;
+        credits.highWatermark = static_cast<uint64_t>(std::max(0, GetEnvInt("EXPORT_DISK_HIGH_WATERMARK_MB", static_cast<int>(credits.highWatermark >> 20)))) << 20;
+        credits.scanIntervalMs = std::max(0, GetEnvInt("EXPORT_BACKLOG_SCAN_MS", credits.scanIntervalMs));
+        exportCredits.Configure(credits);
+        OrthancPluginLogInfo(context, ("Export backlog limit " + std::to_string(credits.maxFiles) + " archives / " + std::to_string(credits.maxBytes >> 20) +
+                                       " MB, paused below " + std::to_string(credits.lowWatermark >> 20) + " MB free until " +
+                                       std::to_string(exportCredits.GetLimits().highWatermark >> 20) + " MB").c_str());
+
+        tracer.ConfigureFromEnvironment();
+        if (!tracer.Directory().empty() && !tracer.FileEnabled()) {
+            OrthancPluginLogWarning(context, ("Cannot write span files to " + tracer.Directory() + ", traces are kept in memory only").c_str());
+        }
+
+        SchedulerConfig scheduling = SchedulerConfig::FromEnvironment();
+        exportQueue.Start(workers, capacity, scheduling);
+
+        OrthancPluginLogInfo(context, ("ExportPlugin started with " + std::to_string(workers) + " export workers, queue capacity " + std::to_string(capacity) +
+                                       ", " + std::to_string(compressionThreads) + " compression threads, " + scheduling.PolicyName() + " scheduling").c_str());
         OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
+        OrthancPluginRegisterRefreshMetricsCallback(context, OnRefreshMetrics);
+        OrthancPluginRegisterRestCallback(context, "/pipeline/trace/([^/]+)", OnTraceRoute);
+        OrthancPluginRegisterRestCallback(context, "/pipeline/traces", OnTracesRoute);
         return 0;
     }
 
     ORTHANC_PLUGINS_API void OrthancPluginFinalize() {
+        exportQueue.Stop();
+        OrthancPluginLogInfo(globalContext, ("Mapping log: " + std::to_string(mappingLog.Commits().Commits()) + " commits in " +
+                                             std::to_string(mappingLog.Commits().Flushes()) + " flushes").c_str());
+        transcodePool.reset();
+        deflatePool.reset();
         curl_global_cleanup();
         OrthancPluginLogInfo(globalContext, "ExportPlugin stopped");
     }
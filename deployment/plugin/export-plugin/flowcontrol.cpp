@@ -0,0 +1,142 @@
+#include "flowcontrol.h"
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+namespace {
+    const std::string ARCHIVE_EXT = ".zip";
+
+    bool IsArchive(const std::string& name) {
+        return name.size() > ARCHIVE_EXT.size() && name[0] != '.' &&
+               name.compare(name.size() - ARCHIVE_EXT.size(), ARCHIVE_EXT.size(), ARCHIVE_EXT) == 0;
+    }
+
+    uint64_t FreeBytes(const std::string& dir) {
+        struct statvfs fs;
+        if (statvfs(dir.c_str(), &fs) != 0) return UINT64_MAX;
+        return static_cast<uint64_t>(fs.f_bavail) * fs.f_frsize;
+    }
+
+    // Archives in dir, skipping uploaded ones if markers is set
+    void CountArchives(const std::string& dir, bool markers, uint64_t& files, uint64_t& bytes) {
+        DIR* d = opendir(dir.c_str());
+        if (!d) return;
+        while (struct dirent* entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (!IsArchive(name)) continue;
+            struct stat st;
+            if (stat((dir + "/" + name).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (markers) {
+                struct stat marker;
+                if (stat((dir + "/" + name + ".uploaded").c_str(), &marker) == 0) continue;
+            }
+            files++;
+            bytes += static_cast<uint64_t>(st.st_size);
+        }
+        closedir(d);
+    }
+}
+
+ExportCredits::ExportCredits(const std::string& exportsDir, const std::string& queueDir)
+    : exportsDir_(exportsDir), queueDir_(queueDir) {
+}
+
+void ExportCredits::Configure(const Limits& limits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limits_ = limits;
+    limits_.highWatermark = std::max(limits_.highWatermark, limits_.lowWatermark);
+}
+
+ExportCredits::Usage ExportCredits::Scan() const {
+    Usage usage;
+    CountArchives(exportsDir_, false, usage.files, usage.bytes);
+    CountArchives(queueDir_, true, usage.files, usage.bytes);
+    usage.freeBytes = std::min(FreeBytes(exportsDir_), FreeBytes(queueDir_));
+    return usage;
+}
+
+bool ExportCredits::TryAcquire(uint64_t bytes, Usage& usage, std::string& blockedBy) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    bool fresh = scanValid_ && scannedReleases_ == releases_ && now - scannedAt_ < std::chrono::milliseconds(limits_.scanIntervalMs);
+    while (!fresh) {
+        uint64_t releases = releases_;
+        lock.unlock();
+        Usage scanned = Scan();
+        lock.lock();
+        scans_++;
+        // An export that finished during the scan may have written its archive where the
+        // scan had already looked and no longer holds credits: scan again
+        if (releases_ == releases) {
+            scanned_ = scanned;
+            scannedReleases_ = releases;
+            scannedAt_ = now;
+            scanValid_ = true;
+            fresh = true;
+        }
+    }
+    usage = scanned_;
+    usage.exporting = exporting_;
+    usage.reservedBytes = reservedBytes_;
+    uint64_t files = usage.files + exporting_;
+    uint64_t pending = usage.bytes + reservedBytes_;
+
+    // Free space still expected after the running exports and this one are written
+    uint64_t expected = reservedBytes_ + bytes;
+    uint64_t free = usage.freeBytes > expected ? usage.freeBytes - expected : 0;
+    if (belowWatermark_ && usage.freeBytes >= reservedBytes_ + limits_.highWatermark) {
+        belowWatermark_ = false;
+    }
+    if (free < limits_.lowWatermark) {
+        belowWatermark_ = true;
+    }
+
+    blockedBy.clear();
+    if (belowWatermark_) {
+        blockedBy = std::to_string(usage.freeBytes / 1048576) + " MB free, " + std::to_string(usage.reservedBytes / 1048576) +
+                    " MB reserved, resuming at " + std::to_string(limits_.highWatermark / 1048576) + " MB free";
+    } else if (files > 0 && files + 1 > limits_.maxFiles) {
+        blockedBy = std::to_string(files) + " archives pending, limit " + std::to_string(limits_.maxFiles);
+    } else if (files > 0 && pending + bytes > limits_.maxBytes) {
+        blockedBy = std::to_string((pending + bytes) / 1048576) + " MB pending, limit " + std::to_string(limits_.maxBytes / 1048576) + " MB";
+    }
+    if (!blockedBy.empty()) {
+        return false;
+    }
+
+    exporting_++;
+    reservedBytes_ += bytes;
+    return true;
+}
+
+void ExportCredits::Release(uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exporting_--;
+        reservedBytes_ -= std::min(reservedBytes_, bytes);
+        releases_++;
+    }
+    released_.notify_all();
+}
+
+bool ExportCredits::Wait(int timeoutMs) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait_for(lock, std::chrono::milliseconds(timeoutMs));
+    return !stopping_;
+}
+
+uint64_t ExportCredits::Scans() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return scans_;
+}
+
+void ExportCredits::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    released_.notify_all();
+}
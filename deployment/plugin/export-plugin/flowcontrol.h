@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Credits for new archives. Everything written but not uploaded yet holds credits: the
+// archives still in /exports, those in /mailqueue without an .uploaded marker, and the
+// estimated size of every export in progress. The backlog is read from the directories,
+// so credits come back when FilesenderPlugin marks an upload done, also across restarts.
+// An export starts only while the backlog stays within maxFiles and maxBytes and the
+// filesystems keep lowWatermark bytes free; once paused by the watermark, exports wait
+// until highWatermark bytes are free again. The directory scan is reused for up to
+// scanIntervalMs, and redone after any export released its credits.
+class ExportCredits {
+public:
+    struct Limits {
+        uint64_t maxFiles = 50;
+        uint64_t maxBytes = 21474836480ULL;      // 20 GiB
+        uint64_t lowWatermark = 5368709120ULL;   // 5 GiB
+        uint64_t highWatermark = 10737418240ULL; // 10 GiB
+        int scanIntervalMs = 1000;               // below the credit poll of paused exports
+    };
+
+    struct Usage {
+        uint64_t files = 0;          // archives waiting for upload
+        uint64_t bytes = 0;
+        uint64_t exporting = 0;      // exports holding credits
+        uint64_t reservedBytes = 0;
+        uint64_t freeBytes = 0;      // least free space of the watched filesystems
+    };
+
+    // Archives wait in exportsDir until QueuePlugin moves them, then in queueDir until uploaded
+    ExportCredits(const std::string& exportsDir, const std::string& queueDir);
+
+    void Configure(const Limits& limits);
+    const Limits& GetLimits() const { return limits_; }
+
+    // Takes credits for an archive of about bytes; false with the reason if it does not
+    // fit. usage is the state it was decided on. Past the file and byte limits an export
+    // is still allowed when nothing else is pending, however large.
+    bool TryAcquire(uint64_t bytes, Usage& usage, std::string& blockedBy);
+    void Release(uint64_t bytes);
+
+    // Waits for a release or timeoutMs; false once stopped
+    bool Wait(int timeoutMs);
+    void Stop();
+
+    // Directory scans so far
+    uint64_t Scans();
+
+private:
+    Usage Scan() const;
+
+    std::string exportsDir_;
+    std::string queueDir_;
+    Limits limits_;
+    std::mutex mutex_;
+    std::condition_variable released_;
+    uint64_t exporting_ = 0;
+    uint64_t reservedBytes_ = 0;
+    uint64_t releases_ = 0;
+    Usage scanned_;
+    bool scanValid_ = false;
+    uint64_t scannedReleases_ = 0;  // releases_ at the time of scanned_
+    std::chrono::steady_clock::time_point scannedAt_;
+    uint64_t scans_ = 0;
+    bool belowWatermark_ = false;
+    bool stopping_ = false;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+// fsync of the directory holding path, so a new or renamed entry survives a crash
+inline bool SyncDirectory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+// Coalesces flushes of one file or directory. A caller whose writes are done waits for
+// the next flush that starts after it arrived; everyone arriving while a flush runs
+// shares the following one, so N concurrent commits cost about two flushes, not N.
+class GroupCommit {
+public:
+    // flush runs without the lock held and must cover all writes made before it started
+    bool Commit(const std::function<bool()>& flush) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t needed = started_ + 1;
+        while (completed_ < needed) {
+            if (running_) {
+                done_.wait(lock);
+                continue;
+            }
+            running_ = true;
+            uint64_t generation = ++started_;
+            lock.unlock();
+            bool ok = flush();
+            lock.lock();
+            running_ = false;
+            completed_ = generation;
+            lastOk_ = ok;
+            flushes_++;
+            done_.notify_all();
+        }
+        commits_++;
+        return lastOk_;
+    }
+
+    uint64_t Commits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return commits_;
+    }
+
+    uint64_t Flushes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return flushes_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable done_;
+    uint64_t started_ = 0;
+    uint64_t completed_ = 0;
+    uint64_t commits_ = 0;
+    uint64_t flushes_ = 0;
+    bool running_ = false;
+    bool lastOk_ = true;
+};
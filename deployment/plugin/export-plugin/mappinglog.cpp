@@ -0,0 +1,149 @@
+#include "mappinglog.h"
+
+#include <json/json.h>
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+#include <memory>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const size_t MIN_COMPACT_RECORDS = 1024;
+
+    bool WriteAll(int fd, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+MappingLog::MappingLog(const std::string& path, const std::string& uploadedDir)
+    : path_(path), uploadedDir_(uploadedDir) {
+    writer_["indentation"] = "";  // one record per line
+}
+
+MappingLog::~MappingLog() {
+    if (fd_ >= 0) close(fd_);
+}
+
+bool MappingLog::Open() {
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) return false;
+    SyncDirectory(path_);  // the log may have just been created
+
+    // Count existing records once, compaction is scheduled from there
+    records_ = 0;
+    std::ifstream existing(path_);
+    std::string line;
+    while (std::getline(existing, line)) {
+        if (!line.empty()) records_++;
+    }
+    compactAt_ = MIN_COMPACT_RECORDS;
+    return true;
+}
+
+bool MappingLog::Append(const std::string& file, const std::vector<std::string>& emails, int64_t stableAt, const std::string& cls,
+                        const std::string& trace) {
+    if (!Write(file, emails, stableAt, cls, trace)) return false;
+
+    // Exports finishing together share one fdatasync. After a compaction the current
+    // file already holds every record written so far, fsync'd.
+    return commit_.Commit([this] {
+        int fd;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fd = fd_ >= 0 ? dup(fd_) : -1;
+        }
+        if (fd < 0) return false;
+        bool ok = fdatasync(fd) == 0;
+        close(fd);
+        return ok;
+    });
+}
+
+bool MappingLog::Write(const std::string& file, const std::vector<std::string>& emails, int64_t stableAt, const std::string& cls,
+                       const std::string& trace) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 && !Open()) return false;
+
+    std::string records;
+    struct stat st;
+    char last = '\n';
+    if (fstat(fd_, &st) == 0 && st.st_size > 0 && pread(fd_, &last, 1, st.st_size - 1) == 1 && last != '\n') {
+        records += '\n';  // terminate a record torn by a crash
+    }
+    // Every field may come from the study or its sender (a quote in an AE title), so the
+    // record is serialized rather than concatenated
+    Json::Value record(Json::objectValue);
+    record["file"] = file;
+    record["emails"] = Json::Value(Json::arrayValue);
+    for (const auto& email : emails) {
+        record["emails"].append(email);
+    }
+    record["stable_at"] = Json::Int64(stableAt);
+    if (!cls.empty()) record["class"] = cls;
+    if (!trace.empty()) record["trace"] = trace;
+    records += Json::writeString(writer_, record) + "\n";
+
+    if (!WriteAll(fd_, records)) return false;
+    records_++;
+
+    if (records_ >= compactAt_) {
+        Compact();
+    }
+    return true;
+}
+
+// Rewrites the log without records of uploaded archives; the old file stays in place on failure
+bool MappingLog::Compact() {
+    compactAt_ = std::max(MIN_COMPACT_RECORDS, 2 * records_);  // retry later if this fails
+
+    std::ifstream existing(path_);
+    if (!existing.is_open()) return false;
+
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    std::string kept;
+    size_t keptRecords = 0;
+    std::string line;
+    while (std::getline(existing, line)) {
+        Json::Value entry;
+        std::string errs;
+        if (line.empty() || !reader->parse(line.data(), line.data() + line.size(), &entry, &errs) || !entry.isObject()) {
+            continue;
+        }
+        std::string file = entry.get("file", "").asString();
+        struct stat st;
+        if (file.empty() || stat((uploadedDir_ + "/" + file + ".uploaded").c_str(), &st) == 0) {
+            continue;
+        }
+        kept += line + "\n";
+        keptRecords++;
+    }
+    existing.close();
+
+    std::string tempPath = path_ + ".compact";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = WriteAll(fd, kept) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tempPath.c_str(), path_.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    SyncDirectory(path_);
+
+    close(fd_);
+    fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    records_ = keptRecords;
+    compactAt_ = std::max(MIN_COMPACT_RECORDS, 2 * keptRecords);
+    return fd_ >= 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "groupcommit.h"
+
+#include <json/writer.h>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Append-only log of archive -> recipients records, one JSON object per archive and line:
+//   {"class":"CT","emails":["...","..."],"file":"...","stable_at":1700000000000,"trace":"..."}
+// ("class" is the scheduling class, see jobscheduler.h, and "trace" the trace id, see
+// tracing.h; both only present when known)
+// (older logs hold one {"file", "email"} line per recipient; readers accept both)
+// The export plugin is its only writer, FilesenderPlugin tails it. Each append is
+// one write() plus a group-committed fdatasync; a torn last line from a crash is
+// terminated before the next append so only that record is lost. Records of
+// uploaded archives (<uploadedDir>/<file>.uploaded exists) are dropped by
+// compaction, which replaces the file by rename once dead records outnumber live ones.
+class MappingLog {
+public:
+    MappingLog(const std::string& path, const std::string& uploadedDir);
+    ~MappingLog();
+
+    // Returns once the records are durable
+    bool Append(const std::string& file, const std::vector<std::string>& emails, int64_t stableAt, const std::string& cls = "",
+                const std::string& trace = "");
+
+    const GroupCommit& Commits() const { return commit_; }
+
+private:
+    bool Write(const std::string& file, const std::vector<std::string>& emails, int64_t stableAt, const std::string& cls,
+               const std::string& trace);
+    bool Open();
+    bool Compact();
+
+    std::mutex mutex_;
+    GroupCommit commit_;
+    Json::StreamWriterBuilder writer_;
+    std::string path_;
+    std::string uploadedDir_;
+    int fd_ = -1;
+    size_t records_ = 0;
+    size_t compactAt_ = 0;
+};
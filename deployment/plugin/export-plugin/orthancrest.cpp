@@ -0,0 +1,135 @@
+#include "orthancrest.h"
+
+#include <curl/curl.h>
+
+namespace {
+    size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+        static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+        return size * nmemb;
+    }
+
+    // One keep-alive handle per worker thread instead of a fresh CURL* per call
+    CURL* ThreadCurlHandle() {
+        struct Handle {
+            CURL* curl = curl_easy_init();
+            ~Handle() { if (curl) curl_easy_cleanup(curl); }
+        };
+        static thread_local Handle handle;
+        if (handle.curl) curl_easy_reset(handle.curl);
+        return handle.curl;
+    }
+
+    std::string HttpGet(const std::string& url) {
+        CURL* curl = ThreadCurlHandle();
+        std::string response;
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+            curl_easy_perform(curl);
+        }
+        return response;
+    }
+
+    std::string HttpPost(const std::string& url, const std::string& data, const std::string& contentType) {
+        CURL* curl = ThreadCurlHandle();
+        std::string response;
+        if (curl) {
+            struct curl_slist* headers = nullptr;
+            headers = curl_slist_append(headers, ("Content-Type: " + contentType).c_str());
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data.c_str());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, data.size());
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+            curl_easy_perform(curl);
+            curl_slist_free_all(headers);
+        }
+        return response;
+    }
+
+    // True on a 2xx answer; the answer body is discarded instead of going to stdout
+    bool HttpDelete(const std::string& url) {
+        CURL* curl = ThreadCurlHandle();
+        std::string response;
+        long status = 0;
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+            if (curl_easy_perform(curl) == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        }
+        return status >= 200 && status < 300;
+    }
+
+    class RestTimer {
+    public:
+        RestTimer() : start_(std::chrono::steady_clock::now()) {}
+        ~RestTimer() {
+            OrthancRest::Stats& stats = OrthancRest::ThreadStats();
+            stats.calls++;
+            stats.elapsed += std::chrono::steady_clock::now() - start_;
+        }
+    private:
+        std::chrono::steady_clock::time_point start_;
+    };
+}
+
+void OrthancRest::Configure(OrthancPluginContext* context, const std::string& url) {
+    context_ = context;
+    url_ = url;
+}
+
+OrthancRest::Stats& OrthancRest::ThreadStats() {
+    static thread_local Stats stats;
+    return stats;
+}
+
+std::string OrthancRest::TakeBuffer(OrthancPluginMemoryBuffer& buffer) {
+    std::string result;
+    if (buffer.size > 0) {
+        result.assign(reinterpret_cast<const char*>(buffer.data), buffer.size);
+    }
+    OrthancPluginFreeMemoryBuffer(context_, &buffer);
+    return result;
+}
+
+std::string OrthancRest::Get(const std::string& uri) {
+    RestTimer timer;
+    if (UsesHttp()) return HttpGet(url_ + uri);
+
+    OrthancPluginMemoryBuffer buffer;
+    if (OrthancPluginRestApiGet(context_, &buffer, uri.c_str()) != OrthancPluginErrorCode_Success) {
+        return "";
+    }
+    return TakeBuffer(buffer);
+}
+
+std::string OrthancRest::Post(const std::string& uri, const std::string& body) {
+    RestTimer timer;
+    if (UsesHttp()) return HttpPost(url_ + uri, body, "application/json");
+
+    OrthancPluginMemoryBuffer buffer;
+    if (OrthancPluginRestApiPost(context_, &buffer, uri.c_str(), body.data(), body.size()) != OrthancPluginErrorCode_Success) {
+        return "";
+    }
+    return TakeBuffer(buffer);
+}
+
+bool OrthancRest::Delete(const std::string& uri) {
+    RestTimer timer;
+    if (UsesHttp()) return HttpDelete(url_ + uri);
+    return OrthancPluginRestApiDelete(context_, uri.c_str()) == OrthancPluginErrorCode_Success;
+}
+
+std::string OrthancRest::PostForm(const std::string& uri, const std::string& form) {
+    if (UsesHttp()) return HttpPost(url_ + uri, form, "application/x-www-form-urlencoded");
+
+    OrthancPluginMemoryBuffer buffer;
+    if (OrthancPluginRestApiPostAfterPlugins(context_, &buffer, uri.c_str(), form.data(), form.size()) != OrthancPluginErrorCode_Success) {
+        return "";
+    }
+    return TakeBuffer(buffer);
+}
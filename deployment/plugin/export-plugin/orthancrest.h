@@ -0,0 +1,37 @@
+#pragma once
+
+#include <OrthancCPlugin.h>
+#include <chrono>
+#include <string>
+
+// Orthanc REST API as used by the export: in-process through the plugin SDK by default,
+// loopback HTTP to the configured URL with EXPORT_REST_TRANSPORT=http, on one keep-alive
+// libcurl handle per worker thread. Get, Post and PostForm answer "" on failure.
+class OrthancRest {
+public:
+    // Calls and time spent on this thread, reset per export and logged at its end
+    struct Stats {
+        size_t calls = 0;
+        std::chrono::steady_clock::duration elapsed{};
+    };
+
+    // An empty url keeps the in-process transport; curl_global_init is up to the plugin
+    void Configure(OrthancPluginContext* context, const std::string& url);
+    bool UsesHttp() const { return !url_.empty(); }
+    const char* TransportName() const { return UsesHttp() ? "http" : "in-process"; }
+
+    std::string Get(const std::string& uri);
+    std::string Post(const std::string& uri, const std::string& body);
+    bool Delete(const std::string& uri);
+
+    // Form POST to a route of another plugin, such as QueuePlugin's /send
+    std::string PostForm(const std::string& uri, const std::string& form);
+
+    static Stats& ThreadStats();
+
+private:
+    std::string TakeBuffer(OrthancPluginMemoryBuffer& buffer);
+
+    OrthancPluginContext* context_ = nullptr;
+    std::string url_;
+};
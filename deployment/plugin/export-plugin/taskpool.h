@@ -0,0 +1,68 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running submitted tasks in FIFO order
+class TaskPool {
+public:
+    explicit TaskPool(size_t threads) {
+        for (size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back(&TaskPool::WorkerLoop, this);
+        }
+    }
+
+    // Pending tasks are still run before the threads exit
+    ~TaskPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& t : threads_) {
+            if (t.joinable()) t.join();
+        }
+    }
+
+    size_t Threads() const { return threads_.size(); }
+
+    template <typename F>
+    std::future<typename std::result_of<F()>::type> Submit(F f) {
+        typedef typename std::result_of<F()>::type Result;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(f));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back([task] { (*task)(); });
+        }
+        wake_.notify_one();
+        return result;
+    }
+
+private:
+    void WorkerLoop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;  // stopping, queue drained
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+};
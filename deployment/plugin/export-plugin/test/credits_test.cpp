@@ -0,0 +1,101 @@
+// ExportCredits reuses its directory scan: workers polling while paused share one scan
+// per scan interval, a release forces a new one, and the file and byte limits hold on
+// the cached state.
+#include "flowcontrol.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    void WriteFile(const std::string& path, size_t bytes) {
+        std::vector<char> data(bytes, 'x');
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+            std::cerr << "cannot write " << path << "\n";
+            std::exit(1);
+        }
+        close(fd);
+    }
+}
+
+int main() {
+    char root[] = "/tmp/credits_test.XXXXXX";
+    if (!mkdtemp(root)) return 1;
+    std::string exportsDir = std::string(root) + "/ex";
+    std::string queueDir = std::string(root) + "/mq";
+    mkdir(exportsDir.c_str(), 0755);
+    mkdir(queueDir.c_str(), 0755);
+
+    ExportCredits credits(exportsDir, queueDir);
+    ExportCredits::Limits limits;
+    limits.maxFiles = 2;
+    limits.maxBytes = 1 << 20;
+    limits.lowWatermark = 0;
+    limits.highWatermark = 0;
+    limits.scanIntervalMs = 300;
+    credits.Configure(limits);
+
+    ExportCredits::Usage usage;
+    std::string blockedBy;
+    WriteFile(queueDir + "/a.zip", 1000);
+    Expect(credits.TryAcquire(1000, usage, blockedBy), "first export allowed");
+    Expect(usage.files == 1 && usage.bytes == 1000, "first scan sees the queued archive");
+    Expect(!credits.TryAcquire(1000, usage, blockedBy), "third archive over the file limit");
+    Expect(credits.Scans() == 1, "second decision reuses the scan, " + std::to_string(credits.Scans()) + " scans");
+
+    // Paused workers polling within one interval share the scan
+    std::vector<std::thread> workers;
+    std::atomic<int> allowed{0};
+    for (int w = 0; w < 8; ++w) {
+        workers.emplace_back([&] {
+            for (int i = 0; i < 1000; ++i) {
+                ExportCredits::Usage u;
+                std::string why;
+                if (credits.TryAcquire(1000, u, why)) allowed++;
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+    Expect(allowed == 0, "no export allowed while over the file limit");
+    Expect(credits.Scans() == 1, "8000 polls reuse the scan, " + std::to_string(credits.Scans()) + " scans");
+
+    // A finished export invalidates the scan: its archive is now on disk
+    WriteFile(queueDir + "/b.zip", 1000);
+    credits.Release(1000);
+    Expect(!credits.TryAcquire(1000, usage, blockedBy), "released export's archive still counts");
+    Expect(credits.Scans() == 2 && usage.files == 2, "release forces a scan that sees the new archive");
+
+    // An upload is only seen once the interval has passed
+    WriteFile(queueDir + "/a.zip.uploaded", 0);
+    Expect(!credits.TryAcquire(1000, usage, blockedBy) && credits.Scans() == 2, "upload not seen within the interval");
+    std::this_thread::sleep_for(std::chrono::milliseconds(limits.scanIntervalMs + 50));
+    Expect(credits.TryAcquire(1000, usage, blockedBy), "upload seen after the interval");
+    Expect(credits.Scans() == 3 && usage.files == 1, "interval forces a new scan");
+
+    // Byte limit
+    credits.Release(1000);
+    Expect(!credits.TryAcquire(1 << 20, usage, blockedBy) && blockedBy.find("MB pending") != std::string::npos,
+           "byte limit: " + blockedBy);
+
+    std::string cleanup = std::string("rm -rf ") + root;
+    if (system(cleanup.c_str()) != 0) std::cerr << "cannot remove " << root << "\n";
+    if (failures == 0) std::cout << "ExportCredits scan cache: " << credits.Scans() << " scans\n";
+    return failures == 0 ? 0 : 1;
+}
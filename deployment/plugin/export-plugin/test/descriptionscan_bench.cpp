@@ -0,0 +1,46 @@
+// Time per description of ScanDescription and of the former regexes, on typical
+// StudyDescriptions.
+//   descriptionscan_bench [rounds]
+#include "descriptionscan.h"
+#include "legacydescription.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    long rounds = argc > 1 ? std::atol(argv[1]) : 20000;
+    const std::vector<std::string> CORPUS = {
+        "CT Thorax john.doe@hospital.ch pw=Secret123",
+        "MRI Knee",
+        "anna-b@uni-bern.ch, peter_x@example.org pw = a1b2 Follow-up",
+        "Routine chest PA/LAT",
+        "XR Hand li. dr.m.muster@ksa.ch;pw=xyz",
+    };
+
+    size_t sink = 0;  // keeps the work observable
+    auto start = std::chrono::steady_clock::now();
+    for (long r = 0; r < rounds; ++r) {
+        for (const auto& description : CORPUS) {
+            LegacyDescription parsed = ParseLegacyDescription(description);
+            sink += parsed.cleaned.size() + parsed.emails.size();
+        }
+    }
+    auto regexDone = std::chrono::steady_clock::now();
+    for (long r = 0; r < rounds; ++r) {
+        for (const auto& description : CORPUS) {
+            DescriptionTokens tokens;
+            std::string cleaned;
+            ScanDescription(description, tokens, &cleaned);
+            sink += cleaned.size() + tokens.emails.size();
+        }
+    }
+    auto scanDone = std::chrono::steady_clock::now();
+
+    double count = static_cast<double>(rounds) * CORPUS.size();
+    double regexUs = std::chrono::duration<double, std::micro>(regexDone - start).count() / count;
+    double scanUs = std::chrono::duration<double, std::micro>(scanDone - regexDone).count() / count;
+    std::cout << "regex " << regexUs << " us/description, scan " << scanUs << " us/description, "
+              << (scanUs > 0 ? regexUs / scanUs : 0.0) << "x (" << sink << ")\n";
+    return 0;
+}
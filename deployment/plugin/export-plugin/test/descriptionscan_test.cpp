@@ -0,0 +1,78 @@
+// ScanDescription against the former regexes: hand-picked descriptions, then random
+// strings over an alphabet dense in the characters the patterns care about.
+//   descriptionscan_test [iterations] [seed]
+#include "descriptionscan.h"
+#include "legacydescription.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+namespace {
+    bool Check(const std::string& description) {
+        LegacyDescription expected = ParseLegacyDescription(description);
+        DescriptionTokens tokens;
+        std::string cleaned;
+        ScanDescription(description, tokens, &cleaned);
+        std::vector<std::string> emails(tokens.emails.begin(), tokens.emails.end());
+        if (emails == expected.emails && std::string(tokens.password) == expected.password && cleaned == expected.cleaned) {
+            return true;
+        }
+
+        std::cerr << "MISMATCH for [" << description << "]\n  emails   regex:";
+        for (const auto& email : expected.emails) std::cerr << " " << email;
+        std::cerr << "\n           scan: ";
+        for (const auto& email : emails) std::cerr << " " << email;
+        std::cerr << "\n  password regex [" << expected.password << "] scan [" << tokens.password << "]"
+                  << "\n  cleaned  regex [" << expected.cleaned << "] scan [" << cleaned << "]\n";
+        return false;
+    }
+}
+
+int main(int argc, char** argv) {
+    long iterations = argc > 1 ? std::atol(argv[1]) : 200000;
+    unsigned seed = argc > 2 ? static_cast<unsigned>(std::atol(argv[2])) : 42;
+
+    const char* const CASES[] = {
+        "",
+        "MRI Knee",
+        "CT Thorax john.doe@hospital.ch pw=Secret123",
+        "anna-b@uni-bern.ch, peter_x@example.org pw = a1b2 Follow-up",
+        "XR Hand li. dr.m.muster@ksa.ch;pw=xyz",
+        "a@b.ch a@b.ch duplicate",
+        "pw=first pw=second",
+        "pw=",
+        "pw\t=\tx",
+        "trailing dot a@b.ch.",
+        "a@b.c",
+        "@@a@b.ch@@",
+        "x@y.z1 \x80\xff bytes",
+        "  \t leading and trailing \t ",
+    };
+    for (const char* description : CASES) {
+        if (!Check(description)) return 1;
+    }
+
+    std::mt19937 random(seed);
+    const char ALPHABET[] = "ab.-_@ pw=\t\x80Zx9.@@";
+    for (long i = 0; i < iterations; ++i) {
+        std::string description;
+        int length = random() % 40;
+        for (int c = 0; c < length; ++c) {
+            int pick = random() % 10;
+            if (pick < 2) {
+                description += "pw";
+            } else if (pick < 3) {
+                description += ".com";
+            } else {
+                description += ALPHABET[random() % (sizeof(ALPHABET) - 1)];
+            }
+        }
+        if (!Check(description)) {
+            std::cerr << "after " << i << " random descriptions, seed " << seed << "\n";
+            return 1;
+        }
+    }
+    std::cout << "ScanDescription matches the regexes on " << iterations << " random descriptions (seed " << seed << ")\n";
+    return 0;
+}
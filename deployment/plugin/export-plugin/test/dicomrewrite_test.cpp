@@ -0,0 +1,234 @@
+// RewriteTags on fixed Part 10 fixtures built here byte by byte: the rewritten file must
+// equal the fixture built with the new values. Covers explicit and implicit VR little
+// endian, StudyDescription/StudyID present and absent, group length fix-up, undefined-
+// length SQ and UN (whose nested tags stay untouched), the Specific Character Set check,
+// the rejection of big endian and deflated files, and TruncateUtf8 on multi-byte
+// boundaries.
+#include "dicomrewrite.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    const char* const EXPLICIT_LE = "1.2.840.10008.1.2.1";
+    const char* const IMPLICIT_LE = "1.2.840.10008.1.2";
+    const char* const EXPLICIT_BE = "1.2.840.10008.1.2.2";
+    const char* const DEFLATED = "1.2.840.10008.1.2.1.99";
+    const uint32_t UNDEFINED = 0xffffffff;
+
+    void Put16(std::string& out, uint16_t v) {
+        out.push_back(static_cast<char>(v & 0xff));
+        out.push_back(static_cast<char>(v >> 8));
+    }
+
+    void Put32(std::string& out, uint32_t v) {
+        Put16(out, static_cast<uint16_t>(v & 0xffff));
+        Put16(out, static_cast<uint16_t>(v >> 16));
+    }
+
+    struct Element {
+        uint16_t group;
+        uint16_t element;
+        std::string vr;
+        std::string value;       // raw bytes; text is padded to even length with a space
+        bool undefined = false;  // undefined length, value holds the items and the delimiter
+    };
+
+    Element Text(uint16_t group, uint16_t element, const std::string& vr, std::string value) {
+        if (value.size() % 2 != 0) value.push_back(vr == "UI" ? '\0' : ' ');
+        return Element{ group, element, vr, value };
+    }
+
+    std::string Encode(const Element& e, bool explicitVr) {
+        std::string out;
+        Put16(out, e.group);
+        Put16(out, e.element);
+        uint32_t length = e.undefined ? UNDEFINED : static_cast<uint32_t>(e.value.size());
+        if (!explicitVr) {
+            Put32(out, length);
+        } else if (e.vr == "OB" || e.vr == "SQ" || e.vr == "UN" || e.vr == "UT") {
+            out += e.vr;
+            Put16(out, 0);
+            Put32(out, length);
+        } else {
+            out += e.vr;
+            Put16(out, static_cast<uint16_t>(length));
+        }
+        return out + e.value;
+    }
+
+    // Items of an undefined-length sequence: each item holds the encoded elements given,
+    // the first with undefined length and an item delimiter, the others with their length
+    std::string Items(const std::vector<std::vector<Element>>& items, bool explicitVr) {
+        std::string out;
+        for (size_t i = 0; i < items.size(); ++i) {
+            std::string content;
+            for (const auto& e : items[i]) content += Encode(e, explicitVr);
+            Put16(out, 0xfffe);
+            Put16(out, 0xe000);
+            Put32(out, i == 0 ? UNDEFINED : static_cast<uint32_t>(content.size()));
+            out += content;
+            if (i == 0) {
+                Put16(out, 0xfffe);
+                Put16(out, 0xe00d);
+                Put32(out, 0);
+            }
+        }
+        Put16(out, 0xfffe);
+        Put16(out, 0xe0dd);
+        Put32(out, 0);
+        return out;
+    }
+
+    // Part 10 file: preamble, meta group and the dataset, with group length elements
+    // holding the size of the groups listed in groupLengths
+    std::string File(const std::string& syntax, const std::vector<Element>& dataset, bool explicitVr,
+                     const std::vector<uint16_t>& groupLengths = {}) {
+        std::string meta = Encode(Element{ 0x0002, 0x0001, "OB", std::string("\0\1", 2) }, true) +
+                           Encode(Text(0x0002, 0x0010, "UI", syntax), true);
+        std::string metaLength;
+        Put32(metaLength, static_cast<uint32_t>(meta.size()));
+        std::string out = std::string(128, '\0') + "DICM" + Encode(Element{ 0x0002, 0x0000, "UL", metaLength }, true) + meta;
+
+        std::map<uint16_t, std::string> groups;
+        for (const auto& e : dataset) groups[e.group] += Encode(e, explicitVr);
+        for (const auto& group : groups) {
+            bool withLength = false;
+            for (uint16_t g : groupLengths) withLength = withLength || g == group.first;
+            if (withLength) {
+                std::string length;
+                Put32(length, static_cast<uint32_t>(group.second.size()));
+                out += Encode(Element{ group.first, 0x0000, "UL", length }, explicitVr);
+            }
+            out += group.second;
+        }
+        return out;
+    }
+
+    std::vector<TagValue> Cleaned(const std::string& description, const std::string& studyId) {
+        return { TagValue{ 0x0008, 0x1030, "LO", description }, TagValue{ 0x0020, 0x0010, "SH", studyId } };
+    }
+
+    bool Rewrite(const std::string& file, const std::vector<TagValue>& tags, std::string& out) {
+        return RewriteTags(reinterpret_cast<const uint8_t*>(file.data()), file.size(), tags, out);
+    }
+
+    void ExpectRewrite(const std::string& what, const std::string& before, const std::string& after,
+                       const std::vector<TagValue>& tags) {
+        std::string out;
+        Expect(Rewrite(before, tags, out), what + ": rewritten");
+        Expect(out == after, what + ": matches the fixture");
+    }
+
+    // A study with the given description and ID (left out when null), optionally with the
+    // undefined-length SQ and UN elements that hold a StudyDescription of their own
+    std::vector<Element> Study(const char* description, const char* studyId, bool nested, bool explicitVr,
+                               const std::string& charset = "ISO_IR 192") {
+        std::vector<Element> dataset = {
+            Text(0x0008, 0x0005, "CS", charset),
+            Text(0x0008, 0x0020, "DA", "20240131"),
+            Text(0x0008, 0x0060, "CS", "CT"),
+        };
+        if (description) dataset.push_back(Text(0x0008, 0x1030, "LO", description));
+        if (nested) {
+            Element sequence{ 0x0008, 0x1110, "SQ",
+                              Items({ { Text(0x0008, 0x1030, "LO", "nested pw=keep") },
+                                      { Text(0x0008, 0x1150, "UI", "1.2.3"), Text(0x0008, 0x1155, "UI", "1.2.3.4") } },
+                                    explicitVr),
+                              true };
+            dataset.push_back(sequence);
+            // Undefined-length UN: its items are implicit VR even in an explicit file
+            Element unknown{ 0x0009, 0x1010, "UN", Items({ { Text(0x0008, 0x1030, "LO", "private pw=keep") } }, false), true };
+            dataset.push_back(unknown);
+        }
+        dataset.push_back(Text(0x0010, 0x0010, "PN", "Doe^John"));
+        if (studyId) dataset.push_back(Text(0x0020, 0x0010, "SH", studyId));
+        dataset.push_back(Text(0x0020, 0x0011, "IS", "1"));
+        return dataset;
+    }
+}
+
+int main() {
+    for (bool explicitVr : { true, false }) {
+        const std::string syntax = explicitVr ? EXPLICIT_LE : IMPLICIT_LE;
+        const std::string label = explicitVr ? "explicit: " : "implicit: ";
+        const std::vector<TagValue> tags = Cleaned("CT Thorax", "A1");
+
+        ExpectRewrite(label + "both present", File(syntax, Study("CT Thorax a@b.ch pw=x", "x@y.ch", false, explicitVr), explicitVr),
+                      File(syntax, Study("CT Thorax", "A1", false, explicitVr), explicitVr), tags);
+        ExpectRewrite(label + "description absent", File(syntax, Study(nullptr, "x@y.ch", false, explicitVr), explicitVr),
+                      File(syntax, Study("CT Thorax", "A1", false, explicitVr), explicitVr), tags);
+        ExpectRewrite(label + "both absent", File(syntax, Study(nullptr, nullptr, false, explicitVr), explicitVr),
+                      File(syntax, Study("CT Thorax", "A1", false, explicitVr), explicitVr), tags);
+
+        // Odd values are padded, and the group lengths of the touched groups follow
+        ExpectRewrite(label + "group lengths",
+                      File(syntax, Study("CT Thorax a@b.ch pw=x", nullptr, false, explicitVr), explicitVr, { 0x0008, 0x0010, 0x0020 }),
+                      File(syntax, Study("CT", "A12", false, explicitVr), explicitVr, { 0x0008, 0x0010, 0x0020 }),
+                      Cleaned("CT", "A12"));
+
+        // Nested StudyDescriptions in the SQ and UN items are skipped, not rewritten
+        ExpectRewrite(label + "undefined-length SQ and UN",
+                      File(syntax, Study("CT Thorax a@b.ch pw=x", "x@y.ch", true, explicitVr), explicitVr, { 0x0008 }),
+                      File(syntax, Study("CT Thorax", "A1", true, explicitVr), explicitVr, { 0x0008 }), tags);
+
+        // Past the end of the dataset: appended
+        std::vector<Element> endsEarly = { Text(0x0008, 0x0005, "CS", "ISO_IR 100"), Text(0x0008, 0x0060, "CS", "MR") };
+        std::vector<Element> appended = endsEarly;
+        appended.push_back(Text(0x0008, 0x1030, "LO", "CT Thorax"));
+        appended.push_back(Text(0x0020, 0x0010, "SH", "A1"));
+        ExpectRewrite(label + "appended at the end", File(syntax, endsEarly, explicitVr), File(syntax, appended, explicitVr), tags);
+    }
+
+    // Specific Character Set: ASCII under any, other UTF-8 only under ISO_IR 192
+    {
+        std::string out;
+        const std::vector<TagValue> umlaut = Cleaned("Z\xc3\xbcrich Thorax", "A1");
+        Expect(!Rewrite(File(EXPLICIT_LE, Study("old", "x", false, true, "ISO_IR 100"), true), umlaut, out),
+               "non-ASCII refused under ISO_IR 100");
+        Expect(!Rewrite(File(EXPLICIT_LE, Study("old", "x", false, true, ""), true), umlaut, out),
+               "non-ASCII refused under the default repertoire");
+        ExpectRewrite("ASCII under ISO_IR 100", File(EXPLICIT_LE, Study("old", "x", false, true, "ISO_IR 100"), true),
+                      File(EXPLICIT_LE, Study("CT Thorax", "A1", false, true, "ISO_IR 100"), true), Cleaned("CT Thorax", "A1"));
+        ExpectRewrite("non-ASCII under ISO_IR 192", File(EXPLICIT_LE, Study("old", "x", false, true), true),
+                      File(EXPLICIT_LE, Study("Z\xc3\xbcrich Thorax", "A1", false, true), true), umlaut);
+    }
+
+    // Big endian and deflated files are left to /instances/{id}/modify
+    {
+        std::string out;
+        const std::vector<TagValue> tags = Cleaned("CT", "A1");
+        Expect(!Rewrite(File(EXPLICIT_BE, Study("old", "x", false, true), true), tags, out), "big endian refused");
+        Expect(!Rewrite(File(DEFLATED, Study("old", "x", false, true), true), tags, out), "deflated refused");
+        Expect(!Rewrite(std::string(200, '\0'), tags, out), "no DICM prefix refused");
+        std::string truncated = File(EXPLICIT_LE, Study("old", "x", true, true), true);
+        truncated.resize(truncated.size() - 30);
+        Expect(!Rewrite(truncated, tags, out), "truncated file refused");
+    }
+
+    // TruncateUtf8 counts characters and never cuts a sequence: 2-byte ü, 3-byte €, 4-byte U+1F600
+    {
+        const std::string text = "Z\xc3\xbc" "\xe2\x82\xac" "\xf0\x9f\x98\x80" "x";
+        Expect(TruncateUtf8(text, 0).empty(), "0 characters");
+        Expect(TruncateUtf8(text, 1) == "Z", "before a 2-byte sequence");
+        Expect(TruncateUtf8(text, 2) == "Z\xc3\xbc", "after a 2-byte sequence");
+        Expect(TruncateUtf8(text, 3) == "Z\xc3\xbc\xe2\x82\xac", "after a 3-byte sequence");
+        Expect(TruncateUtf8(text, 4) == "Z\xc3\xbc\xe2\x82\xac\xf0\x9f\x98\x80", "after a 4-byte sequence");
+        Expect(TruncateUtf8(text, 5) == text && TruncateUtf8(text, 64) == text, "whole string");
+        Expect(TruncateUtf8(std::string(70, 'a'), 64).size() == 64, "64 ASCII characters");
+    }
+
+    if (failures == 0) std::cout << "RewriteTags: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+// Enqueue latency and processes created per archive, from ExportPlugin's side of /send:
+// in-process (the default), over HTTP on the libcurl keep-alive handle, and the former
+// system("curl ... /send") once per recipient. QueuePlugin is built against the stub SDK
+// in stub/, so the time includes its rename and directory fsyncs. Processes are counted
+// from the system-wide fork counter in /proc/stat, keep the machine otherwise quiet.
+// The former 200 ms sleep between recipients is not included.
+//   enqueue_bench [archives] [recipients]
+#include "httpstub.h"
+#include "orthancrest.h"
+
+#include <curl/curl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+extern "C" ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context);
+
+namespace {
+    long ProcessesCreated() {
+        std::ifstream in("/proc/stat");
+        std::string key;
+        long value = 0;
+        while (in >> key) {
+            if (key == "processes" && in >> value) return value;
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t archives = argc > 1 ? std::max(1L, std::atol(argv[1])) : 200;
+    size_t recipients = argc > 2 ? std::max(1L, std::atol(argv[2])) : 2;
+    const std::string root = QUEUE_PLUGIN_ROOT;
+    mkdir(root.c_str(), 0755);
+    OrthancPluginInitialize(nullptr);
+    StubHttpServer server([](const std::string& method, const std::string& uri, const std::string& body, std::string& answer) {
+        return StubDispatch(method, uri, body, answer, true);
+    });
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    std::string emails;
+    for (size_t r = 0; r < recipients; ++r) emails += (r ? "," : "") + std::string("r") + std::to_string(r) + "@hospital.ch";
+    std::printf("%zu archives, %zu recipients\n", archives, recipients);
+    std::printf("%-26s %10s %10s %14s\n", "handoff", "p50 us", "p99 us", "processes/op");
+    for (const char* mode : { "in-process", "http", "system(curl)" }) {
+        OrthancRest rest;
+        rest.Configure(nullptr, std::string(mode) == "http" ? server.Url() : "");
+        std::vector<double> latencies;
+        long before = ProcessesCreated();
+        for (size_t i = 0; i < archives; ++i) {
+            std::string name = std::string(mode).substr(0, 4) + std::to_string(i) + ".zip";
+            std::ofstream(root + "/exports/" + name) << "archive";
+            std::string form = "studyId=study&file=" + name + "&email=" + emails + "&trace=00000000000000aa";
+            auto start = std::chrono::steady_clock::now();
+            if (std::string(mode) != "system(curl)") {
+                rest.PostForm("/send", form);
+            } else {
+                for (size_t r = 0; r < recipients; ++r) {
+                    std::string command = "curl -s -X POST " + server.Url() + "/send -d '" + form + "' --retry 3 -o /dev/null";
+                    if (std::system(command.c_str()) != 0) std::fprintf(stderr, "curl failed\n");
+                }
+            }
+            latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        double processes = static_cast<double>(ProcessesCreated() - before) / archives;
+        std::sort(latencies.begin(), latencies.end());
+        std::printf("%-26s %10.0f %10.0f %14.2f\n", mode, latencies[latencies.size() / 2],
+                    latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)], processes);
+    }
+    curl_global_cleanup();
+    std::system(("rm -rf '" + root + "'").c_str());
+    return 0;
+}
@@ -0,0 +1,112 @@
+// Handoff from ExportPlugin to QueuePlugin: the /send form POST of EnqueueArchive through
+// OrthancRest, into QueuePlugin built against the stub SDK in stub/, creates no process on
+// either transport, moves the archive once, answers OK again when repeated, and 404s an
+// archive that is in neither directory. Process creation is intercepted below; the
+// directories live under QUEUE_PLUGIN_ROOT in the build tree.
+#include "httpstub.h"
+#include "orthancrest.h"
+
+#include <curl/curl.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <spawn.h>
+#include <string>
+#include <sys/stat.h>
+
+extern "C" ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context);
+
+namespace {
+    std::atomic<int> processes{ 0 };
+
+    int Refused() {
+        processes++;
+        errno = EPERM;
+        return -1;
+    }
+
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    bool Exists(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0;
+    }
+
+    float Published(const std::string& name) {
+        for (auto callback : StubRefreshMetrics()) callback();
+        auto it = StubMetrics().find(name);
+        return it == StubMetrics().end() ? -1 : it->second;
+    }
+}
+
+// Every way the handoff could start a shell, curl or any other process
+extern "C" {
+    pid_t fork() noexcept { return Refused(); }
+    pid_t vfork() noexcept { return Refused(); }
+    int system(const char*) { return Refused(); }
+    FILE* popen(const char*, const char*) { return Refused(), nullptr; }
+    int posix_spawn(pid_t*, const char*, const posix_spawn_file_actions_t*, const posix_spawnattr_t*, char* const[], char* const[]) {
+        return Refused(), EPERM;
+    }
+    int posix_spawnp(pid_t*, const char*, const posix_spawn_file_actions_t*, const posix_spawnattr_t*, char* const[], char* const[]) {
+        return Refused(), EPERM;
+    }
+}
+
+int main() {
+    const std::string root = QUEUE_PLUGIN_ROOT;
+    Expect(std::system("true") == -1 && processes == 1, "process creation intercepted");
+    processes = 0;
+
+    // Left over from an earlier run
+    for (const char* dir : { "/exports", "/mailqueue" }) {
+        for (const char* file : { "/a.zip", "/b.zip" }) std::remove((root + dir + file).c_str());
+        rmdir((root + dir).c_str());
+    }
+    mkdir(root.c_str(), 0755);
+
+    OrthancPluginInitialize(nullptr);
+    Expect(Exists(root + "/exports") && Exists(root + "/mailqueue"), "directories created");
+    StubHttpServer server([](const std::string& method, const std::string& uri, const std::string& body, std::string& answer) {
+        return StubDispatch(method, uri, body, answer, true);
+    });
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    for (bool http : { false, true }) {
+        std::string transport = http ? "http: " : "in-process: ";
+        std::string name = http ? "b.zip" : "a.zip";
+        std::ofstream(root + "/exports/" + name) << "archive " << name;
+        OrthancRest rest;
+        rest.Configure(nullptr, http ? server.Url() : "");
+        std::string form = "studyId=study&file=" + name + "&email=a@example.org,b@example.org&trace=00000000000000aa";
+
+        float queued = Published("queue_archives_total");
+        float already = Published("queue_already_queued_total");
+        Expect(rest.PostForm("/send", form) == "OK", transport + "first /send");
+        Expect(!Exists(root + "/exports/" + name) && Exists(root + "/mailqueue/" + name), transport + "archive moved");
+        Expect(Published("queue_archives_total") == queued + 1, transport + "moved once");
+
+        Expect(rest.PostForm("/send", form) == "OK", transport + "repeated /send");
+        Expect(Exists(root + "/mailqueue/" + name), transport + "archive still queued");
+        Expect(Published("queue_archives_total") == queued + 1 && Published("queue_already_queued_total") == already + 1,
+               transport + "repeat counted as already queued");
+
+        Expect(rest.PostForm("/send", "file=missing.zip") != "OK", transport + "unknown archive refused");
+        Expect(rest.PostForm("/send", "file=../a.zip") != "OK", transport + "path outside the queue refused");
+        Expect(processes == 0, transport + "no process created, got " + std::to_string(processes));
+    }
+
+    curl_global_cleanup();
+    if (failures == 0) std::cout << "Enqueue: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+// Concurrent ingest against one file: every caller appends a record and returns once it
+// is durable, either with its own fdatasync or through GroupCommit, at 1, 2, 4, ...
+// callers. Reports commits/s, fdatasyncs per commit and the commit latency.
+//   groupcommit_bench [max callers] [seconds per run] [dir]
+// dir defaults to /tmp; point it at the exports volume for realistic fdatasync costs.
+#include "groupcommit.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    struct Result {
+        uint64_t commits = 0;
+        uint64_t syncs = 0;
+        double p50Us = 0;
+        double p99Us = 0;
+    };
+
+    Result Run(const std::string& path, size_t callers, double seconds, bool grouped) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        GroupCommit commit;
+        std::atomic<uint64_t> syncs{ 0 };
+        std::atomic<bool> stop{ false };
+        std::vector<std::vector<double>> latencies(callers);
+        const std::string record(512, 'r');
+
+        auto sync = [&] {
+            syncs++;
+            return fdatasync(fd) == 0;
+        };
+        std::vector<std::thread> threads;
+        for (size_t c = 0; c < callers; ++c) {
+            threads.emplace_back([&, c] {
+                while (!stop) {
+                    auto start = std::chrono::steady_clock::now();
+                    if (write(fd, record.data(), record.size()) != static_cast<ssize_t>(record.size())) break;
+                    if (grouped) {
+                        commit.Commit(sync);
+                    } else {
+                        sync();
+                    }
+                    latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop = true;
+        for (auto& t : threads) t.join();
+        close(fd);
+
+        Result result;
+        std::vector<double> all;
+        for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+        result.commits = all.size();
+        result.syncs = syncs;
+        if (!all.empty()) {
+            std::sort(all.begin(), all.end());
+            result.p50Us = all[all.size() / 2];
+            result.p99Us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+        }
+        return result;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t maxCallers = argc > 1 ? std::atol(argv[1]) : 32;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 2.0;
+    std::string dir = argc > 3 ? argv[3] : "/tmp";
+    std::string path = dir + "/groupcommit_bench." + std::to_string(getpid());
+
+    std::printf("%8s %12s %12s %10s %10s %10s\n", "callers", "mode", "commits/s", "syncs/op", "p50 us", "p99 us");
+    for (size_t callers = 1; callers <= maxCallers; callers *= 2) {
+        for (bool grouped : { false, true }) {
+            Result r = Run(path, callers, seconds, grouped);
+            std::printf("%8zu %12s %12.0f %10.2f %10.0f %10.0f\n", callers, grouped ? "group" : "own sync", r.commits / seconds,
+                        r.commits ? static_cast<double>(r.syncs) / r.commits : 0, r.p50Us, r.p99Us);
+        }
+    }
+    unlink(path.c_str());
+    return 0;
+}
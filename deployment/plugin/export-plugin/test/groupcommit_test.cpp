@@ -0,0 +1,120 @@
+// GroupCommit coalescing: N callers committing at once share flushes (fewer than N),
+// each returns only after a flush that started after its write, a failed flush fails
+// exactly the callers waiting on it, and callers one after another get one flush each.
+#include "groupcommit.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    // Stands in for a file: writes get increasing numbers, a flush makes durable what
+    // was written when it started
+    struct Journal {
+        std::atomic<uint64_t> written{ 0 };
+        std::mutex mutex;
+        uint64_t durable = 0;
+        int flushes = 0;
+        bool failNext = false;
+
+        bool Flush() {
+            uint64_t covered = written.load();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            std::lock_guard<std::mutex> lock(mutex);
+            flushes++;
+            if (failNext) {
+                failNext = false;
+                return false;
+            }
+            durable = std::max(durable, covered);
+            return true;
+        }
+
+        uint64_t Durable() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return durable;
+        }
+    };
+
+    // Runs callers threads that write and commit together, released at the same moment
+    void Concurrent(GroupCommit& commit, Journal& journal, int callers, std::atomic<int>& covered, std::atomic<int>& ok) {
+        std::mutex mutex;
+        std::condition_variable go;
+        bool started = false;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < callers; ++i) {
+            threads.emplace_back([&] {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    go.wait(lock, [&] { return started; });
+                }
+                uint64_t mine = ++journal.written;
+                bool committed = commit.Commit([&] { return journal.Flush(); });
+                ok += committed;
+                covered += !committed || journal.Durable() >= mine;
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            started = true;
+        }
+        go.notify_all();
+        for (auto& t : threads) t.join();
+    }
+}
+
+int main() {
+    const int callers = 32;
+    {
+        GroupCommit commit;
+        Journal journal;
+        std::atomic<int> covered{ 0 }, ok{ 0 };
+        Concurrent(commit, journal, callers, covered, ok);
+        Expect(ok == callers, "all commits succeed");
+        Expect(covered == callers, "every caller returns after a flush covering its write");
+        Expect(journal.flushes < callers, std::to_string(callers) + " concurrent callers, " + std::to_string(journal.flushes) + " flushes");
+        Expect(commit.Commits() == static_cast<uint64_t>(callers) && commit.Flushes() == static_cast<uint64_t>(journal.flushes),
+               "counters");
+    }
+
+    // A flush that fails fails its waiters only; the next one succeeds for the rest
+    {
+        GroupCommit commit;
+        Journal journal;
+        journal.failNext = true;
+        std::atomic<int> covered{ 0 }, ok{ 0 };
+        Concurrent(commit, journal, callers, covered, ok);
+        Expect(ok < callers, "callers of the failed flush see the failure");
+        Expect(ok > 0, "callers of a later flush succeed");
+        Expect(covered == callers, "successful callers covered after a failed flush");
+        Expect(commit.Commit([&] { return journal.Flush(); }), "commit after a failure");
+    }
+
+    // One after another: nobody to share with, one flush per commit
+    {
+        GroupCommit commit;
+        Journal journal;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t mine = ++journal.written;
+            Expect(commit.Commit([&] { return journal.Flush(); }) && journal.Durable() >= mine, "sequential commit covered");
+        }
+        Expect(journal.flushes == 5, "one flush per sequential commit");
+    }
+
+    if (failures == 0) std::cout << "GroupCommit: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+// Loopback HTTP/1.1 server for the HTTP transport of orthancrest.cpp: keep-alive, one
+// thread per connection, requests answered by a StubRestHandler (stub/OrthancCPlugin.h)
+// so both transports see the same Orthanc.
+
+#include <OrthancCPlugin.h>
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <strings.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class StubHttpServer {
+public:
+    explicit StubHttpServer(StubRestHandler handler)
+        : handler_(std::move(handler)) {
+        listen_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (bind(listen_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listen_, 64) != 0 ||
+            getsockname(listen_, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            return;
+        }
+        port_ = ntohs(address.sin_port);
+        acceptor_ = std::thread([this] { Accept(); });
+    }
+
+    ~StubHttpServer() {
+        shutdown(listen_, SHUT_RDWR);
+        close(listen_);
+        if (acceptor_.joinable()) acceptor_.join();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int fd : connections_) shutdown(fd, SHUT_RDWR);
+        for (auto& t : threads_) t.join();
+        for (int fd : connections_) close(fd);
+    }
+
+    // Base URL as ORTHANC_URL, empty if the server could not listen
+    std::string Url() const { return port_ ? "http://127.0.0.1:" + std::to_string(port_) : ""; }
+
+private:
+    void Accept() {
+        for (;;) {
+            int fd = accept4(listen_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::lock_guard<std::mutex> lock(mutex_);
+            connections_.push_back(fd);
+            threads_.emplace_back([this, fd] { Serve(fd); });
+        }
+    }
+
+    static bool SendAll(int fd, const std::string& data) {
+        for (size_t sent = 0; sent < data.size();) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void Serve(int fd) {
+        std::string buffer;
+        while (Answer(fd, buffer)) {
+        }
+    }
+
+    // One request from the connection, false once it is closed (closed by the destructor)
+    bool Answer(int fd, std::string& buffer) {
+        char chunk[65536];
+        size_t headerEnd;
+        while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return false;
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+        std::string head = buffer.substr(0, headerEnd);
+        buffer.erase(0, headerEnd + 4);
+
+        size_t methodEnd = head.find(' ');
+        size_t uriEnd = head.find(' ', methodEnd + 1);
+        std::string method = head.substr(0, methodEnd);
+        std::string uri = head.substr(methodEnd + 1, uriEnd - methodEnd - 1);
+        size_t contentLength = 0;
+        bool expectContinue = false;
+        for (size_t at = head.find("\r\n"); at != std::string::npos;) {
+            size_t next = head.find("\r\n", at + 2);
+            std::string line = head.substr(at + 2, next == std::string::npos ? std::string::npos : next - at - 2);
+            if (strncasecmp(line.c_str(), "Content-Length:", 15) == 0) contentLength = std::stoul(line.substr(15));
+            if (strncasecmp(line.c_str(), "Expect: 100-continue", 20) == 0) expectContinue = true;
+            at = next;
+        }
+        if (expectContinue && !SendAll(fd, "HTTP/1.1 100 Continue\r\n\r\n")) return false;
+        while (buffer.size() < contentLength) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) return false;
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+        std::string body = buffer.substr(0, contentLength);
+        buffer.erase(0, contentLength);
+
+        std::string answer;
+        int status = handler_(method, uri, body, answer);
+        std::string response = "HTTP/1.1 " + std::to_string(status) + (status < 300 ? " OK" : " Error") +
+                               "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(answer.size()) + "\r\n\r\n";
+        return SendAll(fd, response) && SendAll(fd, answer);
+    }
+
+    StubRestHandler handler_;
+    int listen_ = -1;
+    uint16_t port_ = 0;
+    std::thread acceptor_;
+    std::mutex mutex_;
+    std::vector<int> connections_;
+    std::vector<std::thread> threads_;
+};
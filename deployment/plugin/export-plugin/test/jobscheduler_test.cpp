@@ -0,0 +1,83 @@
+// JobScheduler under "priority": a steady stream of level 0 studies no longer starves an
+// unlisted class, which moves up one level per SCHEDULER_LEVEL_WAIT of waiting, while
+// SCHEDULER_LEVEL_WAIT=0 keeps the levels strict and smallest first holds within a level.
+#include "jobscheduler.h"
+
+#include <iostream>
+#include <string>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    SchedulerConfig Priority(int64_t levelWaitMs) {
+        SchedulerConfig config;
+        config.policy = SchedulerConfig::Policy_Priority;
+        config.levels = { { "CR", 0 }, { "DX", 0 }, { "CT", 2 } };
+        config.levelWaitMs = levelWaitMs;
+        return config;
+    }
+
+    // Pops of CR studies before the MR one, with a new CR arriving on every pop and the
+    // MR having waited waitedMs already
+    int PopsBeforeMr(JobScheduler<std::string>& scheduler, int64_t waitedMs, int limit) {
+        int64_t now = JobScheduler<std::string>::NowMs();
+        scheduler.Push("cr", 1000, "CR", now);
+        scheduler.Push("mr", 1000, "MR", now - waitedMs);
+        std::string label;
+        int64_t waited;
+        for (int pops = 0; pops < limit; ++pops) {
+            if (scheduler.Pop(label, waited) == "mr") return pops;
+            scheduler.Push("cr", 1000, "CR");
+        }
+        return limit;
+    }
+}
+
+int main() {
+    SchedulerConfig config = Priority(1000);
+    Expect(config.Rank("CR") == 0 && config.Rank("DX") == 0 && config.Rank("CT") == 1 && config.Rank("MR") == 2,
+           "ranks of CR, DX, CT and unlisted MR");
+
+    JobScheduler<std::string> strict(Priority(0));
+    Expect(PopsBeforeMr(strict, 3600000, 1000) == 1000, "strict levels starve MR behind a CR stream");
+
+    JobScheduler<std::string> fresh(Priority(1000));
+    Expect(PopsBeforeMr(fresh, 0, 100) == 100, "MR that just arrived waits behind CR");
+
+    // Two level waits lift MR (rank 2) to the level of CR, three above it
+    JobScheduler<std::string> even(Priority(1000));
+    int pops = PopsBeforeMr(even, 2500, 100);
+    Expect(pops < 100, "MR at the level of CR served by size, after " + std::to_string(pops) + " pops");
+    JobScheduler<std::string> aged(Priority(1000));
+    Expect(PopsBeforeMr(aged, 3500, 100) == 0, "MR past CR served first");
+
+    // Smallest first within a level, and the oldest of a level is seen behind its cheaper jobs
+    JobScheduler<std::string> sizes(Priority(1000));
+    int64_t now = JobScheduler<std::string>::NowMs();
+    sizes.Push("ct-old", 900000000, "CT", now - 5000);
+    sizes.Push("cr-big", 500000000, "CR", now);
+    sizes.Push("cr-small", 100, "CR", now);
+    sizes.Push("ct-small", 100, "CT", now);
+    std::string label;
+    int64_t waited;
+    Expect(sizes.Pop(label, waited) == "ct-old", "old CT behind a cheaper CT moves past CR");
+    Expect(waited >= 5000, "wait counted from the original queue time");
+    Expect(sizes.Pop(label, waited) == "cr-small" && sizes.Pop(label, waited) == "cr-big", "CR smallest first");
+    Expect(sizes.Pop(label, waited) == "ct-small" && sizes.Empty(), "CT last");
+
+    sizes.Push("a", 1, "CR");
+    sizes.Push("b", 1, "MR");
+    Expect(sizes.Drain().size() == 2 && sizes.Empty(), "drain empties both orders");
+    sizes.Push("c", 1, "MR");
+    Expect(sizes.Pop(label, waited) == "c" && sizes.Empty(), "usable after drain");
+
+    if (failures == 0) std::cout << "JobScheduler: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <regex>
+#include <string>
+#include <vector>
+
+// The StudyDescription parsing ScanDescription replaced, kept as the reference for the
+// equivalence test and the benchmark
+struct LegacyDescription {
+    std::vector<std::string> emails;
+    std::string password;
+    std::string cleaned;
+};
+
+inline LegacyDescription ParseLegacyDescription(const std::string& description) {
+    static const std::regex EMAIL_REGEX(R"(([\w\.-]+@[\w\.-]+\.\w+))");
+    static const std::regex PASSWORD_REGEX(R"(pw\s*=\s*([^\s]+))");
+
+    LegacyDescription result;
+    for (std::sregex_iterator it(description.begin(), description.end(), EMAIL_REGEX), end; it != end; ++it) {
+        std::string email = it->str(1);
+        if (std::find(result.emails.begin(), result.emails.end(), email) == result.emails.end()) {
+            result.emails.push_back(email);
+        }
+    }
+    std::smatch pwMatch;
+    if (std::regex_search(description, pwMatch, PASSWORD_REGEX)) {
+        result.password = pwMatch.str(1);
+    }
+    result.cleaned = std::regex_replace(description, EMAIL_REGEX, "");
+    result.cleaned = std::regex_replace(result.cleaned, PASSWORD_REGEX, "");
+    result.cleaned.erase(0, result.cleaned.find_first_not_of(" \t"));
+    result.cleaned.erase(result.cleaned.find_last_not_of(" \t") + 1);
+    return result;
+}
@@ -0,0 +1,151 @@
+// Mapping log at scale: appends from concurrent exports (group-committed fdatasync),
+// a compaction once most archives are uploaded, and FilesenderPlugin's MappingIndex
+// reading the whole log, tailing new records and looking archives up.
+//   mappinglog_bench [records] [writers] [dir]
+// dir defaults to /tmp; point it at the exports volume for realistic fdatasync costs.
+#include "mappingindex.h"
+#include "mappinglog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+namespace {
+    double Seconds(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    std::string Name(size_t i) {
+        return "PAT" + std::to_string(i) + "_20240131_CT_Thorax_20240131_120000_" + std::to_string(i % 1000) + ".zip";
+    }
+
+    uint64_t FileSize(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    }
+
+    double Percentile(std::vector<double>& values, double p) {
+        if (values.empty()) return 0;
+        size_t at = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + at, values.end());
+        return values[at];
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t records = argc > 1 ? std::atol(argv[1]) : 100000;
+    size_t writers = std::max(1L, argc > 2 ? std::atol(argv[2]) : 4);
+    std::string base = argc > 3 ? argv[3] : "/tmp";
+
+    std::string dirTemplate = base + "/mappinglog_bench.XXXXXX";
+    std::vector<char> dirBuffer(dirTemplate.begin(), dirTemplate.end());
+    dirBuffer.push_back('\0');
+    if (!mkdtemp(dirBuffer.data())) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dirBuffer.data();
+    std::string path = dir + "/mapping.json";
+    std::string uploaded = dir + "/uploaded";
+    mkdir(uploaded.c_str(), 0755);
+    const std::vector<std::string> emails = { "john.doe@hospital.ch", "anna-b@uni-bern.ch" };
+
+    MappingLog log(path, uploaded);
+
+    // Appends, each returning once durable, from concurrent writers
+    std::vector<std::vector<double>> latencies(writers);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < writers; ++w) {
+        threads.emplace_back([&, w] {
+            for (size_t i = w; i < records; i += writers) {
+                auto appendStart = std::chrono::steady_clock::now();
+                log.Append(Name(i), emails, 1700000000000 + i, "CT", "0123456789abcdef");
+                latencies[w].push_back(Seconds(appendStart) * 1e6);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double appendSeconds = Seconds(start);
+    std::vector<double> all;
+    for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::printf("append      %zu records, %zu writers: %.0f records/s, latency p50 %.0f us, p99 %.0f us, max %.0f us, "
+                "%llu fdatasyncs, %.1f MB\n",
+                records, writers, records / appendSeconds, Percentile(all, 0.5), Percentile(all, 0.99), Percentile(all, 1.0),
+                static_cast<unsigned long long>(log.Commits().Flushes()), FileSize(path) / 1e6);
+
+    // Index over the whole log, as after a FilesenderPlugin restart
+    MappingIndex index(path);
+    start = std::chrono::steady_clock::now();
+    index.Refresh();
+    double loadSeconds = Seconds(start);
+    size_t found = 0;
+    for (size_t i = 0; i < records; ++i) found += index.Find(Name(i)) != nullptr;
+    std::printf("index load  %zu of %zu records in %.1f ms (%.2f us/record)\n", found, records, loadSeconds * 1e3,
+                loadSeconds * 1e6 / std::max<size_t>(1, records));
+
+    // Lookups in random order, hits and misses
+    std::vector<std::string> names;
+    for (size_t i = 0; i < records; ++i) names.push_back(Name(i));
+    std::shuffle(names.begin(), names.end(), std::mt19937(1));
+    start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for (const auto& name : names) hits += index.Find(name) != nullptr;
+    double hitSeconds = Seconds(start);
+    start = std::chrono::steady_clock::now();
+    for (const auto& name : names) hits += index.Find("x" + name) != nullptr;
+    double missSeconds = Seconds(start);
+    std::printf("lookup      %.0f ns hit, %.0f ns miss (%zu hits)\n", hitSeconds * 1e9 / names.size(), missSeconds * 1e9 / names.size(),
+                hits);
+
+    // Tail: the watcher refreshes between exports, parsing only what was appended
+    const size_t tailRecords = 1000;
+    const size_t batch = 10;
+    double tailSeconds = 0;
+    for (size_t i = 0; i < tailRecords; i += batch) {
+        for (size_t j = 0; j < batch; ++j) log.Append(Name(records + i + j), emails, 1700000000000, "CT");
+        start = std::chrono::steady_clock::now();
+        index.Refresh();
+        tailSeconds += Seconds(start);
+    }
+    std::printf("index tail  %.1f us per refresh of %zu new records, %s\n", tailSeconds * 1e6 / (tailRecords / batch), batch,
+                index.Find(Name(records + tailRecords - 1)) ? "all found" : "MISSING RECORDS");
+    records += tailRecords;
+
+    // Compaction: 90% of the archives uploaded, appends continue until the log is rewritten
+    for (size_t i = 0; i < records; ++i) {
+        if (i % 10 != 0) std::ofstream(uploaded + "/" + Name(i) + ".uploaded");
+    }
+    uint64_t before = FileSize(path);
+    double compactMs = 0;
+    size_t extra = 0;
+    for (; extra < 4 * records; ++extra) {
+        start = std::chrono::steady_clock::now();
+        log.Append(Name(records + extra), emails, 1700000000000, "CT");
+        double ms = Seconds(start) * 1e3;
+        if (FileSize(path) < before) {
+            compactMs = ms;
+            break;
+        }
+        before = FileSize(path);
+    }
+    std::printf("compaction  %.1f ms for %zu records, %.1f MB -> %.1f MB, after %zu more appends\n", compactMs,
+                records + extra + 1, before / 1e6, FileSize(path) / 1e6, extra + 1);
+
+    // The index notices the new inode and reloads
+    start = std::chrono::steady_clock::now();
+    index.Refresh();
+    double reloadSeconds = Seconds(start);
+    std::printf("index reload after compaction: %.1f ms, %s\n", reloadSeconds * 1e3,
+                index.Find(Name(0)) && !index.Find(Name(1)) ? "uploaded records dropped" : "UNEXPECTED CONTENT");
+
+    std::system(("rm -rf '" + dir + "'").c_str());
+    return 0;
+}
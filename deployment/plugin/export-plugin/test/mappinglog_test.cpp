@@ -0,0 +1,93 @@
+// MappingLog records are valid JSON whatever the fields hold: quotes, backslashes and
+// control characters in an AE title class, a file name or a recipient parse back to the
+// values written, one record per line, and survive a compaction.
+#include "mappinglog.h"
+
+#include <json/json.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    std::vector<Json::Value> ReadRecords(const std::string& path) {
+        std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+        std::vector<Json::Value> records;
+        std::ifstream log(path);
+        std::string line;
+        while (std::getline(log, line)) {
+            Json::Value record;
+            std::string errs;
+            if (!reader->parse(line.data(), line.data() + line.size(), &record, &errs) || !record.isObject()) {
+                std::cerr << "unparsable record: " << line << "\n";
+                record = Json::Value();
+            }
+            records.push_back(record);
+        }
+        return records;
+    }
+}
+
+int main() {
+    char dirTemplate[] = "/tmp/mappinglog_test.XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+    std::string path = dir + "/mapping.jsonl";
+
+    const std::string cls = "AET:ER\"SCU\\1";
+    const std::string file = "P\"1_20240101_\\x_\t.zip";
+    const std::string email = "a\"b@example.org\n";
+    {
+        MappingLog log(path, dir);
+        Expect(log.Append("plain.zip", { "x@example.org", "y@example.org" }, 1700000000000, "CT", "0123abcd"), "append plain");
+        Expect(log.Append(file, { email }, 42, cls, "t\"r\x01"), "append with quotes and control characters");
+        Expect(log.Append("bare.zip", { "z@example.org" }, 7), "append without class and trace");
+    }
+
+    std::vector<Json::Value> records = ReadRecords(path);
+    Expect(records.size() == 3, "three lines, got " + std::to_string(records.size()));
+    if (records.size() == 3) {
+        Expect(records[0]["file"] == "plain.zip" && records[0]["emails"].size() == 2 && records[0]["emails"][1] == "y@example.org" &&
+                   records[0]["stable_at"].asInt64() == 1700000000000 && records[0]["class"] == "CT" && records[0]["trace"] == "0123abcd",
+               "plain record");
+        Expect(records[1]["file"] == file, "file name round trip");
+        Expect(records[1]["emails"].size() == 1 && records[1]["emails"][0] == email, "recipient round trip");
+        Expect(records[1]["class"] == cls, "class round trip");
+        Expect(records[1]["trace"] == "t\"r\x01", "trace round trip");
+        Expect(records[2]["file"] == "bare.zip" && !records[2].isMember("class") && !records[2].isMember("trace"),
+               "class and trace left out when unknown");
+    }
+
+    // Compaction keeps the escaped record readable and drops the uploaded ones
+    {
+        std::ofstream(dir + "/plain.zip.uploaded").put('\n');
+        std::ofstream(dir + "/bare.zip.uploaded").put('\n');
+        MappingLog log(path, dir);
+        for (int i = 0; i < 1100; ++i) {
+            std::string name = "n" + std::to_string(i) + ".zip";
+            std::ofstream(dir + "/" + name + ".uploaded").put('\n');
+            log.Append(name, { "x@example.org" }, i, cls);
+        }
+    }
+    records = ReadRecords(path);
+    bool found = false;
+    for (const auto& record : records) {
+        Expect(record.isObject(), "record parses after compaction");
+        found = found || (record["file"] == file && record["class"] == cls && record["emails"][0] == email);
+    }
+    Expect(found && records.size() < 1100, "escaped record kept by compaction, " + std::to_string(records.size()) + " left");
+
+    std::system(("rm -rf '" + dir + "'").c_str());
+    if (failures == 0) std::cout << "MappingLog: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,92 @@
+// LatencyHistogram and MetricCounter as published to Orthanc, through the stub SDK in
+// stub/: a value equal to a bound lands in that bucket, values above the last bound
+// only in _count, buckets are cumulative, and StageTimer observes once.
+#include "pipelinemetrics.h"
+
+#include <iostream>
+#include <string>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    float Published(const std::string& name) {
+        auto it = StubMetrics().find(name);
+        return it == StubMetrics().end() ? -1 : it->second;
+    }
+}
+
+int main() {
+    // One observation per bound, exactly on it, plus one just above it
+    {
+        LatencyHistogram histogram;
+        uint64_t sum = 0;
+        for (int64_t bound : LatencyHistogram::BOUNDS_MS) {
+            histogram.Observe(bound);
+            histogram.Observe(bound + 1);
+            sum += 2 * bound + 1;
+        }
+        StubMetrics().clear();
+        histogram.Publish(nullptr, "stage");
+        Expect(StubMetrics().size() == LatencyHistogram::BUCKETS + 2, "one value per bucket, _count and _sum");
+        // le_b holds the value on b and the one above every lower bound
+        for (size_t i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+            std::string name = "stage_le_" + std::to_string(LatencyHistogram::BOUNDS_MS[i]);
+            Expect(Published(name) == static_cast<float>(2 * i + 1), name + " = " + std::to_string(Published(name)));
+        }
+        Expect(Published("stage_count") == 2 * LatencyHistogram::BUCKETS, "300001 ms counted in _count");
+        Expect(Published("stage_le_300000") == 2 * LatencyHistogram::BUCKETS - 1, "300001 ms in no bucket");
+        Expect(Published("stage_sum") == static_cast<float>(sum), "sum");
+    }
+
+    // Zero and negative durations (clock steps) count in the first bucket and add nothing
+    {
+        LatencyHistogram histogram;
+        histogram.Observe(0);
+        histogram.Observe(-3);
+        histogram.Observe(11);
+        histogram.Observe(3600000);
+        StubMetrics().clear();
+        histogram.Publish(nullptr, "edge");
+        Expect(Published("edge_le_10") == 2 && Published("edge_le_50") == 3 && Published("edge_le_300000") == 3,
+               "cumulative buckets");
+        Expect(Published("edge_count") == 4 && Published("edge_sum") == 3600011, "count and sum");
+    }
+
+    // An empty histogram still publishes every series
+    {
+        LatencyHistogram histogram;
+        StubMetrics().clear();
+        histogram.Publish(nullptr, "empty");
+        Expect(Published("empty_le_10") == 0 && Published("empty_count") == 0 && Published("empty_sum") == 0, "empty histogram");
+    }
+
+    {
+        MetricCounter counter;
+        counter.Add();
+        counter.Add(41);
+        StubMetrics().clear();
+        counter.Publish(nullptr, "exported_total");
+        Expect(counter.Value() == 42 && Published("exported_total") == 42, "counter");
+    }
+
+    {
+        LatencyHistogram histogram;
+        {
+            StageTimer timer(histogram);
+            timer.Stop();
+        }
+        StubMetrics().clear();
+        histogram.Publish(nullptr, "timer");
+        Expect(Published("timer_count") == 1, "StageTimer observes once");
+    }
+
+    if (failures == 0) std::cout << "LatencyHistogram: ok\n";
+    return failures == 0 ? 0 : 1;
+}
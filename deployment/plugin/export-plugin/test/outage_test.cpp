@@ -0,0 +1,222 @@
+// Upload outage: studies keep arriving while nothing is uploaded. Two workers export
+// through ExportCredits into ex/ and move the archives to mq/ like QueuePlugin, the
+// uploader is down for the first phase and then marks and deletes archives like
+// FilesenderPlugin. Checks that admission never waits, the scheduled part of the queue
+// stays within its capacity, the backlog within the credit limits, and every study is
+// exported once the uploader is back.
+//   outage_test [studies] [outage ms]
+#include "admission.h"
+#include "flowcontrol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    const size_t CAPACITY = 8;
+    const uint64_t MAX_FILES = 10;
+    const int CREDIT_POLL_MS = 50;
+
+    struct Job {
+        int id;
+        uint64_t bytes;
+    };
+
+    int64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void WriteFile(const std::string& path, size_t bytes) {
+        std::vector<char> data(bytes, 'x');
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size())) {
+            std::cerr << "cannot write " << path << "\n";
+            std::exit(1);
+        }
+        close(fd);
+    }
+
+    // Archives in mq/ without .uploaded marker plus those still in ex/, by name as one can
+    // be moved between the two listings
+    uint64_t Backlog(const std::string& exportsDir, const std::string& queueDir) {
+        std::set<std::string> files;
+        for (const std::string& dir : { exportsDir, queueDir }) {
+            DIR* d = opendir(dir.c_str());
+            while (struct dirent* entry = d ? readdir(d) : nullptr) {
+                std::string name = entry->d_name;
+                if (name.size() > 4 && name[0] != '.' && name.compare(name.size() - 4, 4, ".zip") == 0 &&
+                    access((dir + "/" + name + ".uploaded").c_str(), F_OK) != 0) {
+                    files.insert(name);
+                }
+            }
+            if (d) closedir(d);
+        }
+        return files.size();
+    }
+}
+
+int main(int argc, char** argv) {
+    int studies = argc > 1 ? std::atoi(argv[1]) : 200;
+    int outageMs = argc > 2 ? std::atoi(argv[2]) : 1500;
+
+    char root[] = "/tmp/outage_test.XXXXXX";
+    if (!mkdtemp(root)) return 1;
+    std::string exportsDir = std::string(root) + "/ex";
+    std::string queueDir = std::string(root) + "/mq";
+    mkdir(exportsDir.c_str(), 0755);
+    mkdir(queueDir.c_str(), 0755);
+
+    ExportCredits credits(exportsDir, queueDir);
+    ExportCredits::Limits limits;
+    limits.maxFiles = MAX_FILES;
+    limits.maxBytes = 4 << 20;
+    limits.lowWatermark = 0;
+    limits.highWatermark = 0;
+    limits.scanIntervalMs = CREDIT_POLL_MS / 2;  // below the poll interval, as in the plugin
+    credits.Configure(limits);
+
+    // ExportQueue around AdmissionQueue, without Orthanc
+    std::mutex queueMutex;
+    std::condition_variable notEmpty;
+    AdmissionQueue<Job> jobs;
+    jobs.Configure(SchedulerConfig(), CAPACITY);
+    bool stopping = false;
+    size_t maxScheduled = 0;
+    std::atomic<int> exported{0};
+    std::atomic<uint64_t> maxBacklog{0};
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < 2; ++w) {
+        workers.emplace_back([&] {
+            for (;;) {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(queueMutex);
+                    notEmpty.wait(lock, [&] { return stopping || !jobs.Empty(); });
+                    if (stopping) return;
+                    std::string label;
+                    int64_t waited;
+                    job = jobs.Pop(label, waited);
+                    maxScheduled = std::max(maxScheduled, jobs.Scheduled());
+                }
+                ExportCredits::Usage usage;
+                std::string blockedBy;
+                while (!credits.TryAcquire(job.bytes, usage, blockedBy)) {
+                    if (!credits.Wait(CREDIT_POLL_MS)) return;
+                }
+                std::string name = "s" + std::to_string(job.id) + ".zip";
+                WriteFile(exportsDir + "/." + name, job.bytes);
+                rename((exportsDir + "/." + name).c_str(), (exportsDir + "/" + name).c_str());
+                uint64_t backlog = Backlog(exportsDir, queueDir);
+                uint64_t seen = maxBacklog.load();
+                while (backlog > seen && !maxBacklog.compare_exchange_weak(seen, backlog)) {
+                }
+                rename((exportsDir + "/" + name).c_str(), (queueDir + "/" + name).c_str());
+                credits.Release(job.bytes);
+                exported++;
+            }
+        });
+    }
+
+    std::atomic<bool> uploaderUp{false};
+    std::atomic<bool> done{false};
+    std::thread uploader([&] {
+        while (!done) {
+            if (uploaderUp) {
+                DIR* d = opendir(queueDir.c_str());
+                while (struct dirent* entry = d ? readdir(d) : nullptr) {
+                    std::string name = entry->d_name;
+                    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".zip") == 0) {
+                        WriteFile(queueDir + "/" + name + ".uploaded", 0);
+                        unlink((queueDir + "/" + name).c_str());
+                        unlink((queueDir + "/" + name + ".uploaded").c_str());
+                    }
+                }
+                if (d) closedir(d);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    });
+
+    // Orthanc's change callback: every study arrives during the outage
+    std::mt19937 random(7);
+    int64_t slowestAdmitMs = 0;
+    int64_t outageStart = NowMs();
+    for (int i = 0; i < studies; ++i) {
+        uint64_t bytes = (16 + random() % 48) << 10;
+        int64_t start = NowMs();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            jobs.Push(Job{ i, bytes }, bytes, "");
+            maxScheduled = std::max(maxScheduled, jobs.Scheduled());
+        }
+        notEmpty.notify_one();
+        slowestAdmitMs = std::max(slowestAdmitMs, NowMs() - start);
+    }
+    size_t overflowDuringOutage;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        overflowDuringOutage = jobs.Overflow();
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(std::max<int64_t>(0, outageMs - (NowMs() - outageStart))));
+    int exportedDuringOutage = exported;
+    uploaderUp = true;
+
+    int64_t deadline = NowMs() + 30000;
+    while (exported < studies && NowMs() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        stopping = true;
+    }
+    credits.Stop();
+    notEmpty.notify_all();
+    for (auto& worker : workers) worker.join();
+    done = true;
+    uploader.join();
+    std::string cleanup = std::string("rm -rf ") + root;
+    if (system(cleanup.c_str()) != 0) std::cerr << "cannot remove " << root << "\n";
+
+    std::cout << studies << " studies admitted in at most " << slowestAdmitMs << " ms each, " << overflowDuringOutage
+              << " in overflow, " << exportedDuringOutage << " exported during the outage (backlog max " << maxBacklog
+              << "), " << exported << " in total\n";
+
+    bool ok = true;
+    if (slowestAdmitMs > 100) {
+        std::cerr << "FAIL: admission waited " << slowestAdmitMs << " ms\n";
+        ok = false;
+    }
+    if (maxScheduled > CAPACITY) {
+        std::cerr << "FAIL: " << maxScheduled << " scheduled jobs, capacity " << CAPACITY << "\n";
+        ok = false;
+    }
+    if (exportedDuringOutage > static_cast<int>(MAX_FILES) || maxBacklog > MAX_FILES) {
+        std::cerr << "FAIL: " << exportedDuringOutage << " exports during the outage, backlog max " << maxBacklog << ", limit " << MAX_FILES << "\n";
+        ok = false;
+    }
+    if (overflowDuringOutage == 0) {
+        std::cerr << "FAIL: the overflow list was not used\n";
+        ok = false;
+    }
+    if (exported != studies) {
+        std::cerr << "FAIL: " << exported << " of " << studies << " studies exported\n";
+        ok = false;
+    }
+    return ok ? 0 : 1;
+}
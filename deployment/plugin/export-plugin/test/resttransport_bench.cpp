@@ -0,0 +1,123 @@
+// Per-study REST overhead of the export by transport, for studies of 10, 1000 and 10000
+// instances: the calls ExportStudy makes through OrthancRest (study, patient, series,
+// instances, /modify, delete), and the per-instance /instances/{id}/modify of studies the
+// byte-level rewriter cannot walk. In-process goes through the stub SDK in stub/, HTTP
+// through libcurl to a loopback server in this process (httpstub.h). Both answer the same
+// canned JSON, so the difference is the transport, not Orthanc's work behind it.
+//   resttransport_bench [rounds] [modified instance KB]
+#include "httpstub.h"
+#include "orthancrest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <curl/curl.h>
+#include <string>
+#include <vector>
+
+namespace {
+    // Orthanc's answers for one study of the given size; modified instances are kb KB
+    class CannedStudy {
+    public:
+        CannedStudy(size_t instances, size_t kb)
+            : modified_(kb * 1024, 'D') {
+            size_t seriesCount = instances / 200 + 1;
+            study_ = "{\"ID\": \"study\", \"ParentPatient\": \"patient\", \"Type\": \"Study\", \"MainDicomTags\": "
+                     "{\"StudyDescription\": \"CT Thorax [john.doe@hospital.ch] [pw=secret]\", \"StudyDate\": \"20240131\"}}";
+            patient_ = "{\"ID\": \"patient\", \"Type\": \"Patient\", \"MainDicomTags\": {\"PatientID\": \"PAT1\", "
+                       "\"PatientName\": \"DOE^JOHN\"}}";
+            series_ = "[";
+            for (size_t s = 0; s < seriesCount; ++s) {
+                series_ += (s ? ", " : "") + std::string("{\"ID\": \"series") + std::to_string(s) +
+                           "\", \"MainDicomTags\": {\"Modality\": \"CT\", \"SeriesNumber\": \"" + std::to_string(s + 1) +
+                           "\", \"SeriesDescription\": \"Thorax 1.0 B31f\"}, \"Type\": \"Series\"}";
+            }
+            series_ += "]";
+            instances_ = "[";
+            for (size_t i = 0; i < instances; ++i) {
+                instances_ += (i ? ", " : "") + std::string("{\"FileSize\": 527012, \"FileUuid\": \"3b1e6a2c-9f0d-4c55-8e11-") +
+                              std::to_string(100000000000 + i) + "\", \"ID\": \"instance" + std::to_string(i) +
+                              "\", \"IndexInSeries\": " + std::to_string(i % 200 + 1) + ", \"Labels\": [], \"MainDicomTags\": "
+                              "{\"InstanceNumber\": \"" + std::to_string(i % 200 + 1) + "\", \"SOPInstanceUID\": \"1.2.826.0.1.3680043.8.498." +
+                              std::to_string(i) + "\"}, \"ParentSeries\": \"series" + std::to_string(i / 200) + "\", \"Type\": \"Instance\"}";
+            }
+            instances_ += "]";
+        }
+
+        int Answer(const std::string& method, const std::string& uri, const std::string&, std::string& answer) const {
+            if (method == "GET" && uri == "/studies/study") answer = study_;
+            else if (method == "GET" && uri == "/patients/patient") answer = patient_;
+            else if (method == "GET" && uri == "/studies/study/series") answer = series_;
+            else if (method == "GET" && uri == "/studies/study/instances") answer = instances_;
+            else if (method == "POST" && uri == "/studies/study/modify") answer = "{\"ID\": \"cleaned\", \"Type\": \"Study\"}";
+            else if (method == "POST" && uri.compare(0, 11, "/instances/") == 0) answer = modified_;
+            else if (method == "DELETE" && uri == "/studies/study") answer = "{}";
+            else return 404;
+            return 200;
+        }
+
+        size_t InstancesBytes() const { return instances_.size(); }
+
+    private:
+        std::string study_, patient_, series_, instances_, modified_;
+    };
+
+    struct Overhead {
+        size_t calls = 0;
+        double ms = 0;
+        bool complete = true;  // every answer arrived in full
+    };
+
+    // The REST calls of one export, as counted in the "REST overhead" log line
+    Overhead Export(OrthancRest& rest, const CannedStudy& study, size_t instances, bool modifyEach, size_t kb) {
+        OrthancRest::ThreadStats() = OrthancRest::Stats();
+        bool complete = !rest.Get("/studies/study").empty();
+        complete = !rest.Get("/patients/patient").empty() && complete;
+        complete = !rest.Post("/studies/study/modify", "{\"Replace\": {\"StudyDescription\": \"CT Thorax\"}, \"Force\": true}").empty() && complete;
+        complete = !rest.Get("/studies/study/series").empty() && complete;
+        complete = rest.Get("/studies/study/instances").size() == study.InstancesBytes() && complete;
+        if (modifyEach) {
+            for (size_t i = 0; i < instances; ++i) {
+                complete = rest.Post("/instances/instance" + std::to_string(i) + "/modify", "{\"Replace\": {}, \"Force\": true}").size() ==
+                           kb * 1024 && complete;
+            }
+        }
+        complete = rest.Delete("/studies/study") && complete;
+        const OrthancRest::Stats& stats = OrthancRest::ThreadStats();
+        return Overhead{ stats.calls, std::chrono::duration<double, std::milli>(stats.elapsed).count(), complete };
+    }
+}
+
+int main(int argc, char** argv) {
+    int rounds = argc > 1 ? std::max(1, std::atoi(argv[1])) : 3;
+    size_t kb = argc > 2 ? std::atol(argv[2]) : 64;
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    std::printf("best of %d rounds, /instances/{id}/modify answers %zu KB\n", rounds, kb);
+    std::printf("%10s %12s %10s %8s %12s %10s %12s %10s\n", "instances", "transport", "list KB", "calls", "ms/study", "us/call",
+                "+modify ms", "us/call");
+    for (size_t instances : { 10, 1000, 10000 }) {
+        CannedStudy study(instances, kb);
+        StubRestApi() = [&study](const std::string& method, const std::string& uri, const std::string& body, std::string& answer) {
+            return study.Answer(method, uri, body, answer);
+        };
+        StubHttpServer server(StubRestApi());
+        for (bool http : { false, true }) {
+            OrthancRest rest;
+            rest.Configure(nullptr, http ? server.Url() : "");
+            Overhead best, bestModify;
+            for (int r = 0; r < rounds; ++r) {
+                Overhead plain = Export(rest, study, instances, false, kb);
+                Overhead modify = Export(rest, study, instances, true, kb);
+                if (r == 0 || plain.ms < best.ms) best = plain;
+                if (r == 0 || modify.ms < bestModify.ms) bestModify = modify;
+            }
+            std::printf("%10zu %12s %10.0f %8zu %12.3f %10.1f %12.1f %10.1f%s\n", instances, rest.TransportName(), study.InstancesBytes() / 1024.0,
+                        best.calls, best.ms, best.ms * 1000 / best.calls, bestModify.ms, bestModify.ms * 1000 / bestModify.calls,
+                        best.complete && bestModify.complete ? "" : "  INCOMPLETE ANSWERS");
+        }
+    }
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+// Stand-in for the parts of the Orthanc plugin SDK used by the headers in
+// deployment/plugin/common, orthancrest.cpp, QueuePlugin and FilesenderPlugin, so their
+// tests build without the SDK. Published metrics are kept in StubMetrics instead of going
+// to Orthanc. REST calls go to the routes plugins registered, then to the handler in
+// StubRestApi.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <regex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define ORTHANC_PLUGINS_API __attribute__((visibility("default")))
+
+typedef struct _OrthancPluginContext_t OrthancPluginContext;
+
+typedef enum {
+    OrthancPluginErrorCode_InternalError = -1,
+    OrthancPluginErrorCode_Success = 0,
+    OrthancPluginErrorCode_BadRequest = 8,
+    OrthancPluginErrorCode_UnknownResource = 17
+} OrthancPluginErrorCode;
+
+typedef enum {
+    OrthancPluginMetricsType_Default = 0,
+    OrthancPluginMetricsType_Timer = 1
+} OrthancPluginMetricsType;
+
+typedef struct {
+    void* data;
+    uint32_t size;
+} OrthancPluginMemoryBuffer;
+
+typedef enum {
+    OrthancPluginHttpMethod_Get = 1,
+    OrthancPluginHttpMethod_Post = 2,
+    OrthancPluginHttpMethod_Put = 3,
+    OrthancPluginHttpMethod_Delete = 4
+} OrthancPluginHttpMethod;
+
+typedef struct {
+    OrthancPluginHttpMethod method;
+    uint32_t groupsCount;
+    const char* const* groups;
+    uint32_t getCount;
+    const char* const* getKeys;
+    const char* const* getValues;
+    const void* body;
+    uint32_t bodySize;
+    uint32_t headersCount;
+    const char* const* headersKeys;
+    const char* const* headersValues;
+} OrthancPluginHttpRequest;
+
+// What a route answered
+typedef struct _OrthancPluginRestOutput_t {
+    int status = 200;
+    std::string answer;
+} OrthancPluginRestOutput;
+
+typedef OrthancPluginErrorCode (*OrthancPluginRestCallback)(OrthancPluginRestOutput* output, const char* url,
+                                                            const OrthancPluginHttpRequest* request);
+typedef void (*OrthancPluginRefreshMetricsCallback)();
+
+inline void OrthancPluginLogInfo(OrthancPluginContext*, const char*) {}
+inline void OrthancPluginLogWarning(OrthancPluginContext*, const char*) {}
+inline void OrthancPluginLogError(OrthancPluginContext*, const char*) {}
+
+inline std::map<std::string, float>& StubMetrics() {
+    static std::map<std::string, float> metrics;
+    return metrics;
+}
+
+inline void OrthancPluginSetMetricsValue(OrthancPluginContext*, const char* name, float value, OrthancPluginMetricsType) {
+    StubMetrics()[name] = value;
+}
+
+// The Orthanc REST API: sets answer and returns the HTTP status. Unset, everything is 404.
+typedef std::function<int(const std::string& method, const std::string& uri, const std::string& body, std::string& answer)> StubRestHandler;
+
+inline StubRestHandler& StubRestApi() {
+    static StubRestHandler handler;
+    return handler;
+}
+
+inline std::vector<std::pair<std::regex, OrthancPluginRestCallback>>& StubRoutes() {
+    static std::vector<std::pair<std::regex, OrthancPluginRestCallback>> routes;
+    return routes;
+}
+
+inline std::vector<OrthancPluginRefreshMetricsCallback>& StubRefreshMetrics() {
+    static std::vector<OrthancPluginRefreshMetricsCallback> callbacks;
+    return callbacks;
+}
+
+inline void OrthancPluginRegisterRestCallback(OrthancPluginContext*, const char* pathRegularExpression, OrthancPluginRestCallback callback) {
+    StubRoutes().emplace_back(std::regex(pathRegularExpression), callback);
+}
+
+inline void OrthancPluginRegisterRefreshMetricsCallback(OrthancPluginContext*, OrthancPluginRefreshMetricsCallback callback) {
+    StubRefreshMetrics().push_back(callback);
+}
+
+inline void OrthancPluginSendHttpStatusCode(OrthancPluginContext*, OrthancPluginRestOutput* output, uint16_t status) {
+    output->status = status;
+}
+
+inline void OrthancPluginSendMethodNotAllowed(OrthancPluginContext*, OrthancPluginRestOutput* output, const char*) {
+    output->status = 405;
+}
+
+inline void OrthancPluginAnswerBuffer(OrthancPluginContext*, OrthancPluginRestOutput* output, const void* answer, uint32_t answerSize,
+                                      const char*) {
+    output->answer.assign(static_cast<const char*>(answer), answerSize);
+}
+
+// A call as Orthanc dispatches it, over HTTP or from a plugin: a matching plugin route
+// if there is one (and plugins are asked), else StubRestApi
+inline int StubDispatch(const std::string& method, const std::string& uri, const std::string& body, std::string& answer, bool plugins) {
+    if (plugins) {
+        for (const auto& route : StubRoutes()) {
+            std::smatch match;
+            if (!std::regex_match(uri, match, route.first)) continue;
+            std::vector<std::string> groups(match.begin() + 1, match.end());
+            std::vector<const char*> groupPointers;
+            for (const auto& group : groups) groupPointers.push_back(group.c_str());
+            OrthancPluginHttpRequest request{};
+            request.method = method == "GET" ? OrthancPluginHttpMethod_Get : method == "POST" ? OrthancPluginHttpMethod_Post
+                           : method == "PUT" ? OrthancPluginHttpMethod_Put : OrthancPluginHttpMethod_Delete;
+            request.groupsCount = static_cast<uint32_t>(groups.size());
+            request.groups = groupPointers.data();
+            request.body = body.data();
+            request.bodySize = static_cast<uint32_t>(body.size());
+            OrthancPluginRestOutput output;
+            if (route.second(&output, uri.c_str(), &request) != OrthancPluginErrorCode_Success) return 500;
+            answer = output.answer;
+            return output.status;
+        }
+    }
+    return StubRestApi() ? StubRestApi()(method, uri, body, answer) : 404;
+}
+
+inline OrthancPluginErrorCode StubRestCall(OrthancPluginMemoryBuffer* target, const std::string& method, const char* uri,
+                                           const void* body, uint32_t bodySize, bool plugins = false) {
+    std::string answer;
+    std::string request(static_cast<const char*>(body), bodySize);
+    int status = StubDispatch(method, uri, request, answer, plugins);
+    if (status < 200 || status >= 300) {
+        return status == 404 ? OrthancPluginErrorCode_UnknownResource : OrthancPluginErrorCode_BadRequest;
+    }
+    if (target) {
+        target->size = static_cast<uint32_t>(answer.size());
+        target->data = std::malloc(answer.size() > 0 ? answer.size() : 1);
+        std::memcpy(target->data, answer.data(), answer.size());
+    }
+    return OrthancPluginErrorCode_Success;
+}
+
+inline void OrthancPluginFreeMemoryBuffer(OrthancPluginContext*, OrthancPluginMemoryBuffer* buffer) {
+    std::free(buffer->data);
+    buffer->data = nullptr;
+    buffer->size = 0;
+}
+
+inline OrthancPluginErrorCode OrthancPluginRestApiGet(OrthancPluginContext*, OrthancPluginMemoryBuffer* target, const char* uri) {
+    return StubRestCall(target, "GET", uri, "", 0);
+}
+
+inline OrthancPluginErrorCode OrthancPluginRestApiPost(OrthancPluginContext*, OrthancPluginMemoryBuffer* target, const char* uri,
+                                                       const void* body, uint32_t bodySize) {
+    return StubRestCall(target, "POST", uri, body, bodySize);
+}
+
+inline OrthancPluginErrorCode OrthancPluginRestApiPostAfterPlugins(OrthancPluginContext*, OrthancPluginMemoryBuffer* target,
+                                                                   const char* uri, const void* body, uint32_t bodySize) {
+    return StubRestCall(target, "POST", uri, body, bodySize, true);
+}
+
+inline OrthancPluginErrorCode OrthancPluginRestApiDelete(OrthancPluginContext*, const char* uri) {
+    return StubRestCall(nullptr, "DELETE", uri, "", 0);
+}
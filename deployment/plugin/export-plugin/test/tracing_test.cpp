@@ -0,0 +1,182 @@
+// Tracing: the ring keeps the last TRACE_RING_SPANS spans, span files rotate to .1 before
+// they pass TRACE_FILE_MB without splitting lines, Escape keeps quotes, backslashes and
+// control characters from breaking a line, and the merge of the three plugins' files for
+// /pipeline/trace parses as a Chrome trace ordered by start_us.
+#include "tracemerge.h"
+#include "tracing.h"
+
+#include <json/json.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    bool Parse(const std::string& text, Json::Value& value) {
+        std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+        std::string errs;
+        return reader->parse(text.data(), text.data() + text.size(), &value, &errs);
+    }
+
+    TraceSpan Span(const std::string& trace, const std::string& name, const std::string& subject, int64_t startUs) {
+        TraceSpan span;
+        span.trace = trace;
+        span.name = name;
+        span.subject = subject;
+        span.startUs = startUs;
+        span.endUs = startUs + 100;
+        span.outcome = "ok";
+        return span;
+    }
+
+    // Lines of a span file, each parsed; unparsable lines come back as null values
+    std::vector<Json::Value> Lines(const std::string& path, uint64_t& bytes) {
+        std::vector<Json::Value> lines;
+        std::ifstream in(path);
+        std::string line;
+        bytes = 0;
+        while (std::getline(in, line)) {
+            Json::Value value;
+            if (!Parse(line, value)) value = Json::Value();
+            lines.push_back(value);
+            bytes += line.size() + 1;
+        }
+        return lines;
+    }
+}
+
+int main() {
+    char dirTemplate[] = "/tmp/tracing_test.XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+
+    // Escape: quotes and backslashes escaped, control characters blanked, UTF-8 kept
+    {
+        TraceSpan span = Span("t\"1", "na\\me", "a\"b\\c\nd\te\x01" "f Z\xc3\xbcrich", 1);
+        span.outcome = "error: \"quoted\"\r\n";
+        Json::Value parsed;
+        std::string line = span.ToJson();
+        Expect(line.find('\n') == std::string::npos, "one line");
+        Expect(Parse(line, parsed), "escaped span parses: " + line);
+        Expect(parsed["trace"] == "t\"1" && parsed["name"] == "na\\me", "quote and backslash round trip");
+        Expect(parsed["subject"] == "a\"b\\c d e f Z\xc3\xbcrich", "control characters blanked, UTF-8 kept");
+        Expect(parsed["outcome"] == "error: \"quoted\"  ", "outcome escaped");
+        Expect(TraceSpan::Escape("plain") == "plain", "plain text unchanged");
+    }
+
+    // Ring: the last TRACE_RING_SPANS spans, spans without a trace dropped
+    {
+        TraceLog log("ExportPlugin");
+        log.Configure("", 5, 0);
+        for (int i = 0; i < 8; ++i) log.Record(Span(i % 2 ? "odd" : "even", "s" + std::to_string(i), "study", i));
+        log.Record(Span("", "untraced", "study", 9));
+        std::vector<TraceSpan> recent = log.Recent();
+        Expect(recent.size() == 5 && recent.front().name == "s3" && recent.back().name == "s7", "ring holds s3 to s7");
+        Expect(log.Recent("odd").size() == 3 && log.Recent("none").empty(), "ring filtered by trace");
+        Expect(!log.FileEnabled(), "no span file without TRACE_DIR");
+    }
+
+    // Rotation: the file is moved to .1 before a line would take it past the limit
+    {
+        std::string rotateDir = dir + "/rotate";
+        const uint64_t limit = 2000;
+        TraceLog log("QueuePlugin");
+        log.Configure(rotateDir, 16, limit);
+        const int spans = 60;  // about 200 bytes each, several rotations
+        for (int i = 0; i < spans; ++i) log.Record(Span("trace", "span" + std::to_string(i), "archive.zip", i));
+        std::string path = rotateDir + "/QueuePlugin.trace.jsonl";
+        uint64_t currentBytes = 0, rotatedBytes = 0;
+        std::vector<Json::Value> current = Lines(path, currentBytes);
+        std::vector<Json::Value> rotated = Lines(path + ".1", rotatedBytes);
+        Expect(!rotated.empty() && rotatedBytes <= limit && currentBytes <= limit, "both generations within TRACE_FILE_MB");
+        Expect(rotatedBytes + 250 > limit, "rotated only when the next line did not fit");
+        bool whole = true;
+        for (const auto& line : current) whole = whole && line.isObject();
+        for (const auto& line : rotated) whole = whole && line.isObject();
+        Expect(whole, "every line whole");
+        Expect(!current.empty() && current.back()["name"] == "span" + std::to_string(spans - 1), "newest span last");
+        auto index = [](const Json::Value& span) { return std::atoi(span["name"].asCString() + 4); };
+        Expect(!rotated.empty() && !current.empty() && index(rotated.back()) + 1 == index(current.front()), "generations consecutive");
+
+        // Reopened, the size already in the file counts
+        TraceLog reopened("QueuePlugin");
+        reopened.Configure(rotateDir, 16, limit);
+        for (int i = 0; i < 20; ++i) reopened.Record(Span("trace", "again" + std::to_string(i), "archive.zip", i));
+        Lines(path, currentBytes);
+        Expect(currentBytes <= limit, "limit kept across a restart");
+    }
+
+    // Merge: three plugins writing the same trace out of order, one of them rotated
+    {
+        std::string mergeDir = dir + "/merge";
+        TraceLog exporter("ExportPlugin"), queue("QueuePlugin"), uploader("FilesenderPlugin");
+        exporter.Configure(mergeDir, 16, 0);
+        queue.Configure(mergeDir, 16, 0);
+        uploader.Configure(mergeDir, 16, 700);
+        const std::string trace = "00000000000000aa";
+        // Spans are written when they end, so the enclosing export span comes last
+        exporter.Record(Span(trace, "metadata", "study-1", 1100));
+        exporter.Record(Span(trace, "archive", "study-1", 1300));
+        exporter.Record(Span(trace, "export", "study-1", 1000));
+        queue.Record(Span(trace, "enqueue", "a.zip", 1500));
+        uploader.Record(Span(trace, "queue", "a.zip", 1600));
+        uploader.Record(Span(trace, "upload", "a.zip", 1700));
+        uploader.Record(Span(trace, "chunk", "a.zip", 1650));
+        uploader.Record(Span(trace, "upload", "a.zip", 1800));
+        exporter.Record(Span("00000000000000bb", "export", "study-2", 1200));
+        uploader.Record(Span("00000000000000bb", "upload", "b.zip", 1900));
+
+        std::ifstream rotated(mergeDir + "/FilesenderPlugin.trace.jsonl.1");
+        Expect(rotated.good(), "uploader spans split over .1 and the current file");
+
+        std::vector<Json::Value> spans = LoadTraceSpans(exporter, trace);
+        Expect(spans.size() == 8, "eight spans of the trace, got " + std::to_string(spans.size()));
+        bool ordered = true;
+        for (size_t i = 1; i < spans.size(); ++i) ordered = ordered && spans[i - 1]["start_us"].asInt64() <= spans[i]["start_us"].asInt64();
+        Expect(ordered, "spans ordered by start_us");
+        Expect(LoadTraceSpans(exporter, "study-1").size() == 8, "found by study id");
+        Expect(LoadTraceSpans(exporter, "a.zip").size() == 8, "found by archive name");
+        Expect(LoadTraceSpans(exporter, "unknown").empty(), "unknown id");
+
+        Json::Value chrome;
+        Expect(Parse(ChromeTrace(spans), chrome) && chrome["traceEvents"].isArray(), "Chrome trace parses");
+        std::map<std::string, int> processes;
+        int64_t lastTs = 0;
+        int events = 0;
+        bool sorted = true;
+        for (const auto& event : chrome["traceEvents"]) {
+            if (event["ph"] == "M" && event["name"] == "process_name") processes[event["args"]["name"].asString()] = event["pid"].asInt();
+            if (event["ph"] != "X") continue;
+            sorted = sorted && event["ts"].asInt64() >= lastTs;
+            lastTs = event["ts"].asInt64();
+            events++;
+            Expect(event["dur"].asInt64() == 100 && event["args"]["trace"] == trace, "complete event of the trace");
+        }
+        Expect(events == 8 && sorted, "events in start order");
+        Expect(processes.size() == 3 && processes["ExportPlugin"] == 1 && processes["QueuePlugin"] == 2 && processes["FilesenderPlugin"] == 3,
+               "one process per plugin");
+
+        // Without span files the ring of this plugin answers
+        TraceLog ringOnly("ExportPlugin");
+        ringOnly.Configure("", 16, 0);
+        ringOnly.Record(Span(trace, "archive", "study-1", 20));
+        ringOnly.Record(Span(trace, "export", "study-1", 10));
+        spans = LoadTraceSpans(ringOnly, "study-1");
+        Expect(spans.size() == 2 && spans[0]["name"] == "export", "ring spans ordered by start_us");
+    }
+
+    std::system(("rm -rf '" + dir + "'").c_str());
+    if (failures == 0) std::cout << "Tracing: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+// Stable study to upload start across the handoff that used to sleep: the end of
+// ExportStudy (archive and mapping record made durable, /send in-process), QueuePlugin's
+// move and /filesender/notify, then FilesenderPlugin's watcher and upload pool up to a
+// worker starting the upload against mock_filesender.py. The study is stamped stable just
+// before its archive is written, so Orthanc's /modify and the ZIP itself are not
+// included. Both plugins are built against the stub SDK in stub/, FilesenderPlugin with
+// its entry points renamed (see CMakeLists.txt); the latency is the one FilesenderPlugin
+// logs for each upload. Studies go one at a time, so none waits for an upload worker.
+// Run through uploadstart_bench.sh, which starts the mock server.
+//   uploadstart_bench <rest.php url> [studies] [recipients]
+#include "mappinglog.h"
+#include "orthancrest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C" ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context);
+extern "C" ORTHANC_PLUGINS_API int32_t FilesenderPluginInitialize(OrthancPluginContext* context);
+extern "C" ORTHANC_PLUGINS_API void FilesenderPluginFinalize();
+
+namespace {
+    int64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // The archive as FileSink leaves it: data fsync'd, then its directory entry
+    bool WriteArchive(const std::string& dir, const std::string& name, const std::string& data) {
+        int fd = open((dir + "/" + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        bool ok = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()) && fsync(fd) == 0;
+        close(fd);
+        int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) return false;
+        ok = fsync(dirFd) == 0 && ok;
+        close(dirFd);
+        return ok;
+    }
+
+    bool WaitFor(const std::string& path, int timeoutMs) {
+        struct stat st;
+        for (int waited = 0; stat(path.c_str(), &st) != 0; ++waited) {
+            if (waited >= timeoutMs) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: uploadstart_bench <rest.php url> [studies] [recipients]\n");
+        return 2;
+    }
+    size_t studies = argc > 2 ? std::max(1L, std::atol(argv[2])) : 50;
+    size_t recipients = argc > 3 ? std::max(1L, std::atol(argv[3])) : 2;
+    const std::string root = QUEUE_PLUGIN_ROOT;
+    std::system(("rm -rf '" + root + "'").c_str());
+    mkdir(root.c_str(), 0755);
+
+    setenv("FILESENDER_BASE_URL", argv[1], 1);
+    setenv("FILESENDER_USERNAME", "user@example.org", 1);
+    setenv("FILESENDER_API_KEY", "secretkey", 1);
+    setenv("FILESENDER_UPLOAD_WORKERS", "1", 1);
+    // QueuePlugin first: it creates /mailqueue, which FilesenderPlugin watches
+    if (OrthancPluginInitialize(nullptr) != 0 || FilesenderPluginInitialize(nullptr) != 0) {
+        std::fprintf(stderr, "plugin initialization failed\n");
+        return 1;
+    }
+    OrthancRest rest;
+    rest.Configure(nullptr, "");
+    MappingLog mapping(root + "/exports/mapping.json", root + "/mailqueue");
+
+    std::vector<std::string> emails;
+    std::string recipientList;
+    for (size_t r = 0; r < recipients; ++r) {
+        emails.push_back("r" + std::to_string(r) + "@hospital.ch");
+        recipientList += (r ? "," : "") + emails.back();
+    }
+    const std::string archive(64 * 1024, 'x');
+    int rc = 0;
+    for (size_t i = 0; i < studies && rc == 0; ++i) {
+        std::string name = "study" + std::to_string(i) + ".zip";
+        int64_t stableAt = NowMs();
+        if (!WriteArchive(root + "/exports", name, archive) || !mapping.Append(name, emails, stableAt) ||
+            rest.PostForm("/send", "studyId=study&file=" + name + "&email=" + recipientList + "&trace=") != "OK") {
+            std::fprintf(stderr, "handoff of %s failed\n", name.c_str());
+            rc = 1;
+        } else if (!WaitFor(root + "/mailqueue/" + name + ".uploaded", 30000)) {
+            std::fprintf(stderr, "%s was not uploaded within 30 s\n", name.c_str());
+            rc = 1;
+        }
+    }
+    FilesenderPluginFinalize();
+
+    // "Upload start latency for <file>: <ms> ms after stable study (median ...)"
+    std::vector<long> latencies;
+    std::ifstream log(root + "/logs/filesender/filesender.log");
+    const std::string marker = "Upload start latency for ";
+    for (std::string line; std::getline(log, line);) {
+        size_t at = line.find(marker);
+        size_t colon = at == std::string::npos ? at : line.find(": ", at);
+        if (colon != std::string::npos) latencies.push_back(std::atol(line.c_str() + colon + 2));
+    }
+    if (rc != 0 || latencies.size() != studies) {
+        std::fprintf(stderr, "%zu of %zu uploads started\n", latencies.size(), studies);
+        return 1;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%zu studies, %zu recipients, one at a time\n", studies, recipients);
+    std::printf("%-32s %8s %8s %8s\n", "stable study to upload start", "p50 ms", "p90 ms", "max ms");
+    std::printf("%-32s %8ld %8ld %8ld\n", "event-driven handoff", latencies[latencies.size() / 2],
+                latencies[latencies.size() * 9 / 10], latencies.back());
+    std::system(("rm -rf '" + root + "'").c_str());
+    return 0;
+}
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Median time from stable study to upload start (uploadstart_bench.cpp) against the mock
+# FileSender server of the FilesenderPlugin tests.
+#   uploadstart_bench.sh <uploadstart_bench> [studies] [recipients]
+BENCH=$(realpath "$1")
+shift
+source "$(dirname "$0")/../../filesender-plugin/test/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+mkdir out
+start_mock --chunk-size 1048576 --log requests.log --out-dir out
+# The plugins log to stderr as well
+"$BENCH" "$MOCK_URL" "$@" 2> bench.err || { cat bench.err; exit 1; }
+grep -q "sig=BAD" requests.log && { echo "FAIL: bad signatures"; exit 1; }
+exit 0
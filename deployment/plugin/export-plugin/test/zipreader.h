@@ -0,0 +1,288 @@
+#pragma once
+
+// Minimal ZIP reader for the tests, independent of zipwriter.cpp: finds the central
+// directory through the end record (and the Zip64 locator and end record), reads the
+// Zip64 extras, checks the local headers against the central ones, and extracts entries
+// through ZipCrypto and zlib's inflate, verifying the check byte, size and CRC.
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct ZipEntryInfo {
+    std::string name;
+    uint16_t versionNeeded = 0;
+    uint16_t flags = 0;
+    uint16_t method = 0;
+    uint32_t crc = 0;
+    uint64_t compressedSize = 0;
+    uint64_t uncompressedSize = 0;
+    uint64_t localHeaderOffset = 0;
+    bool zip64Extra = false;  // sizes or offset came from a Zip64 extra field
+};
+
+struct ZipArchive {
+    std::vector<ZipEntryInfo> entries;
+    bool zip64End = false;  // Zip64 end record found through its locator
+};
+
+enum ZipExtractResult {
+    ZipExtract_Ok,
+    ZipExtract_BadHeader,     // local header missing or disagreeing with the central one
+    ZipExtract_BadCheckByte,  // ZipCrypto check byte differs from the CRC: wrong password
+    ZipExtract_BadData,       // inflate failed
+    ZipExtract_BadSize,
+    ZipExtract_BadCrc
+};
+
+class ZipReader {
+public:
+    explicit ZipReader(const std::string& path) {
+        fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd_ >= 0 && fstat(fd_, &st) == 0) size_ = static_cast<uint64_t>(st.st_size);
+    }
+
+    ~ZipReader() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    // Reads the central directory; error describes the first problem found
+    bool ReadDirectory(ZipArchive& archive, std::string& error) {
+        if (fd_ < 0 || size_ < 22) return Fail(error, "no archive");
+
+        size_t tail = static_cast<size_t>(std::min<uint64_t>(size_, 22 + 0xffff));
+        std::vector<uint8_t> end(tail);
+        if (!ReadAt(size_ - tail, end.data(), tail)) return Fail(error, "short read");
+        size_t at = tail - 22;
+        while (Get32(&end[at]) != 0x06054b50) {
+            if (at == 0) return Fail(error, "no end of central directory");
+            at--;
+        }
+        uint64_t count = Get16(&end[at + 10]);
+        uint64_t directorySize = Get32(&end[at + 12]);
+        uint64_t directoryOffset = Get32(&end[at + 16]);
+        uint64_t endOffset = size_ - tail + at;
+
+        if (count == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) {
+            uint8_t locator[20];
+            if (endOffset < 20 || !ReadAt(endOffset - 20, locator, 20) || Get32(locator) != 0x07064b50) {
+                return Fail(error, "no Zip64 end of central directory locator");
+            }
+            uint64_t zip64EndOffset = Get64(&locator[8]);
+            uint8_t zip64End[56];
+            if (!ReadAt(zip64EndOffset, zip64End, 56) || Get32(zip64End) != 0x06064b50) {
+                return Fail(error, "no Zip64 end of central directory record");
+            }
+            if (Get64(&zip64End[4]) != 44 || zip64EndOffset + 56 != endOffset - 20) {
+                return Fail(error, "Zip64 end of central directory record size");
+            }
+            count = Get64(&zip64End[32]);
+            directorySize = Get64(&zip64End[40]);
+            directoryOffset = Get64(&zip64End[48]);
+            archive.zip64End = true;
+        }
+
+        std::vector<uint8_t> directory(static_cast<size_t>(directorySize));
+        if (!ReadAt(directoryOffset, directory.data(), directory.size())) return Fail(error, "central directory out of range");
+        size_t p = 0;
+        for (uint64_t i = 0; i < count; ++i) {
+            if (p + 46 > directory.size() || Get32(&directory[p]) != 0x02014b50) {
+                return Fail(error, "central header " + std::to_string(i));
+            }
+            const uint8_t* h = &directory[p];
+            ZipEntryInfo entry;
+            entry.versionNeeded = Get16(h + 6);
+            entry.flags = Get16(h + 8);
+            entry.method = Get16(h + 10);
+            entry.crc = Get32(h + 16);
+            entry.compressedSize = Get32(h + 20);
+            entry.uncompressedSize = Get32(h + 24);
+            size_t nameSize = Get16(h + 28);
+            size_t extraSize = Get16(h + 30);
+            size_t commentSize = Get16(h + 32);
+            entry.localHeaderOffset = Get32(h + 42);
+            if (p + 46 + nameSize + extraSize + commentSize > directory.size()) {
+                return Fail(error, "central header " + std::to_string(i) + " overruns");
+            }
+            entry.name.assign(reinterpret_cast<const char*>(h + 46), nameSize);
+
+            // The Zip64 extra holds exactly the fields saturated in the header, in this order
+            const uint8_t* extra = h + 46 + nameSize;
+            for (size_t e = 0; e + 4 <= extraSize;) {
+                uint16_t id = Get16(extra + e);
+                uint16_t length = Get16(extra + e + 2);
+                if (id == 0x0001) {
+                    const uint8_t* field = extra + e + 4;
+                    size_t expected = 0;
+                    if (entry.uncompressedSize == 0xffffffff) {
+                        entry.uncompressedSize = Get64(field + expected);
+                        expected += 8;
+                    }
+                    if (entry.compressedSize == 0xffffffff) {
+                        entry.compressedSize = Get64(field + expected);
+                        expected += 8;
+                    }
+                    if (entry.localHeaderOffset == 0xffffffff) {
+                        entry.localHeaderOffset = Get64(field + expected);
+                        expected += 8;
+                    }
+                    if (expected != length) return Fail(error, "Zip64 extra size of " + entry.name);
+                    entry.zip64Extra = true;
+                }
+                e += 4 + length;
+            }
+            if (!entry.zip64Extra && (entry.uncompressedSize == 0xffffffff || entry.compressedSize == 0xffffffff)) {
+                return Fail(error, "saturated size without Zip64 extra in " + entry.name);
+            }
+            archive.entries.push_back(entry);
+            p += 46 + nameSize + extraSize + commentSize;
+        }
+        if (p != directory.size()) return Fail(error, "central directory size");
+        return true;
+    }
+
+    // Extracts entry into out (if given); nonZero counts the non-zero bytes
+    ZipExtractResult Extract(const ZipEntryInfo& entry, const std::string& password, std::vector<uint8_t>* out,
+                             uint64_t* nonZero = nullptr) {
+        uint8_t local[30];
+        if (!ReadAt(entry.localHeaderOffset, local, 30) || Get32(local) != 0x04034b50) return ZipExtract_BadHeader;
+        size_t nameSize = Get16(local + 26);
+        size_t extraSize = Get16(local + 28);
+        std::vector<uint8_t> nameAndExtra(nameSize + extraSize);
+        if (!ReadAt(entry.localHeaderOffset + 30, nameAndExtra.data(), nameAndExtra.size())) return ZipExtract_BadHeader;
+        uint64_t compressedSize = Get32(local + 18);
+        uint64_t uncompressedSize = Get32(local + 22);
+        if (compressedSize == 0xffffffff || uncompressedSize == 0xffffffff) {
+            // Local Zip64 extras always hold both sizes
+            if (extraSize < 20 || Get16(&nameAndExtra[nameSize]) != 0x0001 || Get16(&nameAndExtra[nameSize + 2]) != 16) {
+                return ZipExtract_BadHeader;
+            }
+            uncompressedSize = Get64(&nameAndExtra[nameSize + 4]);
+            compressedSize = Get64(&nameAndExtra[nameSize + 12]);
+        }
+        if (Get16(local + 4) != entry.versionNeeded || Get16(local + 4) < (entry.zip64Extra ? 45 : 20) ||
+            Get16(local + 6) != entry.flags || Get16(local + 8) != entry.method ||
+            Get32(local + 14) != entry.crc || compressedSize != entry.compressedSize || uncompressedSize != entry.uncompressedSize ||
+            std::string(reinterpret_cast<const char*>(nameAndExtra.data()), nameSize) != entry.name) {
+            return ZipExtract_BadHeader;
+        }
+
+        uint64_t offset = entry.localHeaderOffset + 30 + nameSize + extraSize;
+        uint64_t remaining = entry.compressedSize;
+        Keys keys;
+        bool encrypted = (entry.flags & 1) != 0;
+        if (encrypted) {
+            for (char c : password) keys.Update(static_cast<uint8_t>(c));
+            uint8_t header[12];
+            if (remaining < 12 || !ReadAt(offset, header, 12)) return ZipExtract_BadHeader;
+            keys.Decrypt(header, 12);
+            if (header[11] != static_cast<uint8_t>(entry.crc >> 24)) return ZipExtract_BadCheckByte;
+            offset += 12;
+            remaining -= 12;
+        }
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        bool deflated = entry.method == 8;
+        if (deflated && inflateInit2(&zs, -MAX_WBITS) != Z_OK) return ZipExtract_BadData;
+        std::vector<uint8_t> in(1 << 20);
+        std::vector<uint8_t> inflated(1 << 20);
+        uint32_t crc = 0;
+        uint64_t produced = 0;
+        int ret = Z_OK;
+        auto consume = [&](const uint8_t* data, size_t n) {
+            crc = static_cast<uint32_t>(crc32_z(crc, data, n));
+            produced += n;
+            if (out) out->insert(out->end(), data, data + n);
+            if (nonZero) {
+                for (size_t i = 0; i < n; ++i) *nonZero += data[i] != 0;
+            }
+        };
+        while (remaining > 0) {
+            size_t n = static_cast<size_t>(std::min<uint64_t>(remaining, in.size()));
+            if (!ReadAt(offset, in.data(), n)) break;
+            offset += n;
+            remaining -= n;
+            if (encrypted) keys.Decrypt(in.data(), n);
+            if (!deflated) {
+                consume(in.data(), n);
+                continue;
+            }
+            zs.next_in = in.data();
+            zs.avail_in = static_cast<uInt>(n);
+            while (zs.avail_in > 0 && ret == Z_OK) {
+                zs.next_out = inflated.data();
+                zs.avail_out = static_cast<uInt>(inflated.size());
+                ret = inflate(&zs, Z_NO_FLUSH);
+                consume(inflated.data(), inflated.size() - zs.avail_out);
+            }
+            if (ret != Z_OK && ret != Z_STREAM_END) break;
+        }
+        if (deflated) {
+            while (ret == Z_OK && remaining == 0) {  // output held back by inflate
+                zs.next_out = inflated.data();
+                zs.avail_out = static_cast<uInt>(inflated.size());
+                ret = inflate(&zs, Z_NO_FLUSH);
+                consume(inflated.data(), inflated.size() - zs.avail_out);
+                if (zs.avail_out > 0 && ret == Z_OK) ret = Z_BUF_ERROR;  // input ended before the stream
+            }
+            inflateEnd(&zs);
+            if (ret != Z_STREAM_END || remaining > 0) return ZipExtract_BadData;
+        }
+        if (remaining > 0) return ZipExtract_BadHeader;
+        if (produced != entry.uncompressedSize) return ZipExtract_BadSize;
+        return crc == entry.crc ? ZipExtract_Ok : ZipExtract_BadCrc;
+    }
+
+private:
+    // ZipCrypto keys, APPNOTE 6.1, for decryption
+    struct Keys {
+        uint32_t key0 = 0x12345678;
+        uint32_t key1 = 0x23456789;
+        uint32_t key2 = 0x34567890;
+
+        void Update(uint8_t b) {
+            const z_crc_t* table = get_crc_table();
+            key0 = table[(key0 ^ b) & 0xff] ^ (key0 >> 8);
+            key1 = (key1 + (key0 & 0xff)) * 134775813 + 1;
+            key2 = table[(key2 ^ (key1 >> 24)) & 0xff] ^ (key2 >> 8);
+        }
+
+        void Decrypt(uint8_t* data, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                uint32_t temp = (key2 & 0xffff) | 2;
+                data[i] ^= static_cast<uint8_t>((temp * (temp ^ 1)) >> 8);
+                Update(data[i]);
+            }
+        }
+    };
+
+    static uint16_t Get16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+    static uint32_t Get32(const uint8_t* p) { return Get16(p) | (static_cast<uint32_t>(Get16(p + 2)) << 16); }
+    static uint64_t Get64(const uint8_t* p) { return Get32(p) | (static_cast<uint64_t>(Get32(p + 4)) << 32); }
+
+    static bool Fail(std::string& error, const std::string& what) {
+        error = what;
+        return false;
+    }
+
+    bool ReadAt(uint64_t offset, void* data, size_t size) {
+        if (offset + size > size_) return false;
+        for (size_t done = 0; done < size;) {
+            ssize_t n = pread(fd_, static_cast<uint8_t*>(data) + done, size - done, static_cast<off_t>(offset + done));
+            if (n <= 0) return false;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    uint64_t size_ = 0;
+};
@@ -0,0 +1,91 @@
+// Throughput of ParallelZipWriter by DeflatePool size on a fixed corpus: inline (no pool),
+// then 1, 2, 4, ... threads up to max threads, writing an encrypted archive to /dev/null
+// the way WriteStudyArchive does (2 * threads entries in flight). Reports MB/s of
+// instance data and the compression ratio.
+//   zipscaling_bench [instances] [instance KB] [max threads] [rounds]
+#include "zipwriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    // Instance-like data: a compressible header and text part, then noisy "pixel" data
+    // of which about half the bytes repeat the previous row
+    std::vector<uint8_t> Instance(size_t size, uint32_t seed) {
+        std::vector<uint8_t> data(size);
+        uint32_t state = seed;
+        const size_t header = std::min<size_t>(size, 4096);
+        const size_t row = 512;
+        for (size_t i = 0; i < size; ++i) {
+            state = state * 1103515245 + 12345;
+            if (i < header) {
+                data[i] = static_cast<uint8_t>("DICM 0008,1030 LO CT Thorax "[i % 28]);
+            } else if (i >= header + row && (state >> 16) % 2 == 0) {
+                data[i] = data[i - row];
+            } else {
+                data[i] = static_cast<uint8_t>((state >> 16) & 0x3f);
+            }
+        }
+        return data;
+    }
+
+    // Seconds to archive the corpus, with the compressed size
+    double Archive(const std::vector<std::vector<uint8_t>>& corpus, size_t threads, uint64_t& compressed) {
+        std::unique_ptr<DeflatePool> pool(threads > 0 ? new DeflatePool(threads) : nullptr);
+        auto start = std::chrono::steady_clock::now();
+        FileSink sink("/dev/null");
+        ZipWriter zip(sink, "bench password");
+        {
+            ParallelZipWriter writer(zip, pool.get(), 2 * std::max<size_t>(1, threads));
+            for (size_t i = 0; i < corpus.size(); ++i) {
+                writer.Add(std::to_string(i) + ".dcm", corpus[i].data(), corpus[i].size(), nullptr);
+            }
+            writer.Flush();
+        }
+        zip.Finish();
+        sink.Close();
+        compressed = zip.CompressedBytes();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t instances = argc > 1 ? std::atol(argv[1]) : 200;
+    size_t instanceKb = argc > 2 ? std::atol(argv[2]) : 512;
+    size_t maxThreads = argc > 3 ? std::atol(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    int rounds = argc > 4 ? std::atoi(argv[4]) : 3;
+
+    std::vector<std::vector<uint8_t>> corpus;
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < instances; ++i) {
+        corpus.push_back(Instance(instanceKb * 1024, static_cast<uint32_t>(i + 1)));
+        bytes += corpus.back().size();
+    }
+    std::printf("%zu instances of %zu KB, %.1f MB, best of %d rounds, %u cores\n", instances, instanceKb, bytes / 1e6, rounds,
+                std::thread::hardware_concurrency());
+    std::printf("%8s %10s %8s %8s\n", "threads", "MB/s", "speedup", "ratio");
+
+    std::vector<size_t> counts = { 0 };
+    for (size_t threads = 1; threads <= maxThreads; threads *= 2) counts.push_back(threads);
+    if (counts.back() != maxThreads) counts.push_back(maxThreads);
+
+    double inlineSeconds = 0;
+    for (size_t threads : counts) {
+        double best = 0;
+        uint64_t compressed = 0;
+        for (int r = 0; r < rounds; ++r) {
+            double seconds = Archive(corpus, threads, compressed);
+            best = r == 0 ? seconds : std::min(best, seconds);
+        }
+        if (threads == 0) inlineSeconds = best;
+        std::printf("%8s %10.1f %7.2fx %8.2f\n", threads == 0 ? "inline" : std::to_string(threads).c_str(), bytes / 1e6 / best,
+                    inlineSeconds / best, static_cast<double>(bytes) / compressed);
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+// ZipWriter round trip: archives are read back through zipreader.h (zlib inflate and an
+// independent ZipCrypto) and, where installed, Info-ZIP unzip. Covers STORE and DEFLATE
+// entries and the fallback to STORE, ZipCrypto flags and check bytes, a wrong password,
+// the Zip64 end record and locator of an archive over 65535 entries, and the Zip64
+// extras of a sparse entry over 4 GB.
+//   zipwriter_test [--no-large]
+#include "zipreader.h"
+#include "zipwriter.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+
+    struct Input {
+        std::string name;
+        std::vector<uint8_t> data;
+        ZipWriter::Method method;
+        uint16_t expectedMethod;
+    };
+
+    std::vector<uint8_t> Compressible(size_t size) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>("DICM tag value "[i % 15] + (i / 4096) % 3);
+        return data;
+    }
+
+    std::vector<uint8_t> Random(size_t size, uint32_t seed) {
+        std::mt19937 rng(seed);
+        std::vector<uint8_t> data(size);
+        for (auto& b : data) b = static_cast<uint8_t>(rng());
+        return data;
+    }
+
+    bool HaveUnzip() {
+        return std::system("command -v unzip > /dev/null 2>&1") == 0;
+    }
+
+    bool Unzip(const std::string& path, const std::string& password) {
+        return std::system(("unzip -tqq -P '" + password + "' '" + path + "' > /dev/null 2>&1").c_str()) == 0;
+    }
+
+    bool Write(const std::string& path, const std::string& password, const std::vector<Input>& inputs) {
+        FileSink sink(path);
+        ZipWriter zip(sink, password);
+        for (const auto& input : inputs) {
+            if (!zip.AddEntry(input.name, input.data.data(), input.data.size(), input.method)) return false;
+        }
+        return zip.Finish() && sink.Close();
+    }
+
+    void RoundTrip(const std::string& path, const std::string& password, const std::vector<Input>& inputs) {
+        std::string label = password.empty() ? "plain: " : "encrypted: ";
+        Expect(Write(path, password, inputs), label + "written");
+        ZipReader reader(path);
+        ZipArchive archive;
+        std::string error;
+        bool read = reader.ReadDirectory(archive, error);
+        Expect(read, label + "central directory: " + error);
+        Expect(!archive.zip64End, label + "no Zip64 end record");
+        Expect(archive.entries.size() == inputs.size(), label + "entry count");
+        for (size_t i = 0; i < inputs.size() && i < archive.entries.size(); ++i) {
+            const ZipEntryInfo& entry = archive.entries[i];
+            const Input& input = inputs[i];
+            Expect(entry.name == input.name, label + "name of " + input.name);
+            Expect(entry.method == input.expectedMethod, label + "method of " + input.name);
+            Expect(entry.flags == (password.empty() ? 0x0800 : 0x0801), label + "UTF-8 and encryption flags of " + input.name);
+            Expect(entry.versionNeeded == 20 && !entry.zip64Extra, label + "no Zip64 for " + input.name);
+            uint64_t overhead = password.empty() ? 0 : 12;  // encryption header
+            Expect(entry.method == 8 ? entry.compressedSize < input.data.size() + overhead : entry.compressedSize == input.data.size() + overhead,
+                   label + "compressed size of " + input.name);
+            std::vector<uint8_t> data;
+            Expect(reader.Extract(entry, password, &data) == ZipExtract_Ok, label + "check byte, size and CRC of " + input.name);
+            Expect(data == input.data, label + "content of " + input.name);
+        }
+        if (HaveUnzip()) Expect(Unzip(path, password), label + "unzip -t");
+    }
+}
+
+int main(int argc, char** argv) {
+    bool large = !(argc > 1 && std::string(argv[1]) == "--no-large");
+    char dirTemplate[] = "/tmp/zipwriter_test.XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+
+    // STORE and DEFLATE, incompressible data falling back to STORE, empty and UTF-8 names
+    std::vector<Input> inputs = {
+        { "deflate.dcm", Compressible(300000), ZipWriter::Method_Deflate, 8 },
+        { "store.dcm", Compressible(70000), ZipWriter::Method_Store, 0 },
+        { "random.dcm", Random(50000, 1), ZipWriter::Method_Deflate, 0 },
+        { "empty.dcm", {}, ZipWriter::Method_Store, 0 },
+        { "empty-deflate.dcm", {}, ZipWriter::Method_Deflate, 0 },
+        { "one.dcm", { 0x42 }, ZipWriter::Method_Deflate, 0 },
+        { "Z\xc3\xbcrich/\xc3\xa9t\xc3\xa9.dcm", Compressible(5000), ZipWriter::Method_Deflate, 8 },
+    };
+    RoundTrip(dir + "/plain.zip", "", inputs);
+    RoundTrip(dir + "/encrypted.zip", "s3cret pw", inputs);
+
+    // A wrong password fails the check byte of most entries (1 in 256 passes by chance)
+    // and the CRC or inflate of every one
+    {
+        std::vector<Input> many;
+        for (int i = 0; i < 32; ++i) many.push_back({ "e" + std::to_string(i), Compressible(1000 + i), ZipWriter::Method_Deflate, 8 });
+        std::string path = dir + "/wrong.zip";
+        Expect(Write(path, "right", many), "wrong password archive written");
+        ZipReader reader(path);
+        ZipArchive archive;
+        std::string error;
+        bool read = reader.ReadDirectory(archive, error);
+        Expect(read, "wrong password central directory: " + error);
+        int checkBytes = 0;
+        int accepted = 0;
+        for (const auto& entry : archive.entries) {
+            ZipExtractResult result = reader.Extract(entry, "wrong", nullptr);
+            checkBytes += result == ZipExtract_BadCheckByte;
+            accepted += result == ZipExtract_Ok;
+            Expect(reader.Extract(entry, "right", nullptr) == ZipExtract_Ok, "right password accepted for " + entry.name);
+        }
+        Expect(accepted == 0, "wrong password never accepted");
+        Expect(checkBytes >= 24, "wrong password caught by the check byte in " + std::to_string(checkBytes) + " of 32");
+        if (HaveUnzip()) Expect(!Unzip(path, "wrong"), "unzip -t rejects the wrong password");
+    }
+
+    // Over 65535 entries: the counts only fit the Zip64 end record, found through its locator
+    {
+        std::string path = dir + "/entries.zip";
+        FileSink sink(path);
+        ZipWriter zip(sink, "");
+        const size_t count = 70000;
+        bool added = true;
+        for (size_t i = 0; i < count; ++i) {
+            std::string data = std::to_string(i);
+            added = added && zip.AddEntry(std::to_string(i), data.data(), data.size(), ZipWriter::Method_Store);
+        }
+        Expect(added && zip.Finish() && sink.Close(), "70000 entries written");
+        ZipReader reader(path);
+        ZipArchive archive;
+        std::string error;
+        bool read = reader.ReadDirectory(archive, error);
+        Expect(read, "70000 entries central directory: " + error);
+        Expect(archive.zip64End && archive.entries.size() == count, "Zip64 end record holds the count");
+        bool all = archive.entries.size() == count;
+        for (size_t i = 0; all && i < count; i += 997) {
+            std::vector<uint8_t> data;
+            std::string expected = std::to_string(i);
+            all = reader.Extract(archive.entries[i], "", &data) == ZipExtract_Ok && std::string(data.begin(), data.end()) == expected;
+        }
+        Expect(all, "entries of the Zip64 archive extract");
+        if (HaveUnzip()) Expect(Unzip(path, ""), "unzip -t of 70000 entries");
+    }
+
+    // A sparse 4 GB + 1 MB entry, deflated on a pool and encrypted: Zip64 extras in the
+    // local and central headers, and a CRC combined over more than 4 GB
+    if (large) {
+        const size_t size = (size_t(4) << 30) + (1 << 20);
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        Expect(mapped != MAP_FAILED, "map the sparse entry");
+        if (mapped != MAP_FAILED) {
+            uint8_t* data = static_cast<uint8_t*>(mapped);
+            data[0] = 1;
+            data[ParallelZipWriter::BLOCK_SIZE] = 2;
+            data[(size_t(4) << 30) + 12345] = 3;  // past 4 GB
+            data[size - 1] = 4;
+
+            std::string path = dir + "/large.zip";
+            {
+                FileSink sink(path);
+                ZipWriter zip(sink, "large");
+                DeflatePool pool(4);
+                ParallelZipWriter writer(zip, &pool, 2);
+                Expect(writer.Add("small.dcm", data, 1000, nullptr) && writer.Add("sparse.dcm", data, size, nullptr) &&
+                           writer.Add("after.dcm", data, 1000, nullptr) && writer.Flush(),
+                       "sparse entry compressed");
+                Expect(zip.Finish() && sink.Close(), "sparse archive written");
+            }
+            munmap(mapped, size);
+
+            ZipReader reader(path);
+            ZipArchive archive;
+            std::string error;
+            bool read = reader.ReadDirectory(archive, error);
+            Expect(read, "sparse central directory: " + error);
+            Expect(archive.entries.size() == 3 && !archive.zip64End, "three entries, offsets fit the plain end record");
+            if (archive.entries.size() == 3) {
+                const ZipEntryInfo& sparse = archive.entries[1];
+                Expect(sparse.zip64Extra && sparse.versionNeeded == 45 && sparse.uncompressedSize == size && sparse.method == 8,
+                       "Zip64 extra with the 64 bit size");
+                Expect(!archive.entries[0].zip64Extra && !archive.entries[2].zip64Extra, "no Zip64 extra for the small entries");
+                uint64_t nonZero = 0;
+                Expect(reader.Extract(sparse, "large", nullptr, &nonZero) == ZipExtract_Ok, "sparse entry size and CRC");
+                Expect(nonZero == 4, "sparse entry content");
+                Expect(reader.Extract(archive.entries[2], "large", nullptr) == ZipExtract_Ok, "entry after the sparse one");
+            }
+            unlink(path.c_str());
+        }
+    }
+
+    std::system(("rm -rf '" + dir + "'").c_str());
+    if (failures == 0) std::cout << "ZipWriter: ok\n";
+    return failures == 0 ? 0 : 1;
+}
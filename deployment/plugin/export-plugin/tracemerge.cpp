@@ -0,0 +1,140 @@
+#include "tracemerge.h"
+
+#include <json/reader.h>
+#include <json/writer.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <dirent.h>
+
+std::vector<std::string> TraceFiles(const std::string& dir) {
+    std::vector<std::string> files;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return files;
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.find(".trace.jsonl") != std::string::npos) {
+            files.push_back(dir + "/" + name);
+        }
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end(), [](const std::string& a, const std::string& b) {
+        bool rotatedA = a.back() == '1', rotatedB = b.back() == '1';
+        return rotatedA != rotatedB ? rotatedA : a < b;
+    });
+    return files;
+}
+
+std::vector<Json::Value> LoadTraceSpans(const TraceLog& tracer, const std::string& id) {
+    std::vector<Json::Value> ring;
+    if (!tracer.FileEnabled()) {
+        for (const auto& span : tracer.Recent()) {
+            Json::Value value;
+            value["trace"] = span.trace;
+            value["process"] = span.process;
+            value["name"] = span.name;
+            value["subject"] = span.subject;
+            value["start_us"] = static_cast<Json::Int64>(span.startUs);
+            value["end_us"] = static_cast<Json::Int64>(span.endUs);
+            value["bytes"] = static_cast<Json::UInt64>(span.bytes);
+            value["outcome"] = span.outcome;
+            ring.push_back(value);
+        }
+    }
+
+    // Calls visit for every span, the substring test skips most lines unparsed
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    auto scan = [&](const std::set<std::string>& needles, const std::function<void(const Json::Value&)>& visit) {
+        for (const auto& span : ring) visit(span);
+        for (const auto& file : TraceFiles(tracer.Directory())) {
+            std::ifstream in(file);
+            std::string line;
+            while (std::getline(in, line)) {
+                bool candidate = false;
+                for (const auto& needle : needles) candidate = candidate || line.find(needle) != std::string::npos;
+                Json::Value span;
+                std::string errs;
+                if (candidate && reader->parse(line.data(), line.data() + line.size(), &span, &errs) && span.isObject()) {
+                    visit(span);
+                }
+            }
+        }
+    };
+
+    std::set<std::string> traces;
+    scan({ id }, [&](const Json::Value& span) {
+        if (span["trace"].asString() == id || span["subject"].asString() == id) traces.insert(span["trace"].asString());
+    });
+    std::vector<Json::Value> spans;
+    if (traces.empty()) return spans;
+    scan(traces, [&](const Json::Value& span) {
+        if (traces.count(span["trace"].asString())) spans.push_back(span);
+    });
+
+    // Each file is in the order its plugin finished the spans; merged, they go by start
+    std::stable_sort(spans.begin(), spans.end(), [](const Json::Value& a, const Json::Value& b) {
+        return a["start_us"].asInt64() < b["start_us"].asInt64();
+    });
+    return spans;
+}
+
+std::string ChromeTrace(const std::vector<Json::Value>& spans) {
+    std::map<std::string, int> pids = { { "ExportPlugin", 1 }, { "QueuePlugin", 2 }, { "FilesenderPlugin", 3 } };
+    std::map<std::string, int> tids;
+    Json::Value events(Json::arrayValue);
+    std::set<std::pair<int, int>> named;
+    for (const auto& span : spans) {
+        std::string process = span["process"].asString();
+        std::string trace = span["trace"].asString();
+        if (!pids.count(process)) {
+            int pid = static_cast<int>(pids.size()) + 1;
+            pids[process] = pid;
+        }
+        if (!tids.count(trace)) {
+            int tid = static_cast<int>(tids.size()) + 1;
+            tids[trace] = tid;
+        }
+        int pid = pids[process], tid = tids[trace];
+        if (named.insert({ pid, 0 }).second) {
+            Json::Value meta;
+            meta["name"] = "process_name";
+            meta["ph"] = "M";
+            meta["pid"] = pid;
+            meta["args"]["name"] = process;
+            events.append(meta);
+        }
+        if (named.insert({ pid, tid }).second) {
+            Json::Value meta;
+            meta["name"] = "thread_name";
+            meta["ph"] = "M";
+            meta["pid"] = pid;
+            meta["tid"] = tid;
+            meta["args"]["name"] = "trace " + trace;
+            events.append(meta);
+        }
+
+        Json::Value event;
+        event["name"] = span["name"].asString();
+        event["cat"] = process;
+        event["ph"] = "X";
+        event["ts"] = span["start_us"].asInt64();
+        event["dur"] = span["end_us"].asInt64() - span["start_us"].asInt64();
+        event["pid"] = pid;
+        event["tid"] = tid;
+        event["args"]["trace"] = trace;
+        event["args"]["subject"] = span["subject"].asString();
+        event["args"]["bytes"] = span["bytes"].asUInt64();
+        event["args"]["outcome"] = span["outcome"].asString();
+        events.append(event);
+    }
+
+    Json::Value root;
+    root["traceEvents"] = events;
+    root["displayTimeUnit"] = "ms";
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+    return Json::writeString(writer, root);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "tracing.h"
+
+#include <json/value.h>
+#include <string>
+#include <vector>
+
+// Merge of the span files of all plugins (tracing.h) for /pipeline/trace
+
+// Span files of all plugins in dir, rotated generations first
+std::vector<std::string> TraceFiles(const std::string& dir);
+
+// Spans of the traces with id, or of every trace whose spans name id as subject (a study
+// exported twice has one trace per export). Read from the span files of all plugins, or
+// from the ring of tracer when span files are off. Ordered by start.
+std::vector<Json::Value> LoadTraceSpans(const TraceLog& tracer, const std::string& id);
+
+// Chrome trace event format, opens in Perfetto (ui.perfetto.dev) and chrome://tracing:
+// one process per plugin, one thread per trace, complete events in microseconds
+std::string ChromeTrace(const std::vector<Json::Value>& spans);
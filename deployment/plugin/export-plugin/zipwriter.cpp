@@ -0,0 +1,480 @@
+#include "zipwriter.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <random>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    const uint32_t LOCAL_HEADER_SIGNATURE = 0x04034b50;
+    const uint32_t CENTRAL_HEADER_SIGNATURE = 0x02014b50;
+    const uint32_t END_OF_CENTRAL_DIR_SIGNATURE = 0x06054b50;
+    const uint32_t ZIP64_END_OF_CENTRAL_DIR_SIGNATURE = 0x06064b50;
+    const uint32_t ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+    const uint16_t ZIP64_EXTRA_ID = 0x0001;
+    const uint16_t VERSION_DEFAULT = 20;
+    const uint16_t VERSION_ZIP64 = 45;
+    const uint16_t FLAG_ENCRYPTED = 0x0001;
+    const uint16_t FLAG_UTF8 = 0x0800;
+    const uint32_t MAX_32 = 0xffffffff;
+    const uint16_t MAX_16 = 0xffff;
+    const size_t ENCRYPTION_HEADER_SIZE = 12;
+
+    void Put16(std::string& out, uint16_t v) {
+        out.push_back(static_cast<char>(v & 0xff));
+        out.push_back(static_cast<char>((v >> 8) & 0xff));
+    }
+
+    void Put32(std::string& out, uint32_t v) {
+        Put16(out, static_cast<uint16_t>(v & 0xffff));
+        Put16(out, static_cast<uint16_t>(v >> 16));
+    }
+
+    void Put64(std::string& out, uint64_t v) {
+        Put32(out, static_cast<uint32_t>(v & 0xffffffff));
+        Put32(out, static_cast<uint32_t>(v >> 32));
+    }
+
+    // Traditional PKWARE encryption, APPNOTE 6.1
+    class ZipCrypto {
+    public:
+        explicit ZipCrypto(const std::string& password) : table_(get_crc_table()) {
+            for (char c : password) UpdateKeys(static_cast<uint8_t>(c));
+        }
+
+        void Encrypt(uint8_t* data, size_t size) {
+            for (size_t i = 0; i < size; ++i) {
+                uint8_t plain = data[i];
+                data[i] = plain ^ StreamByte();
+                UpdateKeys(plain);
+            }
+        }
+
+    private:
+        uint32_t Crc(uint32_t crc, uint8_t b) const {
+            return table_[(crc ^ b) & 0xff] ^ (crc >> 8);
+        }
+
+        void UpdateKeys(uint8_t b) {
+            key0_ = Crc(key0_, b);
+            key1_ = (key1_ + (key0_ & 0xff)) * 134775813 + 1;
+            key2_ = Crc(key2_, static_cast<uint8_t>(key1_ >> 24));
+        }
+
+        uint8_t StreamByte() const {
+            // In uint32_t: uint16_t operands would be promoted to int and the product overflow
+            uint32_t temp = (key2_ & 0xffff) | 2;
+            return static_cast<uint8_t>((temp * (temp ^ 1)) >> 8);
+        }
+
+        const z_crc_t* table_;
+        uint32_t key0_ = 0x12345678;
+        uint32_t key1_ = 0x23456789;
+        uint32_t key2_ = 0x34567890;
+    };
+}
+
+DeflateBlock DeflateSlice(const uint8_t* data, size_t size, const uint8_t* dictionary, size_t dictionarySize,
+                          bool last, int level) {
+    struct timespec cpuStart;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+
+    DeflateBlock block;
+    block.size = size;
+    block.crc = crc32_z(0L, data, size);
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return block;
+    }
+    if (dictionarySize > 0) {
+        deflateSetDictionary(&zs, dictionary, static_cast<uInt>(dictionarySize));
+    }
+
+    // Room for the sync flush marker of non-final slices
+    block.data.resize(deflateBound(&zs, size) + 16);
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.next_out = block.data.data();
+
+    // avail_in/avail_out are 32 bit, feed large buffers in slices
+    int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+    int ret = Z_OK;
+    size_t remaining = size;
+    for (;;) {
+        size_t in = std::min<size_t>(remaining, 1u << 30);
+        zs.avail_in = static_cast<uInt>(in);
+        zs.avail_out = static_cast<uInt>(std::min<size_t>(block.data.size() - zs.total_out, 1u << 30));
+        remaining -= in;
+        ret = deflate(&zs, remaining == 0 ? flush : Z_NO_FLUSH);
+        remaining += zs.avail_in;
+        if (ret == Z_STREAM_END || ret == Z_STREAM_ERROR) break;
+        if (remaining == 0 && !last && zs.avail_out > 0) break;  // sync flush complete
+        if (ret == Z_BUF_ERROR) break;
+    }
+    block.data.resize(zs.total_out);
+    deflateEnd(&zs);
+    block.ok = last ? ret == Z_STREAM_END : (ret == Z_OK && remaining == 0);
+
+    struct timespec cpuEnd;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+    block.cpuNanos = (cpuEnd.tv_sec - cpuStart.tv_sec) * 1000000000ull + cpuEnd.tv_nsec - cpuStart.tv_nsec;
+    return block;
+}
+
+FileSink::FileSink(const std::string& path, bool publish) : path_(path), publish_(publish), buffer_(BUFFER_SIZE) {
+    if (publish) {
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        fd_ = open(dir.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            tempPath_ = dir + "." + path.substr(slash + 1) + ".tmp";
+            fd_ = open(tempPath_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        }
+    } else {
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+}
+
+FileSink::~FileSink() {
+    Close();
+}
+
+bool FileSink::Write(const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0 && !failed_) {
+        size_t n = std::min(size, BUFFER_SIZE - used_);
+        memcpy(buffer_.data() + used_, p, n);
+        used_ += n;
+        p += n;
+        size -= n;
+        if (used_ == BUFFER_SIZE) Flush();
+    }
+    return !failed_;
+}
+
+bool FileSink::Close() {
+    if (fd_ < 0) return !failed_;
+    Flush();
+    if (publish_ && !failed_ && fsync(fd_) != 0) failed_ = true;
+    if (publish_ && !failed_ && tempPath_.empty()) {
+        std::string procPath = "/proc/self/fd/" + std::to_string(fd_);
+        if (linkat(AT_FDCWD, procPath.c_str(), AT_FDCWD, path_.c_str(), AT_SYMLINK_FOLLOW) != 0) failed_ = true;
+    }
+    if (close(fd_) != 0) failed_ = true;
+    if (publish_ && !tempPath_.empty()) {
+        if (failed_ || rename(tempPath_.c_str(), path_.c_str()) != 0) {
+            unlink(tempPath_.c_str());
+            failed_ = true;
+        }
+    }
+    fd_ = -1;
+    return !failed_;
+}
+
+void FileSink::Flush() {
+    size_t offset = 0;
+    while (offset < used_ && !failed_) {
+        ssize_t n = write(fd_, buffer_.data() + offset, used_ - offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            failed_ = true;
+        } else {
+            offset += n;
+        }
+    }
+    written_ += offset;
+    used_ = 0;
+}
+
+ZipWriter::ZipWriter(FileSink& sink, const std::string& password, int compressionLevel)
+    : sink_(sink), password_(password), level_(compressionLevel) {
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    dosTime_ = static_cast<uint16_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+    dosDate_ = static_cast<uint16_t>(((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+}
+
+bool ZipWriter::AddEntry(const std::string& name, const void* data, size_t size, Method method) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    if (method == Method_Deflate) {
+        std::vector<DeflateBlock> blocks;
+        blocks.push_back(DeflateSlice(bytes, size, nullptr, 0, true, level_));
+        return AddBlocks(name, data, size, blocks);
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.method = Method_Store;
+    entry.uncompressedSize = size;
+    entry.crc = crc32_z(0L, bytes, size);
+    return WriteEntry(entry, { Piece{ data, size } });
+}
+
+bool ZipWriter::AddBlocks(const std::string& name, const void* data, size_t size, const std::vector<DeflateBlock>& blocks) {
+    Entry entry;
+    entry.name = name;
+    entry.method = Method_Deflate;
+    entry.uncompressedSize = size;
+    entry.crc = 0;
+
+    uint64_t compressedSize = 0;
+    std::vector<Piece> pieces;
+    for (const DeflateBlock& block : blocks) {
+        if (!block.ok) return false;
+        deflateCpuNanos_ += block.cpuNanos;
+        entry.crc = crc32_combine64(entry.crc, block.crc, block.size);
+        compressedSize += block.data.size();
+        pieces.push_back(Piece{ block.data.data(), block.data.size() });
+    }
+
+    if (compressedSize >= size) {
+        entry.method = Method_Store;
+        return WriteEntry(entry, { Piece{ data, size } });
+    }
+    return WriteEntry(entry, pieces);
+}
+
+bool ZipWriter::WriteEntry(Entry& entry, const std::vector<Piece>& payload) {
+    uint64_t payloadSize = 0;
+    for (const Piece& piece : payload) payloadSize += piece.size;
+
+    bool encrypted = !password_.empty();
+    entry.compressedSize = payloadSize + (encrypted ? ENCRYPTION_HEADER_SIZE : 0);
+    entry.localHeaderOffset = offset_;
+
+    bool zip64 = entry.compressedSize >= MAX_32 || entry.uncompressedSize >= MAX_32;
+    uint16_t flags = FLAG_UTF8 | (encrypted ? FLAG_ENCRYPTED : 0);
+
+    std::string header;
+    Put32(header, LOCAL_HEADER_SIGNATURE);
+    Put16(header, zip64 ? VERSION_ZIP64 : VERSION_DEFAULT);
+    Put16(header, flags);
+    Put16(header, entry.method);
+    Put16(header, dosTime_);
+    Put16(header, dosDate_);
+    Put32(header, entry.crc);
+    Put32(header, zip64 ? MAX_32 : static_cast<uint32_t>(entry.compressedSize));
+    Put32(header, zip64 ? MAX_32 : static_cast<uint32_t>(entry.uncompressedSize));
+    Put16(header, static_cast<uint16_t>(entry.name.size()));
+    Put16(header, zip64 ? 20 : 0);
+    header += entry.name;
+    if (zip64) {
+        Put16(header, ZIP64_EXTRA_ID);
+        Put16(header, 16);
+        Put64(header, entry.uncompressedSize);
+        Put64(header, entry.compressedSize);
+    }
+
+    if (!sink_.Write(header.data(), header.size())) return false;
+
+    if (encrypted) {
+        ZipCrypto crypto(password_);
+
+        // Random encryption header, the last byte is the CRC check byte
+        static thread_local std::mt19937 rng(std::random_device{}());
+        uint8_t encryptionHeader[ENCRYPTION_HEADER_SIZE];
+        for (size_t i = 0; i < ENCRYPTION_HEADER_SIZE - 1; ++i) {
+            encryptionHeader[i] = static_cast<uint8_t>(rng());
+        }
+        encryptionHeader[ENCRYPTION_HEADER_SIZE - 1] = static_cast<uint8_t>(entry.crc >> 24);
+        crypto.Encrypt(encryptionHeader, ENCRYPTION_HEADER_SIZE);
+        if (!sink_.Write(encryptionHeader, ENCRYPTION_HEADER_SIZE)) return false;
+
+        // Encrypt through a fixed-size block instead of copying the whole payload
+        uint8_t block[64 * 1024];
+        for (const Piece& piece : payload) {
+            const uint8_t* p = static_cast<const uint8_t*>(piece.data);
+            for (size_t done = 0; done < piece.size;) {
+                size_t n = std::min(sizeof(block), piece.size - done);
+                memcpy(block, p + done, n);
+                auto encryptStart = std::chrono::steady_clock::now();
+                crypto.Encrypt(block, n);
+                encryptNanos_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - encryptStart).count();
+                if (!sink_.Write(block, n)) return false;
+                done += n;
+            }
+        }
+    } else {
+        for (const Piece& piece : payload) {
+            if (!sink_.Write(piece.data, piece.size)) return false;
+        }
+    }
+
+    offset_ += header.size() + entry.compressedSize;
+    uncompressedBytes_ += entry.uncompressedSize;
+    compressedBytes_ += entry.compressedSize;
+    if (entry.method == Method_Store) storedEntries_++;
+    entries_.push_back(entry);
+    return true;
+}
+
+bool ZipWriter::Finish() {
+    uint16_t flags = FLAG_UTF8 | (password_.empty() ? 0 : FLAG_ENCRYPTED);
+    uint64_t centralDirOffset = offset_;
+
+    std::string out;
+    for (const Entry& entry : entries_) {
+        bool bigUncompressed = entry.uncompressedSize >= MAX_32;
+        bool bigCompressed = entry.compressedSize >= MAX_32;
+        bool bigOffset = entry.localHeaderOffset >= MAX_32;
+
+        std::string extra;
+        if (bigUncompressed || bigCompressed || bigOffset) {
+            uint16_t extraSize = (bigUncompressed ? 8 : 0) + (bigCompressed ? 8 : 0) + (bigOffset ? 8 : 0);
+            Put16(extra, ZIP64_EXTRA_ID);
+            Put16(extra, extraSize);
+            if (bigUncompressed) Put64(extra, entry.uncompressedSize);
+            if (bigCompressed) Put64(extra, entry.compressedSize);
+            if (bigOffset) Put64(extra, entry.localHeaderOffset);
+        }
+        uint16_t version = extra.empty() ? VERSION_DEFAULT : VERSION_ZIP64;
+
+        Put32(out, CENTRAL_HEADER_SIGNATURE);
+        Put16(out, version);  // made by: MS-DOS attributes
+        Put16(out, version);
+        Put16(out, flags);
+        Put16(out, entry.method);
+        Put16(out, dosTime_);
+        Put16(out, dosDate_);
+        Put32(out, entry.crc);
+        Put32(out, bigCompressed ? MAX_32 : static_cast<uint32_t>(entry.compressedSize));
+        Put32(out, bigUncompressed ? MAX_32 : static_cast<uint32_t>(entry.uncompressedSize));
+        Put16(out, static_cast<uint16_t>(entry.name.size()));
+        Put16(out, static_cast<uint16_t>(extra.size()));
+        Put16(out, 0);  // comment length
+        Put16(out, 0);  // disk number
+        Put16(out, 0);  // internal attributes
+        Put32(out, 0);  // external attributes
+        Put32(out, bigOffset ? MAX_32 : static_cast<uint32_t>(entry.localHeaderOffset));
+        out += entry.name;
+        out += extra;
+
+        if (out.size() >= FileSink::BUFFER_SIZE) {
+            if (!sink_.Write(out.data(), out.size())) return false;
+            offset_ += out.size();
+            out.clear();
+        }
+    }
+    offset_ += out.size();
+
+    uint64_t centralDirSize = offset_ - centralDirOffset;
+    uint64_t count = entries_.size();
+    bool zip64 = count >= MAX_16 || centralDirSize >= MAX_32 || centralDirOffset >= MAX_32;
+
+    if (zip64) {
+        uint64_t zip64EndOffset = offset_;
+        Put32(out, ZIP64_END_OF_CENTRAL_DIR_SIGNATURE);
+        Put64(out, 44);
+        Put16(out, VERSION_ZIP64);
+        Put16(out, VERSION_ZIP64);
+        Put32(out, 0);
+        Put32(out, 0);
+        Put64(out, count);
+        Put64(out, count);
+        Put64(out, centralDirSize);
+        Put64(out, centralDirOffset);
+
+        Put32(out, ZIP64_LOCATOR_SIGNATURE);
+        Put32(out, 0);
+        Put64(out, zip64EndOffset);
+        Put32(out, 1);
+    }
+
+    Put32(out, END_OF_CENTRAL_DIR_SIGNATURE);
+    Put16(out, 0);
+    Put16(out, 0);
+    Put16(out, zip64 ? MAX_16 : static_cast<uint16_t>(count));
+    Put16(out, zip64 ? MAX_16 : static_cast<uint16_t>(count));
+    Put32(out, zip64 ? MAX_32 : static_cast<uint32_t>(centralDirSize));
+    Put32(out, zip64 ? MAX_32 : static_cast<uint32_t>(centralDirOffset));
+    Put16(out, 0);
+
+    return sink_.Write(out.data(), out.size());
+}
+
+ParallelZipWriter::ParallelZipWriter(ZipWriter& writer, DeflatePool* pool, size_t maxInFlight)
+    : writer_(writer), pool_(pool), maxInFlight_(std::max<size_t>(1, maxInFlight)) {
+}
+
+ParallelZipWriter::~ParallelZipWriter() {
+    // Slices still reference the entry buffers, wait for them before releasing
+    for (Pending& p : pending_) {
+        for (auto& f : p.blocks) {
+            if (f.valid()) f.wait();
+        }
+        if (p.release) p.release();
+    }
+}
+
+bool ParallelZipWriter::Add(const std::string& name, const void* data, size_t size, std::function<void()> release,
+                            ZipWriter::Method method) {
+    if (failed_) {
+        if (release) release();
+        return false;
+    }
+
+    if (pool_ == nullptr) {
+        bool ok = writer_.AddEntry(name, data, size, method);
+        if (release) release();
+        failed_ = !ok;
+        return ok;
+    }
+
+    Pending p;
+    p.name = name;
+    p.data = static_cast<const uint8_t*>(data);
+    p.size = size;
+    p.release = std::move(release);
+    p.method = method;
+
+    if (method == ZipWriter::Method_Deflate) {
+        const size_t window = 32 * 1024;
+        size_t offset = 0;
+        do {
+            size_t n = std::min(BLOCK_SIZE, size - offset);
+            size_t dict = std::min(offset, window);
+            bool last = offset + n == size;
+            p.blocks.push_back(pool_->Submit(p.data + offset, n, p.data + offset - dict, dict, last, writer_.CompressionLevel()));
+            offset += n;
+        } while (offset < size);
+    }
+
+    pending_.push_back(std::move(p));
+    while (pending_.size() > maxInFlight_) {
+        if (!WriteFront()) return false;
+    }
+    return true;
+}
+
+bool ParallelZipWriter::Flush() {
+    while (!pending_.empty()) {
+        if (!WriteFront()) return false;
+    }
+    return !failed_;
+}
+
+bool ParallelZipWriter::WriteFront() {
+    Pending p = std::move(pending_.front());
+    pending_.pop_front();
+
+    bool ok;
+    if (p.method == ZipWriter::Method_Deflate) {
+        std::vector<DeflateBlock> blocks;
+        blocks.reserve(p.blocks.size());
+        for (auto& f : p.blocks) blocks.push_back(f.get());
+        ok = !failed_ && writer_.AddBlocks(p.name, p.data, p.size, blocks);
+    } else {
+        ok = !failed_ && writer_.AddEntry(p.name, p.data, p.size, p.method);
+    }
+
+    if (p.release) p.release();
+    failed_ = failed_ || !ok;
+    return ok;
+}
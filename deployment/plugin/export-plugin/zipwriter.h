@@ -0,0 +1,176 @@
+#pragma once
+
+#include "taskpool.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <string>
+#include <vector>
+
+// Buffered writer on a raw fd: data goes to disk in fixed-size blocks, so memory
+// use does not depend on the archive size
+class FileSink {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    // publish: the file only ever appears under path complete and fsync'd. It is
+    // written as an unnamed O_TMPFILE and linked to path on a successful Close, or
+    // under a hidden temp name and renamed where the filesystem has no O_TMPFILE.
+    explicit FileSink(const std::string& path, bool publish = false);
+    ~FileSink();
+
+    bool IsOpen() const { return fd_ >= 0; }
+    bool Failed() const { return failed_; }
+    uint64_t BytesWritten() const { return written_ + used_; }
+
+    bool Write(const void* data, size_t size);
+    bool Close();
+
+    // Closes without publishing; a plain file is left for the caller to remove
+    void Abort() {
+        failed_ = true;
+        Close();
+    }
+
+private:
+    void Flush();
+
+    std::string path_;
+    std::string tempPath_;  // publish without O_TMPFILE
+    bool publish_ = false;
+    int fd_ = -1;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    uint64_t written_ = 0;
+    bool failed_ = false;
+};
+
+// Raw deflate output of one slice of an entry. Slices are flushed to a byte
+// boundary so they can be concatenated in order; only the last one finishes the stream.
+struct DeflateBlock {
+    std::vector<uint8_t> data;
+    uint32_t crc = 0;
+    size_t size = 0;
+    uint64_t cpuNanos = 0;  // thread CPU time spent in deflate
+    bool ok = false;
+};
+
+// The dictionary is the 32 KB of input before the slice, so splitting costs almost no ratio
+DeflateBlock DeflateSlice(const uint8_t* data, size_t size, const uint8_t* dictionary, size_t dictionarySize,
+                          bool last, int level);
+
+// Fixed set of threads compressing slices for all exports
+class DeflatePool {
+public:
+    explicit DeflatePool(size_t threads) : pool_(threads) {}
+
+    size_t Threads() const { return pool_.Threads(); }
+
+    // The caller keeps data and dictionary alive until the future is ready
+    std::future<DeflateBlock> Submit(const uint8_t* data, size_t size, const uint8_t* dictionary, size_t dictionarySize,
+                                     bool last, int level) {
+        return pool_.Submit([=] { return DeflateSlice(data, size, dictionary, dictionarySize, last, level); });
+    }
+
+private:
+    TaskPool pool_;
+};
+
+// Single-pass ZIP writer with optional traditional PKWARE encryption (ZipCrypto)
+// and Zip64 records for archives over 4 GB or 65535 entries
+class ZipWriter {
+public:
+    enum Method : uint16_t {
+        Method_Store = 0,
+        Method_Deflate = 8
+    };
+
+    // An empty password writes an unencrypted archive
+    ZipWriter(FileSink& sink, const std::string& password, int compressionLevel = 6);
+
+    // Compresses and appends one entry. Deflate falls back to Store when it does not shrink the data.
+    bool AddEntry(const std::string& name, const void* data, size_t size, Method method = Method_Deflate);
+
+    // Appends an entry deflated elsewhere as consecutive slices of data; CRCs are combined here
+    bool AddBlocks(const std::string& name, const void* data, size_t size, const std::vector<DeflateBlock>& blocks);
+
+    int CompressionLevel() const { return level_; }
+
+    // Writes the central directory; the sink is left open
+    bool Finish();
+
+    size_t EntryCount() const { return entries_.size(); }
+    size_t StoredEntries() const { return storedEntries_; }
+    uint64_t UncompressedBytes() const { return uncompressedBytes_; }
+    uint64_t CompressedBytes() const { return compressedBytes_; }
+    double DeflateCpuSeconds() const { return deflateCpuNanos_ / 1e9; }
+    double EncryptSeconds() const { return encryptNanos_ / 1e9; }
+
+private:
+    struct Entry {
+        std::string name;
+        uint16_t method;
+        uint32_t crc;
+        uint64_t compressedSize;
+        uint64_t uncompressedSize;
+        uint64_t localHeaderOffset;
+    };
+
+    struct Piece {
+        const void* data;
+        size_t size;
+    };
+
+    bool WriteEntry(Entry& entry, const std::vector<Piece>& payload);
+
+    FileSink& sink_;
+    std::string password_;
+    int level_;
+    uint16_t dosTime_;
+    uint16_t dosDate_;
+    uint64_t offset_ = 0;
+    uint64_t uncompressedBytes_ = 0;
+    uint64_t compressedBytes_ = 0;
+    uint64_t deflateCpuNanos_ = 0;
+    uint64_t encryptNanos_ = 0;
+    size_t storedEntries_ = 0;
+    std::vector<Entry> entries_;
+};
+
+// Keeps several entries in flight on a DeflatePool and writes them to the
+// ZipWriter in submission order. Without a pool entries are compressed inline.
+class ParallelZipWriter {
+public:
+    static constexpr size_t BLOCK_SIZE = 4 << 20;
+
+    ParallelZipWriter(ZipWriter& writer, DeflatePool* pool, size_t maxInFlight);
+    ~ParallelZipWriter();
+
+    // release is called once the entry has been written (or dropped on error)
+    bool Add(const std::string& name, const void* data, size_t size, std::function<void()> release,
+             ZipWriter::Method method = ZipWriter::Method_Deflate);
+
+    // Waits for all pending entries and writes them
+    bool Flush();
+
+private:
+    struct Pending {
+        std::string name;
+        const uint8_t* data;
+        size_t size;
+        std::function<void()> release;
+        ZipWriter::Method method;
+        std::vector<std::future<DeflateBlock>> blocks;
+    };
+
+    bool WriteFront();
+
+    ZipWriter& writer_;
+    DeflatePool* pool_;
+    size_t maxInFlight_;
+    std::deque<Pending> pending_;
+    bool failed_ = false;
+};
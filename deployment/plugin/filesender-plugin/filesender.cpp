@@ -1,4 +1,10 @@
 #include <OrthancCPlugin.h>
+#include "filesenderclient.h"
+#include "jobscheduler.h"
+#include "mappingindex.h"
+#include "pipelinemetrics.h"
+#include "retryschedule.h"
+#include "tracing.h"
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -11,32 +17,57 @@
 #include <cstdlib>
 #include <set>
 #include <sys/wait.h>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sstream>
+#include <iomanip>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 
 OrthancPluginContext* globalContext = NULL;
 std::thread watcherThread;
-bool runWatcher = true;
+std::atomic<bool> runWatcher(true);
 
 namespace fs = std::filesystem;
 
-const std::string EXPORTS_DIR = "/exports";
-const std::string MAILQUEUE_DIR = "/mailqueue";
+// The benchmarks build the plugin with FILESENDER_PLUGIN_ROOT set to a directory of their own
+#ifndef FILESENDER_PLUGIN_ROOT
+#define FILESENDER_PLUGIN_ROOT ""
+#endif
+const std::string EXPORTS_DIR = FILESENDER_PLUGIN_ROOT "/exports";
+const std::string MAILQUEUE_DIR = FILESENDER_PLUGIN_ROOT "/mailqueue";
 const std::string FILE_EXT = ".zip";
-const int CHECK_INTERVAL = 10; 
+const int CHECK_INTERVAL = 300;  // consistency sweep; new archives arrive through inotify and /filesender/notify
 const std::string PROCESSED_MARK = ".uploaded";
 const std::string PROCESSING_MARK = ".uploading";
+const std::string TRANSFER_MARK = ".transfer";  // FileSender transfer checkpoint of an unfinished upload
 const std::string MAPPING_FILE = EXPORTS_DIR + "/mapping.json";
+const std::string QUARANTINE_DIR = MAILQUEUE_DIR + "/failed";  // archives given up on, not counted by the export credits
 
 std::string getLogsDir() {
-    return "/logs/filesender";
+    return FILESENDER_PLUGIN_ROOT "/logs/filesender";
 }
 
 std::string getLogFile() {
     return getLogsDir() + "/filesender.log";
 }
 
+std::mutex logMutex;  // upload workers log concurrently
+
 void log_to_file(const std::string& message) {
     std::string logsDir = getLogsDir();
     std::string logFile = getLogFile();
+    std::lock_guard<std::mutex> lock(logMutex);
     
     // Debug: Auch nach stderr für Docker-Logs
     std::cerr << "[DEBUG] " << message << std::endl;
@@ -63,40 +94,18 @@ void log_to_file(const std::string& message) {
     }
 }
 
-void load_mapping(std::unordered_map<std::string, std::string>& mapping) {
-    if (!fs::exists(MAPPING_FILE)) {
-        return;
-    }
-
-    std::ifstream file(MAPPING_FILE);
-    if (!file.is_open()) {
-        log_to_file("Failed to open mapping.json.");
-        return;
-    }
-
-    std::string line;
-    while (std::getline(file, line)) {
-        try {
-            Json::CharReaderBuilder builder;
-            std::string errs;
-            Json::Value entry;
-
-            std::istringstream ss(line);
-            if (!Json::parseFromStream(builder, ss, &entry, &errs) || !entry.isObject()) {
-                continue;
-            }
-            std::string zip_file = entry["file"].asString();
-            std::string email = entry["email"].asString();
-            if (!zip_file.empty() && !email.empty()) {
-                mapping[zip_file] = email;
-            }
-        } catch (const std::exception& e) {
-            continue;
-        }
+std::string JoinEmails(const std::vector<std::string>& emails, const char* separator)
+{
+    std::string joined;
+    for (const auto& email : emails) {
+        joined += (joined.empty() ? "" : separator) + email;
     }
+    return joined;
 }
 
-bool UploadFileSync(const std::string& filepath, const std::string& email, const std::string& filename) {
+// FILESENDER_CLIENT=python: former upload through the filesender.py CLI, one process per archive;
+// recipients is the comma separated list the CLI splits into one transfer
+bool UploadFileSync(const std::string& filepath, const std::string& recipients, const std::string& filename, int budgetSeconds) {
     std::string username = std::getenv("FILESENDER_USERNAME") ? std::getenv("FILESENDER_USERNAME") : "";
     std::string apikey = std::getenv("FILESENDER_API_KEY") ? std::getenv("FILESENDER_API_KEY") : "";
     
@@ -106,13 +115,13 @@ bool UploadFileSync(const std::string& filepath, const std::string& email, const
     }
     
     std::string logFile = "/tmp/upload_" + filename + ".log";
-    std::string command = "timeout 300 python3 /filesender_cli/filesender.py \"" + filepath + 
-                         "\" --recipients \"" + email + 
+    std::string command = "timeout " + std::to_string(budgetSeconds) + " python3 /filesender_cli/filesender.py \"" + filepath + 
+                         "\" --recipients \"" + recipients + 
                          "\" -u \"" + username + 
                          "\" -a \"" + apikey + 
                          "\" > \"" + logFile + "\" 2>&1";
     
-    log_to_file("Starting synchronous upload: " + filename + " to " + email);
+    log_to_file("Starting synchronous upload: " + filename + " to " + recipients);
     log_to_file("Upload command: " + command);
     
     int result = system(command.c_str());
@@ -123,7 +132,7 @@ bool UploadFileSync(const std::string& filepath, const std::string& email, const
             log_to_file("Upload successful: " + filename);
             return true;
         } else if (exit_code == 124) {  // timeout exit code
-            log_to_file("Upload timed out after 300 seconds: " + filename);
+            log_to_file("Upload timed out after " + std::to_string(budgetSeconds) + " seconds: " + filename);
         } else {
             log_to_file("Upload failed with exit code " + std::to_string(exit_code) + ": " + filename);
         }
@@ -152,121 +161,638 @@ bool UploadFileSync(const std::string& filepath, const std::string& email, const
     return false;
 }
 
-void cleanup_mapping() {
-    std::unordered_map<std::string, std::string> mapping;
-    load_mapping(mapping);
+// Writes a state marker and fsyncs it and its directory, nothing else on the host
+bool WriteDurableMarker(const std::string& path, const std::string& content) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()) && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+
+    int dirFd = open(MAILQUEUE_DIR.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd < 0) {
+        return false;
+    }
+    ok = fsync(dirFd) == 0 && ok;
+    close(dirFd);
+    return ok;
+}
 
-    std::vector<Json::Value> new_entries;
+// Stable study to upload start, median over the last uploads
+class LatencyTracker {
+public:
+    void Record(const std::string& filename, int64_t stableAt) {
+        if (stableAt <= 0) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        samples_.push_back(now - stableAt);
+        if (samples_.size() > WINDOW) samples_.pop_front();
+
+        std::vector<int64_t> sorted(samples_.begin(), samples_.end());
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        log_to_file("Upload start latency for " + filename + ": " + std::to_string(now - stableAt) + " ms after stable study (median " +
+                    std::to_string(sorted[sorted.size() / 2]) + " ms over " + std::to_string(sorted.size()) + " uploads)");
+    }
 
-    for (const auto& [zip_file, email] : mapping) {
-        fs::path uploaded_path = fs::path(MAILQUEUE_DIR) / (zip_file + PROCESSED_MARK);
-        if (!fs::exists(uploaded_path)) {
-            Json::Value obj;
-            obj["file"] = zip_file;
-            obj["email"] = email;
-            new_entries.push_back(obj);
+private:
+    static const size_t WINDOW = 100;
+    std::mutex mutex_;
+    std::deque<int64_t> samples_;
+};
+
+// Sources of new archives for the watcher: inotify on /mailqueue (renamed or written
+// archives) and names posted to /filesender/notify, which also covers archives linked
+// in by ExportPlugin without a rename. Finalize wakes the watcher through the same eventfd.
+class QueueEvents {
+public:
+    bool Open() {
+        wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd_ >= 0 && inotify_add_watch(inotifyFd_, MAILQUEUE_DIR.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+            close(inotifyFd_);
+            inotifyFd_ = -1;
         }
+        return wakeFd_ >= 0;
     }
 
-    std::string tempFile = MAPPING_FILE + ".tmp";
-    std::ofstream file(tempFile);
-    if (!file.is_open()) {
-        log_to_file("Failed to open temp mapping.json to write.");
-        return;
+    bool Watching() const {
+        return inotifyFd_ >= 0;
     }
 
-    Json::StreamWriterBuilder writer;
-    for (const auto& entry : new_entries) {
-        file << Json::writeString(writer, entry) << std::endl;
+    void Notify(const std::string& file) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            notified_.push_back(file);
+        }
+        Wake();
     }
-    file.close();
-    
-    if (rename(tempFile.c_str(), MAPPING_FILE.c_str()) != 0) {
-        log_to_file("Failed to update mapping.json atomically");
-        std::remove(tempFile.c_str());
+
+    void Wake() {
+        uint64_t one = 1;
+        if (write(wakeFd_, &one, sizeof(one)) < 0) {
+            // counter saturated, the watcher is awake anyway
+        }
+    }
+
+    // Waits up to timeoutMs and adds the announced archives to ready. Returns false if
+    // inotify lost events, so the caller sweeps the directory.
+    bool Wait(int timeoutMs, std::set<std::string>& ready) {
+        struct pollfd fds[2] = { { wakeFd_, POLLIN, 0 }, { inotifyFd_, POLLIN, 0 } };
+        poll(fds, inotifyFd_ >= 0 ? 2 : 1, timeoutMs);
+
+        uint64_t count;
+        while (read(wakeFd_, &count, sizeof(count)) > 0) {
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& file : notified_) {
+                ready.insert(file);
+            }
+            notified_.clear();
+        }
+
+        bool complete = true;
+        alignas(struct inotify_event) char buffer[16 * 1024];
+        ssize_t n;
+        while (inotifyFd_ >= 0 && (n = read(inotifyFd_, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + n;) {
+                struct inotify_event* event = reinterpret_cast<struct inotify_event*>(p);
+                if (event->mask & IN_Q_OVERFLOW) {
+                    complete = false;
+                } else if (event->len > 0) {
+                    std::string name(event->name);
+                    if (name.size() > FILE_EXT.size() && name.compare(name.size() - FILE_EXT.size(), FILE_EXT.size(), FILE_EXT) == 0) {
+                        ready.insert(name);
+                    }
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return complete;
+    }
+
+    void Close() {
+        if (inotifyFd_ >= 0) close(inotifyFd_);
+        if (wakeFd_ >= 0) close(wakeFd_);
+        inotifyFd_ = wakeFd_ = -1;
+    }
+
+private:
+    int wakeFd_ = -1;
+    int inotifyFd_ = -1;
+    std::mutex mutex_;
+    std::vector<std::string> notified_;
+};
+
+QueueEvents queueEvents;
+
+OrthancPluginErrorCode OnNotifyRoute(OrthancPluginRestOutput* output,
+                                     const char* /*url*/,
+                                     const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Post) {
+        OrthancPluginSendMethodNotAllowed(globalContext, output, "POST");
+        return OrthancPluginErrorCode_Success;
+    }
+
+    // The body is the archive name; an empty body only forces a look at the ready set
+    std::string file(reinterpret_cast<const char*>(request->body), request->bodySize);
+    if (file.empty() || file.find('/') != std::string::npos) {
+        queueEvents.Wake();
+    } else {
+        queueEvents.Notify(file);
+    }
+
+    OrthancPluginAnswerBuffer(globalContext, output, "OK", 2, "text/plain");
+    return OrthancPluginErrorCode_Success;
+}
+
+// Exclusive claim on a queue entry: the .uploading marker is created with O_EXCL and
+// names the owning process. Claims left by a crashed or restarted Orthanc are removed
+// at startup by ReleaseStaleClaims, so their archives are uploaded again.
+bool ClaimArchive(const std::string& path)
+{
+    int fd = open((path + PROCESSING_MARK).c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    std::string owner = "pid " + std::to_string(getpid()) + ", processing started at " + std::to_string(std::time(nullptr)) + "\n";
+    bool ok = write(fd, owner.data(), owner.size()) == static_cast<ssize_t>(owner.size());
+    close(fd);
+    return ok;
+}
+
+void ReleaseClaim(const std::string& path)
+{
+    std::remove((path + PROCESSING_MARK).c_str());
+}
+
+// Only this process uploads from /mailqueue, so every claim found at startup is stale
+void ReleaseStaleClaims()
+{
+    size_t released = 0;
+    try {
+        for (const auto& entry : fs::directory_iterator(MAILQUEUE_DIR)) {
+            if (entry.path().extension() == PROCESSING_MARK && std::remove(entry.path().c_str()) == 0) {
+                released++;
+            }
+        }
+    } catch (const std::exception& e) {
+        log_to_file("Failed to scan for stale claims: " + std::string(e.what()));
+    }
+    if (released > 0) {
+        log_to_file("Released " + std::to_string(released) + " stale upload claims");
+    }
+}
+
+FileSenderConfig fileSenderConfig;
+std::unique_ptr<FileSenderSession> fileSenderSession;  // null when uploading through filesender.py
+
+// Non-negative integer from the environment, fallback if unset or invalid
+long EnvNumber(const char* name, long fallback)
+{
+    const char* value = std::getenv(name);
+    if (!value || !*value) {
+        return fallback;
+    }
+    char* end;
+    long number = std::strtol(value, &end, 10);
+    return *end == '\0' && number >= 0 ? number : fallback;
+}
+
+void LoadFileSenderConfig(FileSenderConfig& config)
+{
+    const char* baseUrl = std::getenv("FILESENDER_BASE_URL");
+    if (baseUrl && *baseUrl) config.baseUrl = baseUrl;
+    config.username = std::getenv("FILESENDER_USERNAME") ? std::getenv("FILESENDER_USERNAME") : "";
+    config.apikey = std::getenv("FILESENDER_API_KEY") ? std::getenv("FILESENDER_API_KEY") : "";
+    config.transferDaysValid = std::max(1L, EnvNumber("FILESENDER_TRANSFER_DAYS", config.transferDaysValid));
+    config.chunkWindow = std::max(1L, EnvNumber("FILESENDER_CHUNK_WINDOW", config.chunkWindow));
+    config.budgetBaseSeconds = EnvNumber("FILESENDER_BUDGET_BASE", config.budgetBaseSeconds);
+    config.budgetRate = EnvNumber("FILESENDER_BUDGET_RATE", config.budgetRate);
+    config.chunkTimeoutSeconds = EnvNumber("FILESENDER_CHUNK_TIMEOUT", config.chunkTimeoutSeconds);
+    config.minThroughput = EnvNumber("FILESENDER_MIN_THROUGHPUT", config.minThroughput);
+    config.stallWindowSeconds = EnvNumber("FILESENDER_STALL_WINDOW", config.stallWindowSeconds);
+}
+
+// Backoff of failed uploads, see retryschedule.h
+RetrySchedule uploadRetries;
+long orphanGraceSeconds = 3600;  // FILESENDER_ORPHAN_GRACE
+
+void LoadRetryConfig()
+{
+    uploadRetries.Configure(static_cast<int>(EnvNumber("FILESENDER_MAX_ATTEMPTS", 0)),
+                            EnvNumber("FILESENDER_RETRY_BASE", 60) * 1000, EnvNumber("FILESENDER_RETRY_MAX_DELAY", 3600) * 1000);
+    orphanGraceSeconds = EnvNumber("FILESENDER_ORPHAN_GRACE", orphanGraceSeconds);
+}
+
+// Moves an archive that will not be uploaded out of the queue into QUARANTINE_DIR, with
+// its transfer checkpoint. Moving both back into /mailqueue retries it.
+bool QuarantineArchive(const std::string& filename, const std::string& reason)
+{
+    std::string from = MAILQUEUE_DIR + "/" + filename;
+    std::string to = QUARANTINE_DIR + "/" + filename;
+    if (mkdir(QUARANTINE_DIR.c_str(), 0755) != 0 && errno != EEXIST) {
+        log_to_file("Failed to create " + QUARANTINE_DIR + ": " + std::strerror(errno));
+        return false;
+    }
+    if (std::rename(from.c_str(), to.c_str()) != 0) {
+        log_to_file("Failed to quarantine " + filename + ": " + std::strerror(errno));
+        return false;
+    }
+    std::rename((from + TRANSFER_MARK).c_str(), (to + TRANSFER_MARK).c_str());  // absent unless the native client got a transfer
+    log_to_file("Quarantined " + filename + " in " + QUARANTINE_DIR + ": " + reason);
+    return true;
+}
+
+struct UploadJob {
+    std::string filename;
+    MappingEntry recipient;
+    uint64_t bytes = 0;
+};
+
+// Upload stage of the pipeline metrics, published by OnRefreshMetrics
+struct UploadMetrics {
+    LatencyHistogram attempt;   // one upload attempt
+    LatencyHistogram total;     // stable study to upload done
+    MetricCounter succeeded;
+    MetricCounter failed;
+    MetricCounter failures[FileSenderClient::Failure_Budget + 1];  // by FileSenderClient::Failure
+    MetricCounter failedCli;    // FILESENDER_CLIENT=python
+    MetricCounter sentBytes;    // chunk bytes, retries included
+    MetricCounter uploadMillis; // time spent in attempts, sentBytes / uploadMillis is the throughput
+    MetricCounter requests;
+    MetricCounter connects;
+    MetricCounter chunkRetries;
+    MetricCounter resumedBytes;
+    MetricCounter quarantined;  // attempts used up or no mapping record
+    std::atomic<int> inFlight{0};
+    std::atomic<uint64_t> lastRate{0};  // bytes/s of the last successful attempt
+};
+UploadMetrics uploadMetrics;
+
+// Spans of the upload stage, the trace id comes from the mapping log
+TraceLog tracer("FilesenderPlugin");
+
+// Fixed set of upload workers fed by the watcher thread, so one large upload does not
+// hold up the small ones behind it; queued archives are taken in the order of the
+// scheduler policy. State is logged per worker and published as metrics.
+class UploadPool {
+public:
+    void Start(size_t workers, const SchedulerConfig& scheduling) {
+        stopping_ = false;
+        jobs_.Configure(scheduling);
+        busy_.assign(workers, false);
+        for (size_t i = 0; i < workers; ++i) {
+            workers_.emplace_back(&UploadPool::WorkerLoop, this, i);
+        }
+        PublishMetrics();
+    }
+
+    // Running uploads finish; queued ones are dropped with their claims released
+    void Stop() {
+        std::vector<UploadJob> dropped;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            dropped = jobs_.Drain();
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            if (worker.joinable()) worker.join();
+        }
+        workers_.clear();
+        for (const auto& job : dropped) {
+            ReleaseClaim(MAILQUEUE_DIR + "/" + job.filename);
+        }
+    }
+
+    void Submit(UploadJob job, uint64_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::string cls = job.recipient.cls;
+            job.bytes = bytes;
+            queuedBytes_ += bytes;
+            jobs_.Push(std::move(job), bytes, cls);
+        }
+        wake_.notify_one();
+        PublishMetrics();
+    }
+
+    size_t Workers() const {
+        return workers_.size();
+    }
+
+private:
+    void WorkerLoop(size_t index) {
+        std::string tag = "[worker " + std::to_string(index) + "] ";
+        std::unique_ptr<FileSenderClient> client;  // kept across jobs for its connection and buffers
+        if (fileSenderSession) {
+            client.reset(new FileSenderClient(*fileSenderSession));
+        }
+        for (;;) {
+            UploadJob job;
+            std::string label;
+            int64_t waited;
+            ClassLatency::Summary wait;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !jobs_.Empty(); });
+                if (stopping_) return;
+                job = jobs_.Pop(label, waited);
+                queuedBytes_ -= job.bytes;
+                wait = queueLatency_.Record(label, waited);
+                busy_[index] = true;
+            }
+            PublishMetrics();
+            TraceSpan queued;
+            queued.trace = job.recipient.trace;
+            queued.name = "upload_wait";
+            queued.subject = job.filename;
+            queued.endUs = TraceLog::NowUs();
+            queued.startUs = queued.endUs - waited * 1000;
+            queued.bytes = job.bytes;
+            queued.outcome = "ok";
+            tracer.Record(queued);
+            log_to_file(tag + job.filename + " waited " + std::to_string(waited) + " ms in the upload queue (" + label + ": median " +
+                        std::to_string(wait.median) + " ms, max " + std::to_string(wait.max) + " ms over " + std::to_string(wait.count) + ")");
+            OrthancPluginSetMetricsValue(globalContext, ("filesender_queue_wait_ms_" + ClassLatency::MetricSuffix(label)).c_str(),
+                                         static_cast<float>(wait.median), OrthancPluginMetricsType_Default);
+
+            std::string path = MAILQUEUE_DIR + "/" + job.filename;
+            std::error_code ec;
+            uintmax_t size = fs::file_size(path, ec);
+            log_to_file(tag + "File found: " + job.filename + " -> Recipients: " + JoinEmails(job.recipient.emails, ", ") +
+                        " (" + std::to_string(ec ? 0 : size / 1048576) + " MB)");
+            latency_.Record(job.filename, job.recipient.stableAt);
+
+            auto start = std::chrono::steady_clock::now();
+            TraceScope uploadSpan(tracer, job.recipient.trace, "upload", job.filename);
+            uploadMetrics.inFlight++;
+            uint64_t requests = client ? client->Requests() : 0;
+            uint64_t connects = client ? client->Connects() : 0;
+            uint64_t retries = client ? client->ChunkRetries() : 0;
+            bool uploadSuccess;
+            if (client) {
+                std::string error;
+                uploadSuccess = client->UploadFile(path, path + TRANSFER_MARK, job.recipient.emails, error);
+                if (client->ResumedBytes() > 0) {
+                    log_to_file(tag + "Resumed transfer of " + job.filename + " with " +
+                                std::to_string(client->ResumedBytes() / 1048576) + " MB already uploaded");
+                }
+                if (!uploadSuccess) {
+                    log_to_file(tag + "Upload error for " + job.filename + ": " + error);
+                }
+            } else {
+                uploadSuccess = UploadFileSync(path, JoinEmails(job.recipient.emails, ","), job.filename, fileSenderConfig.BudgetSeconds(ec ? 0 : size));
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            uploadMetrics.inFlight--;
+
+            if (uploadSuccess) {
+                // A lost marker after a crash would send the archive again
+                if (!WriteDurableMarker(path + PROCESSED_MARK, "Upload completed at " + std::to_string(std::time(nullptr)) + "\n")) {
+                    log_to_file(tag + "Failed to persist upload marker for: " + job.filename);
+                } else {
+                    std::remove((path + TRANSFER_MARK).c_str());  // marked complete, only needed until the marker exists
+                }
+            }
+
+            // Effective throughput of every attempt, for tuning the stall thresholds
+            uint64_t sent = client ? client->SentBytes() : (uploadSuccess && !ec ? size : 0);
+            uploadSpan.SetBytes(sent);
+            uploadSpan.Finish(uploadSuccess ? "ok" : (client ? FileSenderClient::FailureName(client->LastFailure()) : "cli"));
+            std::ostringstream rate;
+            rate << std::fixed << std::setprecision(1) << seconds << " s, " << sent / 1048576.0 << " MB sent, "
+                 << (seconds > 0 ? sent / 1048576.0 / seconds : 0.0) << " MB/s";
+            if (client) {
+                rate << ", " << client->Requests() - requests << " requests, " << client->Connects() - connects << " new connections, "
+                     << client->ChunkRetries() - retries << " chunk retries";
+            }
+            if (uploadSuccess) {
+                log_to_file(tag + "Upload completed successfully: " + job.filename + " (" + rate.str() + ")");
+                uploadRetries.Forget(job.filename);
+            } else {
+                // The python client reports neither progress nor the kind of failure
+                bool progressed = client && client->AckedChunks() > 0;
+                FileSenderClient::Failure failure = client ? client->LastFailure() : FileSenderClient::Failure_None;
+                bool permanent = failure == FileSenderClient::Failure_Local || failure == FileSenderClient::Failure_Refused;
+                int strikes;
+                int64_t delay = uploadRetries.Failed(job.filename, progressed, permanent, strikes);
+                std::string attempt = client ? FileSenderClient::FailureName(failure) : "cli";
+                if (progressed) {
+                    attempt += ", " + std::to_string(client->AckedChunks()) + " chunks acknowledged";
+                } else if (permanent && uploadRetries.MaxAttempts() > 0) {
+                    attempt += ", " + std::to_string(strikes) + " of " + std::to_string(uploadRetries.MaxAttempts()) + " attempts";
+                }
+                if (delay >= 0) {
+                    log_to_file(tag + "Upload failed (" + attempt + "), retrying in " + std::to_string(delay / 1000) + " s: " +
+                                job.filename + " (" + rate.str() + ")");
+                } else {
+                    log_to_file(tag + "Upload failed (" + attempt + "), giving up: " + job.filename + " (" + rate.str() + ")");
+                    if (QuarantineArchive(job.filename, std::to_string(strikes) + " attempts " +
+                                          (failure == FileSenderClient::Failure_Refused ? "refused by the server" : "failed on this side"))) {
+                        uploadMetrics.quarantined.Add();
+                    }
+                }
+            }
+            ReleaseClaim(path);
+            if (!uploadSuccess) {
+                queueEvents.Wake();  // the watcher waits for the next retry
+            }
+
+            int64_t millis = static_cast<int64_t>(seconds * 1000);
+            uploadMetrics.attempt.Observe(millis);
+            uploadMetrics.uploadMillis.Add(static_cast<uint64_t>(millis));
+            uploadMetrics.sentBytes.Add(sent);
+            if (client) {
+                uploadMetrics.requests.Add(client->Requests() - requests);
+                uploadMetrics.connects.Add(client->Connects() - connects);
+                uploadMetrics.chunkRetries.Add(client->ChunkRetries() - retries);
+                uploadMetrics.resumedBytes.Add(client->ResumedBytes());
+            }
+            if (uploadSuccess) {
+                uploadMetrics.succeeded.Add();
+                uploadMetrics.lastRate.store(seconds > 0 ? static_cast<uint64_t>(sent / seconds) : 0, std::memory_order_relaxed);
+                if (job.recipient.stableAt > 0) {
+                    uploadMetrics.total.Observe(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count() - job.recipient.stableAt);
+                }
+            } else {
+                uploadMetrics.failed.Add();
+                if (client) {
+                    uploadMetrics.failures[client->LastFailure()].Add();
+                } else {
+                    uploadMetrics.failedCli.Add();
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                busy_[index] = false;
+            }
+            PublishMetrics();
+        }
+    }
+
+    void PublishMetrics() {
+        size_t queued, busy = 0;
+        uint64_t bytes;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued = jobs_.Size();
+            bytes = queuedBytes_;
+            for (bool b : busy_) busy += b ? 1 : 0;
+        }
+        OrthancPluginSetMetricsValue(globalContext, "filesender_upload_queue_depth", static_cast<float>(queued), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "filesender_upload_queue_mb", static_cast<float>(bytes / 1048576), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(globalContext, "filesender_workers_busy", static_cast<float>(busy), OrthancPluginMetricsType_Default);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    JobScheduler<UploadJob> jobs_;
+    uint64_t queuedBytes_ = 0;  // of the archives in jobs_
+    ClassLatency queueLatency_;
+    std::vector<std::thread> workers_;
+    std::vector<bool> busy_;
+    bool stopping_ = false;
+    LatencyTracker latency_;
+};
+
+UploadPool uploadPool;
+
+// Called by Orthanc before it answers /tools/metrics and /tools/metrics-prometheus
+void OnRefreshMetrics()
+{
+    uploadMetrics.attempt.Publish(globalContext, "filesender_upload_attempt_ms");
+    uploadMetrics.total.Publish(globalContext, "filesender_study_latency_ms");
+    uploadMetrics.succeeded.Publish(globalContext, "filesender_uploads_succeeded_total");
+    uploadMetrics.failed.Publish(globalContext, "filesender_uploads_failed_total");
+    for (int failure = FileSenderClient::Failure_Local; failure <= FileSenderClient::Failure_Budget; ++failure) {
+        uploadMetrics.failures[failure].Publish(globalContext, std::string("filesender_failures_") +
+                                                FileSenderClient::FailureName(static_cast<FileSenderClient::Failure>(failure)) + "_total");
+    }
+    uploadMetrics.failedCli.Publish(globalContext, "filesender_failures_cli_total");
+    uploadMetrics.sentBytes.Publish(globalContext, "filesender_sent_bytes_total");
+    uploadMetrics.uploadMillis.Publish(globalContext, "filesender_upload_ms_total");
+    uploadMetrics.requests.Publish(globalContext, "filesender_requests_total");
+    uploadMetrics.connects.Publish(globalContext, "filesender_connections_total");
+    uploadMetrics.chunkRetries.Publish(globalContext, "filesender_chunk_retries_total");
+    uploadMetrics.resumedBytes.Publish(globalContext, "filesender_resumed_bytes_total");
+    uploadMetrics.quarantined.Publish(globalContext, "filesender_quarantined_total");
+    OrthancPluginSetMetricsValue(globalContext, "filesender_retries_waiting", static_cast<float>(uploadRetries.Waiting()),
+                                 OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(globalContext, "filesender_uploads_in_flight", static_cast<float>(uploadMetrics.inFlight.load()),
+                                 OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(globalContext, "filesender_last_upload_kbps", static_cast<float>(uploadMetrics.lastRate.load() / 1024),
+                                 OrthancPluginMetricsType_Default);
+}
+
+// Adds every archive in the queue without a marker to ready
+void SweepQueue(std::set<std::string>& ready)
+{
+    if (!fs::exists(MAILQUEUE_DIR)) {
+        log_to_file("Mailqueue directory does not exist: " + MAILQUEUE_DIR);
+        return;
+    }
+    for (const auto& entry : fs::directory_iterator(MAILQUEUE_DIR)) {
+        if (entry.is_regular_file() && entry.path().extension() == FILE_EXT) {
+            ready.insert(entry.path().filename().string());
+        }
     }
 }
 
 void FilesenderThread()
 {
     OrthancPluginLogInfo(globalContext, "Filesender-Watcher started.");
-    log_to_file("Filesender-Watcher started (Synchronous Uploads)");
+    log_to_file("Filesender-Watcher started (" + std::to_string(uploadPool.Workers()) + " upload workers, " +
+                (queueEvents.Watching() ? "inotify" : "no inotify, sweep only") + ")");
 
     std::set<std::string> ignoredFiles; // files without e-mail should not be logged endlessy
+    std::set<std::string> ready;        // archives announced but not claimed yet
+    MappingIndex mapping(MAPPING_FILE);
+    auto nextSweep = std::chrono::steady_clock::now();
+    int64_t untilRetry = -1;            // ms until the next failed upload is due, -1 if none waits
 
     while (runWatcher) {
         try {
-            std::unordered_map<std::string, std::string> mapping;
-            load_mapping(mapping);
-
-            if (!fs::exists(MAILQUEUE_DIR)) {
-                log_to_file("Mailqueue directory does not exist: " + MAILQUEUE_DIR);
-                std::this_thread::sleep_for(std::chrono::seconds(CHECK_INTERVAL));
-                continue;
+            auto now = std::chrono::steady_clock::now();
+            if (now >= nextSweep) {
+                SweepQueue(ready);
+                nextSweep = now + std::chrono::seconds(CHECK_INTERVAL);
             }
+            untilRetry = uploadRetries.TakeDue(ready);
 
-            for (const auto& entry : fs::directory_iterator(MAILQUEUE_DIR)) {
-                if (!entry.is_regular_file() || entry.path().extension() != FILE_EXT) {
-                    continue;
-                }
+            mapping.Refresh();
 
-                std::string filename = entry.path().filename().string();
+            for (auto it = ready.begin(); it != ready.end() && runWatcher;) {
+                std::string filename = *it;
                 fs::path full_path = fs::path(MAILQUEUE_DIR) / filename;
 
-                if (fs::exists(full_path.string() + PROCESSED_MARK) || 
-                    fs::exists(full_path.string() + PROCESSING_MARK)) {
+                if (!fs::exists(full_path) || fs::exists(full_path.string() + PROCESSED_MARK)) {
+                    uploadRetries.Forget(filename);  // removed or uploaded by hand
+                    it = ready.erase(it);
+                    continue;
+                }
+                if (fs::exists(full_path.string() + PROCESSING_MARK)) {
+                    it = ready.erase(it);
+                    continue;
+                }
+                // Failed before, TakeDue puts it back once its backoff has passed
+                if (!uploadRetries.Due(filename)) {
+                    it = ready.erase(it);
                     continue;
                 }
 
-                auto recipient = mapping.find(filename);
-                if (recipient == mapping.end()) {
+                // Kept in ready: the mapping record may still be on its way, up to orphanGraceSeconds
+                // after the archive was written
+                const MappingEntry* recipient = mapping.Find(filename);
+                if (!recipient) {
+                    struct stat st;
+                    if (stat(full_path.c_str(), &st) == 0 && std::time(nullptr) - st.st_mtime > orphanGraceSeconds) {
+                        if (QuarantineArchive(filename, "no e-mail address known after " + std::to_string(orphanGraceSeconds) + " s")) {
+                            uploadMetrics.quarantined.Add();
+                        }
+                        ignoredFiles.erase(filename);
+                        it = ready.erase(it);
+                        continue;
+                    }
                     if (ignoredFiles.find(filename) == ignoredFiles.end()) {
-                        std::string msg = "No e-mail-adress known for: " + filename + " (will be ignored)";
+                        std::string msg = "No e-mail-adress known for: " + filename + " (waiting for its mapping record)";
                         log_to_file(msg);
                         ignoredFiles.insert(filename);
                     }
+                    ++it;
                     continue;
                 }
+                it = ready.erase(it);
+                ignoredFiles.erase(filename);
 
-                std::ofstream processingMarker(full_path.string() + PROCESSING_MARK);
-                if (processingMarker.is_open()) {
-                    processingMarker << "Processing started at " << std::time(nullptr) << std::endl;
-                    processingMarker.close();
-                } else {
-                    log_to_file("Failed to create processing marker for: " + filename);
+                if (!ClaimArchive(full_path.string())) {
+                    log_to_file("Failed to claim " + filename + ", already being uploaded");
                     continue;
                 }
-
-                std::string msg = "File found: " + filename + " -> Recipient: " + recipient->second;
-                log_to_file(msg);
-
-                bool uploadSuccess = UploadFileSync(full_path.string(), recipient->second, filename);
-                
-                std::remove((full_path.string() + PROCESSING_MARK).c_str());
-                
-                if (uploadSuccess) {
-                    std::ofstream marker(full_path.string() + PROCESSED_MARK);
-                    if (marker.is_open()) {
-                        marker << "Upload completed at " << std::time(nullptr) << std::endl;
-                        marker.close();
-                    }
-                    
-                    log_to_file("Upload completed successfully: " + filename);
-                    
-                    ignoredFiles.erase(filename);
-                } else {
-                    log_to_file("Upload failed, will retry next cycle: " + filename);
-                }
+                std::error_code ec;
+                uintmax_t size = fs::file_size(full_path, ec);
+                uploadPool.Submit(UploadJob{ filename, *recipient }, ec ? 0 : size);
             }
 
-            cleanup_mapping();
-
         } catch (const std::exception& e) {
             std::string error_msg = "General error in FilesenderThread: " + std::string(e.what());
             log_to_file(error_msg);
         }
 
-        std::this_thread::sleep_for(std::chrono::seconds(CHECK_INTERVAL));
+        if (!runWatcher) {
+            break;
+        }
+        auto untilSweep = std::chrono::duration_cast<std::chrono::milliseconds>(nextSweep - std::chrono::steady_clock::now()).count();
+        int64_t timeout = untilRetry >= 0 ? std::min<int64_t>(untilSweep, untilRetry) : untilSweep;
+        if (!queueEvents.Wait(static_cast<int>(std::max<int64_t>(0, timeout)), ready)) {
+            log_to_file("inotify queue overflow, sweeping " + MAILQUEUE_DIR);
+            nextSweep = std::chrono::steady_clock::now();
+        }
     }
 
     OrthancPluginLogInfo(globalContext, "Filesender-Watcher ended.");
@@ -286,9 +812,48 @@ extern "C"
             OrthancPluginLogError(context, ("Failed to create directories: " + std::string(e.what())).c_str());
         }
         
-        OrthancPluginLogInfo(context, "FilesenderPlugin started (Synchronous).");
+        OrthancPluginLogInfo(context, "FilesenderPlugin started.");
         log_to_file("FilesenderPlugin initialized");
         
+        if (!queueEvents.Open()) {
+            OrthancPluginLogError(context, "FilesenderPlugin: eventfd unavailable");
+            return -1;
+        }
+        ReleaseStaleClaims();
+
+        LoadFileSenderConfig(fileSenderConfig);
+        LoadRetryConfig();
+        log_to_file("Upload budget " + std::to_string(fileSenderConfig.budgetBaseSeconds) + " s + 1 s per " +
+                    std::to_string(fileSenderConfig.budgetRate / 1024) + " KB, stalled below " +
+                    std::to_string(fileSenderConfig.minThroughput / 1024) + " KB/s over " + std::to_string(fileSenderConfig.stallWindowSeconds) +
+                    " s, " + std::to_string(fileSenderConfig.chunkTimeoutSeconds) + " s per request");
+        log_to_file("Failed uploads retried with backoff" +
+                    (uploadRetries.MaxAttempts() > 0 ? ", archives refused or failing on this side quarantined after " + std::to_string(uploadRetries.MaxAttempts()) + " attempts without progress"
+                                                     : std::string()) +
+                    ", archives without a mapping record quarantined after " + std::to_string(orphanGraceSeconds) + " s in " + QUARANTINE_DIR);
+        const char* clientEnv = std::getenv("FILESENDER_CLIENT");
+        if (!clientEnv || std::string(clientEnv) != "python") {
+            if (fileSenderConfig.username.empty() || fileSenderConfig.apikey.empty()) {
+                log_to_file("ERROR: FILESENDER_USERNAME or FILESENDER_API_KEY not set");
+            }
+            curl_global_init(CURL_GLOBAL_DEFAULT);
+            fileSenderSession.reset(new FileSenderSession(fileSenderConfig));
+            log_to_file("Native FileSender client for " + fileSenderConfig.baseUrl + ", " +
+                        std::to_string(fileSenderConfig.chunkWindow) + " chunks in flight per file");
+        }
+
+        int workers = 2;
+        const char* workersEnv = std::getenv("FILESENDER_UPLOAD_WORKERS");
+        if (workersEnv && std::atoi(workersEnv) > 0) {
+            workers = std::atoi(workersEnv);
+        }
+        SchedulerConfig scheduling = SchedulerConfig::FromEnvironment();
+        uploadPool.Start(workers, scheduling);
+        log_to_file(std::string("Upload order: ") + scheduling.PolicyName() + " scheduling");
+
+        tracer.ConfigureFromEnvironment();
+        OrthancPluginRegisterRestCallback(context, "/filesender/notify", OnNotifyRoute);
+        OrthancPluginRegisterRefreshMetricsCallback(context, OnRefreshMetrics);
         watcherThread = std::thread(FilesenderThread);
         return 0;
     }
@@ -296,8 +861,15 @@ extern "C"
     ORTHANC_PLUGINS_API void OrthancPluginFinalize()
     {
         runWatcher = false;
+        queueEvents.Wake();
         if (watcherThread.joinable())
             watcherThread.join();
+        uploadPool.Stop();
+        if (fileSenderSession) {
+            fileSenderSession.reset();
+            curl_global_cleanup();
+        }
+        queueEvents.Close();
         OrthancPluginLogInfo(globalContext, "FilesenderPlugin unloaded.");
         log_to_file("FilesenderPlugin finalized");
     }
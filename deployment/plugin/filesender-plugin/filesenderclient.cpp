@@ -0,0 +1,721 @@
+#include "filesenderclient.h"
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    const char* JSON_TYPE = "application/json";
+    const char* CHUNK_TYPE = "application/octet-stream";
+    const int CONNECT_TIMEOUT = 30;       // seconds
+    const int64_t CLEANUP_TIMEOUT = 30000;  // ms granted to deleteTransfer after a failure
+    const int CHUNK_ATTEMPTS = 3;
+    const int64_t CHUNK_RETRY_DELAY = 1000;  // ms, times the attempt number
+    const int64_t RESUME_MARGIN = 24 * 3600;  // s, a transfer closer to expiry is started over
+
+    int64_t SteadyMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    size_t WriteBody(char* data, size_t size, size_t count, void* userp) {
+        static_cast<std::string*>(userp)->append(data, size * count);
+        return size * count;
+    }
+
+    // The signed URL has no scheme, as in filesender.py
+    std::string StripScheme(const std::string& url) {
+        size_t pos = url.find("://");
+        return pos == std::string::npos ? url : url.substr(pos + 3);
+    }
+
+    // Percent-encodes a key=value argument; '@' stays readable in remote_user
+    std::string QuoteArgument(const std::string& arg) {
+        static const char* HEX = "0123456789ABCDEF";
+        std::string quoted;
+        quoted.reserve(arg.size());
+        for (unsigned char c : arg) {
+            if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~' || c == '@' || c == '=') {
+                quoted += static_cast<char>(c);
+            } else {
+                quoted += '%';
+                quoted += HEX[c >> 4];
+                quoted += HEX[c & 15];
+            }
+        }
+        return quoted;
+    }
+
+    std::string Join(const std::vector<std::string>& args, bool quote) {
+        std::string joined;
+        for (const auto& arg : args) {
+            if (!joined.empty()) joined += '&';
+            joined += quote ? QuoteArgument(arg) : arg;
+        }
+        return joined;
+    }
+
+    // The server rejects the request itself, repeating it will not help
+    bool Refused(long code) {
+        return code >= 400 && code < 500 && code != 408 && code != 429;
+    }
+
+    // Transfer and file ids come back as numbers, uids as strings
+    std::string IdString(const Json::Value& value) {
+        if (value.isIntegral()) return std::to_string(value.asLargestInt());
+        return value.isString() ? value.asString() : "";
+    }
+
+    std::string ToJson(const Json::Value& value) {
+        Json::StreamWriterBuilder builder;
+        builder["indentation"] = "";
+        return Json::writeString(builder, value);
+    }
+
+    bool ReadFull(int fd, char* buffer, size_t size, uint64_t offset, size_t& done) {
+        done = 0;
+        while (done < size) {
+            ssize_t n = pread(fd, buffer + done, size - done, offset + done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            if (n == 0) break;
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+FileSenderSession::FileSenderSession(const FileSenderConfig& config)
+    : config_(config) {
+    share_ = curl_share_init();
+    if (share_) {
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &FileSenderSession::Lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &FileSenderSession::Unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+}
+
+FileSenderSession::~FileSenderSession() {
+    if (share_) curl_share_cleanup(share_);
+}
+
+size_t FileSenderSession::ChunkSize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return chunkSize_;
+}
+
+void FileSenderSession::SetChunkSize(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunkSize_ = size;
+}
+
+void FileSenderSession::Lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+    static_cast<FileSenderSession*>(userptr)->locks_[data].lock();
+}
+
+void FileSenderSession::Unlock(CURL*, curl_lock_data data, void* userptr) {
+    static_cast<FileSenderSession*>(userptr)->locks_[data].unlock();
+}
+
+FileSenderClient::FileSenderClient(FileSenderSession& session)
+    : session_(session), reader_(Json::CharReaderBuilder().newCharReader()) {
+    curl_ = NewHandle();
+
+    // An empty Expect: saves the 100-continue round trip curl adds to large bodies
+    jsonHeaders_ = curl_slist_append(jsonHeaders_, "Accept: application/json");
+    jsonHeaders_ = curl_slist_append(jsonHeaders_, "Content-Type: application/json");
+    jsonHeaders_ = curl_slist_append(jsonHeaders_, "Expect:");
+    chunkHeaders_ = curl_slist_append(chunkHeaders_, "Accept: application/json");
+    chunkHeaders_ = curl_slist_append(chunkHeaders_, "Content-Type: application/octet-stream");
+    chunkHeaders_ = curl_slist_append(chunkHeaders_, "Expect:");
+}
+
+FileSenderClient::~FileSenderClient() {
+    for (auto& slot : slots_) {
+        if (multi_) curl_multi_remove_handle(multi_, slot->curl);
+        curl_easy_cleanup(slot->curl);
+    }
+    if (multi_) curl_multi_cleanup(multi_);
+    if (curl_) curl_easy_cleanup(curl_);
+    curl_slist_free_all(jsonHeaders_);
+    curl_slist_free_all(chunkHeaders_);
+}
+
+CURL* FileSenderClient::NewHandle() const {
+    CURL* curl = curl_easy_init();
+    if (curl) {
+        if (session_.Share()) curl_easy_setopt(curl, CURLOPT_SHARE, session_.Share());
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, static_cast<long>(CONNECT_TIMEOUT));
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteBody);
+    }
+    return curl;
+}
+
+std::string FileSenderClient::Sign(const std::string& prefix, const char* content, size_t contentSize) const {
+    const std::string& key = session_.Config().apikey;
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    size_t macSize = 0;
+
+    EVP_MAC* hmac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+    EVP_MAC_CTX* ctx = hmac ? EVP_MAC_CTX_new(hmac) : nullptr;
+    char digest[] = "SHA1";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()
+    };
+    bool ok = ctx &&
+              EVP_MAC_init(ctx, reinterpret_cast<const unsigned char*>(key.data()), key.size(), params) == 1 &&
+              EVP_MAC_update(ctx, reinterpret_cast<const unsigned char*>(prefix.data()), prefix.size()) == 1;
+    // Bodies are signed as '&' + content, a present but empty chunk included
+    if (ok && content) {
+        ok = EVP_MAC_update(ctx, reinterpret_cast<const unsigned char*>("&"), 1) == 1 &&
+             EVP_MAC_update(ctx, reinterpret_cast<const unsigned char*>(content), contentSize) == 1;
+    }
+    ok = ok && EVP_MAC_final(ctx, mac, &macSize, sizeof(mac)) == 1;
+    EVP_MAC_CTX_free(ctx);
+    EVP_MAC_free(hmac);
+    if (!ok) return "";
+
+    static const char* HEX = "0123456789abcdef";
+    std::string hex;
+    for (size_t i = 0; i < macSize; ++i) {
+        hex += HEX[mac[i] >> 4];
+        hex += HEX[mac[i] & 15];
+    }
+    return hex;
+}
+
+bool FileSenderClient::Perform(const char* method, const std::string& url, const char* content, size_t contentSize,
+                               const char* contentType, Response& response, std::string& error) {
+    if (!curl_) {
+        error = "curl_easy_init failed";
+        failure_ = Failure_Local;
+        return false;
+    }
+
+    long timeoutMs;
+    if (!TimeLeft(timeoutMs, error)) {
+        return false;
+    }
+
+    bool get = strcmp(method, "get") == 0;
+    bool del = strcmp(method, "delete") == 0;
+    curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+    if (get || del) {
+        curl_easy_setopt(curl_, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, del ? "DELETE" : nullptr);
+    } else {
+        curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, content ? content : "");
+        curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(content ? contentSize : 0));
+        curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, strcmp(method, "put") == 0 ? "PUT" : nullptr);
+    }
+    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, strcmp(contentType, CHUNK_TYPE) == 0 ? chunkHeaders_ : jsonHeaders_);
+    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &response.body);
+    curl_easy_setopt(curl_, CURLOPT_TIMEOUT_MS, timeoutMs);
+
+    CURLcode res = curl_easy_perform(curl_);
+    CountRequest(curl_);
+
+    if (res != CURLE_OK) {
+        error = std::string(curl_easy_strerror(res)) + " (" + method + " " + url.substr(0, url.find('?')) + ")";
+        failure_ = Failure_Network;
+        return false;
+    }
+    curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &response.code);
+    return true;
+}
+
+void FileSenderClient::CountRequest(CURL* curl) {
+    requests_++;
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    connects_ += static_cast<uint64_t>(connects);
+}
+
+// CURLOPT_TIMEOUT_MS of the next request: the per-request limit, cut to what is left of
+// the upload's budget. False once the budget is spent.
+bool FileSenderClient::TimeLeft(long& timeoutMs, std::string& error) {
+    timeoutMs = session_.Config().chunkTimeoutSeconds * 1000L;
+    if (deadline_ > 0) {
+        int64_t remaining = deadline_ - SteadyMs();
+        if (remaining <= 0) {
+            error = "Upload budget of " + std::to_string(budgetSeconds_) + " s exhausted";
+            failure_ = Failure_Budget;
+            return false;
+        }
+        if (timeoutMs <= 0 || remaining < timeoutMs) {
+            timeoutMs = static_cast<long>(remaining);
+        }
+    }
+    return true;
+}
+
+int FileSenderClient::OnProgress(void* userp, curl_off_t, curl_off_t, curl_off_t, curl_off_t ulnow) {
+    ChunkSlot* slot = static_cast<ChunkSlot*>(userp);
+    if (ulnow > slot->uploaded) {
+        *slot->sent += static_cast<uint64_t>(ulnow - slot->uploaded);
+        slot->uploaded = ulnow;
+    }
+    return 0;
+}
+
+// call() of filesender.py: remote_user and timestamp are added, the sorted arguments
+// are signed together with the body and the signature is appended to the query.
+// Empty if signing failed.
+std::string FileSenderClient::SignedUrl(const char* method, const std::string& path, std::vector<std::string> args,
+                                        const char* content, size_t contentSize) const {
+    const FileSenderConfig& config = session_.Config();
+    args.push_back("remote_user=" + config.username);
+    args.push_back("timestamp=" + std::to_string(std::time(nullptr)));
+    std::sort(args.begin(), args.end());
+
+    std::string signature = Sign(std::string(method) + "&" + StripScheme(config.baseUrl) + path + "?" + Join(args, false),
+                                 content, contentSize);
+    if (signature.empty()) {
+        return "";
+    }
+    args.push_back("signature=" + signature);
+    std::sort(args.begin(), args.end());
+    return config.baseUrl + path + "?" + Join(args, true);
+}
+
+bool FileSenderClient::CheckResponse(const char* method, const std::string& path, const Response& response,
+                                     Json::Value& result, std::string& error) {
+    bool created = strcmp(method, "post") == 0 && response.code == 201;
+    if (response.code != 200 && !created) {
+        lastHttpError_ = response.code;
+        error = "Http error " + std::to_string(response.code) + " " + response.body.substr(0, 300);
+        failure_ = Refused(response.code) ? Failure_Refused : Failure_Server;
+        return false;
+    }
+    if (response.body.empty()) {
+        error = "Http error " + std::to_string(response.code) + " Empty response";
+        failure_ = Failure_Server;
+        return false;
+    }
+
+    std::string errs;
+    result = Json::Value();
+    if (!reader_->parse(response.body.data(), response.body.data() + response.body.size(), &result, &errs)) {
+        error = "Invalid JSON from " + path + ": " + errs;
+        failure_ = Failure_Server;
+        return false;
+    }
+    return true;
+}
+
+bool FileSenderClient::Call(const char* method, const std::string& path, std::vector<std::string> args,
+                            const char* content, size_t contentSize, const char* contentType,
+                            Json::Value& result, std::string& error) {
+    std::string url = SignedUrl(method, path, std::move(args), content, contentSize);
+    if (url.empty()) {
+        error = "HMAC-SHA1 signing failed";
+        failure_ = Failure_Local;
+        return false;
+    }
+
+    Response response;
+    return Perform(method, url, content, contentSize, contentType, response, error) &&
+           CheckResponse(method, path, response, result, error);
+}
+
+bool FileSenderClient::StartChunk(ChunkSlot& slot, int fd, uint64_t offset, int attempt, size_t chunkSize,
+                                  const std::string& fileId, const std::vector<std::string>& args, std::string& error) {
+    if (slot.buffer.size() < chunkSize) {
+        slot.buffer.resize(chunkSize);
+    }
+    if (!ReadFull(fd, slot.buffer.data(), chunkSize, offset, slot.length)) {
+        error = std::string("Read failed at offset ") + std::to_string(offset) + ": " + strerror(errno);
+        failure_ = Failure_Local;
+        return false;
+    }
+    slot.url = SignedUrl("put", "/file/" + fileId + "/chunk/" + std::to_string(offset), args, slot.buffer.data(), slot.length);
+    if (slot.url.empty()) {
+        error = "HMAC-SHA1 signing failed";
+        failure_ = Failure_Local;
+        return false;
+    }
+    long timeoutMs;
+    if (!TimeLeft(timeoutMs, error)) {
+        return false;
+    }
+    slot.offset = offset;
+    slot.attempt = attempt;
+    slot.response = Response();
+    slot.uploaded = 0;
+    slot.sent = &sentBytes_;
+
+    curl_easy_setopt(slot.curl, CURLOPT_URL, slot.url.c_str());
+    curl_easy_setopt(slot.curl, CURLOPT_POSTFIELDS, slot.buffer.data());
+    curl_easy_setopt(slot.curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(slot.length));
+    curl_easy_setopt(slot.curl, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(slot.curl, CURLOPT_HTTPHEADER, chunkHeaders_);
+    curl_easy_setopt(slot.curl, CURLOPT_WRITEDATA, &slot.response.body);
+    curl_easy_setopt(slot.curl, CURLOPT_PRIVATE, &slot);
+    curl_easy_setopt(slot.curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(slot.curl, CURLOPT_XFERINFOFUNCTION, &FileSenderClient::OnProgress);
+    curl_easy_setopt(slot.curl, CURLOPT_XFERINFODATA, &slot);
+    curl_easy_setopt(slot.curl, CURLOPT_TIMEOUT_MS, timeoutMs);
+    if (curl_multi_add_handle(multi_, slot.curl) != CURLM_OK) {
+        error = "curl_multi_add_handle failed";
+        failure_ = Failure_Local;
+        return false;
+    }
+    return true;
+}
+
+// putChunk for offsets 0, n, 2n ... up to and including size like filesender.py, except
+// those acknowledged in the checkpoint, with up to chunkWindow PUTs in flight. FileSender addresses chunks by offset, so they may
+// complete in any order; a failed chunk is sent again on its own after a pause, and the
+// file is done once every offset was acknowledged.
+bool FileSenderClient::PutChunks(int fd, uint64_t size, size_t chunkSize, const std::string& fileId,
+                                 const std::vector<std::string>& args, TransferCheckpoint* checkpoint, std::string& error) {
+    struct Pending {
+        uint64_t offset;
+        int attempt;
+        int64_t notBefore;
+    };
+
+    // Offsets the server has not acknowledged in an earlier attempt
+    std::deque<uint64_t> offsets;
+    for (uint64_t offset = 0; offset <= size; offset += chunkSize) {
+        if (!checkpoint || !checkpoint->Acked(offset)) {
+            offsets.push_back(offset);
+        }
+    }
+    uint64_t chunks = offsets.size();
+    if (chunks == 0) {
+        return true;
+    }
+    size_t window = static_cast<size_t>(std::min<uint64_t>(std::max(1, session_.Config().chunkWindow), chunks));
+    if (!multi_ && !(multi_ = curl_multi_init())) {
+        error = "curl_multi_init failed";
+        failure_ = Failure_Local;
+        return false;
+    }
+    while (slots_.size() < window) {
+        std::unique_ptr<ChunkSlot> slot(new ChunkSlot);
+        if (!(slot->curl = NewHandle())) {
+            error = "curl_easy_init failed";
+            failure_ = Failure_Local;
+            return false;
+        }
+        slots_.push_back(std::move(slot));
+    }
+    std::vector<ChunkSlot*> idle;
+    for (size_t i = 0; i < window; ++i) {
+        idle.push_back(slots_[i].get());
+    }
+
+    // Bytes sent over time, for the throughput floor
+    const FileSenderConfig& config = session_.Config();
+    int64_t windowMs = config.stallWindowSeconds * 1000LL;
+    int64_t started = SteadyMs();
+    std::deque<std::pair<int64_t, uint64_t>> samples;
+
+    std::deque<Pending> retries;
+    uint64_t acknowledged = 0;
+    bool ok = true;
+    while (ok && acknowledged < chunks) {
+        // Fill the window, retries that are due before new offsets
+        int64_t now = SteadyMs();
+        while (ok && !idle.empty()) {
+            Pending next;
+            auto due = std::find_if(retries.begin(), retries.end(), [now](const Pending& p) { return p.notBefore <= now; });
+            if (due != retries.end()) {
+                next = *due;
+                retries.erase(due);
+            } else if (!offsets.empty()) {
+                next = Pending{ offsets.front(), 0, 0 };
+                offsets.pop_front();
+            } else {
+                break;
+            }
+            ok = StartChunk(*idle.back(), fd, next.offset, next.attempt, chunkSize, fileId, args, error);
+            if (ok) {
+                idle.pop_back();
+            }
+        }
+        if (!ok) {
+            break;
+        }
+
+        int running;
+        curl_multi_perform(multi_, &running);
+        curl_multi_poll(multi_, nullptr, 0, retries.empty() ? 1000 : 100, nullptr);
+        curl_multi_perform(multi_, &running);
+
+        CURLMsg* msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi_, &queued))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            ChunkSlot* slot = nullptr;
+            CURLcode res = msg->data.result;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, reinterpret_cast<char**>(&slot));
+            curl_multi_remove_handle(multi_, slot->curl);
+            CountRequest(slot->curl);
+            idle.push_back(slot);
+
+            std::string chunkError;
+            Json::Value result;
+            if (res == CURLE_OK) {
+                curl_easy_getinfo(slot->curl, CURLINFO_RESPONSE_CODE, &slot->response.code);
+                if (CheckResponse("put", "/file/" + fileId + "/chunk/" + std::to_string(slot->offset), slot->response, result, chunkError)) {
+                    acknowledged++;
+                    ackedChunks_++;
+                    if (checkpoint) {
+                        checkpoint->Ack(slot->offset);
+                    }
+                    continue;
+                }
+            } else {
+                chunkError = curl_easy_strerror(res);
+            }
+
+            if (slot->attempt + 1 < CHUNK_ATTEMPTS && ok && !Refused(slot->response.code)) {
+                chunkRetries_++;
+                retries.push_back(Pending{ slot->offset, slot->attempt + 1, SteadyMs() + CHUNK_RETRY_DELAY * (slot->attempt + 1) });
+            } else if (ok) {
+                error = "Chunk at offset " + std::to_string(slot->offset) + " failed after " +
+                        std::to_string(slot->attempt + 1) + " attempts: " + chunkError;
+                if (res != CURLE_OK) {
+                    failure_ = Failure_Network;  // otherwise set by CheckResponse
+                }
+                ok = false;
+            }
+        }
+
+        long timeoutMs;
+        if (ok && !TimeLeft(timeoutMs, error)) {
+            ok = false;
+        }
+
+        // Stalled: less than minThroughput over the last stallWindowSeconds
+        now = SteadyMs();
+        samples.emplace_back(now, sentBytes_);
+        while (samples.size() > 1 && samples[1].first <= now - windowMs) {
+            samples.pop_front();
+        }
+        if (ok && config.minThroughput > 0 && windowMs > 0 && now - started >= windowMs && samples.front().first <= now - windowMs) {
+            uint64_t rate = (sentBytes_ - samples.front().second) * 1000 / static_cast<uint64_t>(now - samples.front().first);
+            if (rate < config.minThroughput) {
+                error = "Stalled: " + std::to_string(rate / 1024) + " KB/s over the last " + std::to_string(config.stallWindowSeconds) +
+                        " s, below " + std::to_string(config.minThroughput / 1024) + " KB/s";
+                failure_ = Failure_Stalled;
+                ok = false;
+            }
+        }
+    }
+
+    // Abandon whatever is still in flight; removing an idle handle is a no-op
+    for (size_t i = 0; i < window; ++i) {
+        curl_multi_remove_handle(multi_, slots_[i]->curl);
+    }
+    return ok;
+}
+
+bool FileSenderClient::FetchChunkSize(std::string& error) {
+    if (session_.ChunkSize() > 0) {
+        return true;
+    }
+
+    Response response;
+    if (!Perform("get", session_.Config().baseUrl + "/info", nullptr, 0, JSON_TYPE, response, error)) {
+        return false;
+    }
+    Json::Value info;
+    std::string errs;
+    if (response.code != 200 ||
+        !reader_->parse(response.body.data(), response.body.data() + response.body.size(), &info, &errs) ||
+        !info.isObject() || !info["upload_chunk_size"].isIntegral() || info["upload_chunk_size"].asLargestInt() <= 0) {
+        error = "No upload_chunk_size in /info (Http " + std::to_string(response.code) + ")";
+        failure_ = Failure_Server;
+        return false;
+    }
+    session_.SetChunkSize(static_cast<size_t>(info["upload_chunk_size"].asLargestInt()));
+    return true;
+}
+
+// postTransfer for a single file; fills the ids and keys of header
+bool FileSenderClient::PostTransfer(const std::string& name, uint64_t size, const std::vector<std::string>& recipients,
+                                    TransferCheckpoint::Header& header, std::string& error) {
+    const FileSenderConfig& config = session_.Config();
+    Json::Value request(Json::objectValue);
+    request["from"] = config.username;
+    Json::Value file(Json::objectValue);
+    file["name"] = name;
+    file["size"] = static_cast<Json::UInt64>(size);
+    request["files"].append(file);
+    for (const auto& recipient : recipients) {
+        request["recipients"].append(recipient);
+    }
+    header.expires = static_cast<int64_t>(std::time(nullptr)) + config.transferDaysValid * 24 * 3600;
+    request["subject"] = Json::Value();
+    request["message"] = Json::Value();
+    request["expires"] = static_cast<Json::Int64>(header.expires);
+    request["aup_checked"] = 1;
+    request["options"]["get_a_link"] = 0;
+    std::string body = ToJson(request);
+
+    Json::Value transfer;
+    if (!Call("post", "/transfer", {}, body.data(), body.size(), JSON_TYPE, transfer, error)) {
+        return false;
+    }
+
+    header.transferId = IdString(transfer["id"]);
+    header.roundtripToken = transfer.get("roundtriptoken", "").asString();
+    const Json::Value& files = transfer["files"];
+    for (Json::ArrayIndex i = 0; files.isArray() && i < files.size(); ++i) {
+        if (i == 0) {
+            header.transferKey = files[i].get("uid", "").asString();
+        }
+        if (files[i].get("name", "").asString() == name && files[i]["size"].isIntegral() &&
+            static_cast<uint64_t>(files[i]["size"].asLargestUInt()) == size) {
+            header.fileId = IdString(files[i]["id"]);
+            header.fileUid = files[i].get("uid", "").asString();
+        }
+    }
+    if (header.transferId.empty() || header.fileId.empty()) {
+        error = "Transfer response without " + name;
+        failure_ = Failure_Server;
+        return false;
+    }
+    return true;
+}
+
+bool FileSenderClient::UploadFile(const std::string& path, const std::string& checkpointPath,
+                                  const std::vector<std::string>& recipients, std::string& error) {
+    lastHttpError_ = 0;
+    failure_ = Failure_None;
+    resumedBytes_ = 0;
+    sentBytes_ = 0;
+    ackedChunks_ = 0;
+    const FileSenderConfig& config = session_.Config();
+    if (config.username.empty() || config.apikey.empty()) {
+        error = "FILESENDER_USERNAME or FILESENDER_API_KEY not set";
+        failure_ = Failure_Local;
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error = "Cannot open " + path + ": " + strerror(errno);
+        failure_ = Failure_Local;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    budgetSeconds_ = config.BudgetSeconds(size);
+    deadline_ = budgetSeconds_ > 0 ? SteadyMs() + budgetSeconds_ * 1000LL : 0;
+    int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+    std::string name = path.substr(path.find_last_of('/') + 1);
+
+    if (!FetchChunkSize(error)) {
+        close(fd);
+        return false;
+    }
+    size_t chunkSize = session_.ChunkSize();
+
+    // Continue a saved transfer of the same archive content; one that is about to
+    // expire or was cut into other chunks is left to expire on the server
+    TransferCheckpoint checkpoint(checkpointPath);
+    TransferCheckpoint::Header transfer;
+    bool persist = !checkpointPath.empty();
+    bool resumed = false;
+    if (persist && checkpoint.Load()) {
+        const TransferCheckpoint::Header& saved = checkpoint.GetHeader();
+        if (saved.size == size && saved.mtime == mtime && saved.chunkSize == chunkSize &&
+            saved.expires > static_cast<int64_t>(std::time(nullptr)) + RESUME_MARGIN) {
+            transfer = saved;
+            resumed = true;
+            resumedBytes_ = std::min<uint64_t>(size, checkpoint.AckedCount() * chunkSize);
+        } else {
+            checkpoint.Remove();
+        }
+    }
+    if (!resumed) {
+        if (!PostTransfer(name, size, recipients, transfer, error)) {
+            close(fd);
+            return false;
+        }
+        transfer.size = size;
+        transfer.mtime = mtime;
+        transfer.chunkSize = chunkSize;
+        persist = persist && checkpoint.Create(transfer);  // without it the upload is just not resumable
+    }
+
+    Json::Value result;
+    static const std::string COMPLETE = "{\"complete\":true}";
+    bool ok = true;
+    bool transferDone = resumed && checkpoint.Complete();
+    if (!transferDone && !(resumed && checkpoint.FileComplete())) {
+        ok = PutChunks(fd, size, chunkSize, transfer.fileId, { "key=" + transfer.fileUid, "roundtriptoken=" + transfer.roundtripToken },
+                       persist ? &checkpoint : nullptr, error) &&
+             Call("put", "/file/" + transfer.fileId, { "key=" + transfer.fileUid, "roundtriptoken=" + transfer.roundtripToken },
+                  COMPLETE.data(), COMPLETE.size(), JSON_TYPE, result, error);
+        if (ok && persist) {
+            checkpoint.MarkFileComplete();
+        }
+    }
+    if (ok && !transferDone && resumed && checkpoint.Completing()) {
+        // Cut off while transferComplete was on its way: only complete it if it did not arrive
+        std::string statusError;
+        transferDone = Call("get", "/transfer/" + transfer.transferId, { "key=" + transfer.transferKey },
+                            nullptr, 0, JSON_TYPE, result, statusError) &&
+                       result.isObject() && result.get("status", "").asString() == "available";
+        if (transferDone) {
+            checkpoint.MarkComplete();
+        }
+        lastHttpError_ = 0;
+    }
+    if (ok && !transferDone) {
+        if (persist) {
+            checkpoint.MarkCompleting();
+        }
+        ok = Call("put", "/transfer/" + transfer.transferId, { "key=" + transfer.transferKey },
+                  COMPLETE.data(), COMPLETE.size(), JSON_TYPE, result, error);
+        if (ok && persist) {
+            checkpoint.MarkComplete();
+        }
+    }
+    close(fd);
+
+    // Errors on our side, timeouts and 5xx keep the transfer for the next attempt. A
+    // transfer the server refuses is deleted (deleteTransfer) and started over next time.
+    Failure failure = ok ? Failure_None : failure_;
+    if (!ok && persist && !Refused(lastHttpError_)) {
+        error += " (" + std::to_string(checkpoint.AckedCount()) + " of " + std::to_string(size / chunkSize + 1) +
+                 " chunks kept for the next attempt)";
+    } else if (!ok) {
+        deadline_ = SteadyMs() + CLEANUP_TIMEOUT;
+        std::string deleteError;
+        if (!Call("delete", "/transfer/" + transfer.transferId, { "key=" + transfer.transferKey },
+                  nullptr, 0, JSON_TYPE, result, deleteError)) {
+            error += "; deleteTransfer failed: " + deleteError;
+        }
+        if (persist) {
+            checkpoint.Remove();
+        }
+    }
+    deadline_ = 0;
+    failure_ = failure;  // not the cleanup's, nor that of chunks retried successfully
+    return ok;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "transfercheckpoint.h"
+
+#include <curl/curl.h>
+#include <json/json.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct FileSenderConfig {
+    std::string baseUrl = "https://filesender.switch.ch/filesender2/rest.php";
+    std::string username;
+    std::string apikey;
+    int transferDaysValid = 20;
+    int chunkWindow = 4;       // chunk PUTs in flight per file, 1 sends them one after another
+
+    // Supervision of an upload attempt, replacing the former fixed `timeout 300`
+    int budgetBaseSeconds = 300;   // overall budget: base plus size / budgetRate
+    uint64_t budgetRate = 262144;  // bytes/s
+    int chunkTimeoutSeconds = 300; // per request, a timed out chunk is retried
+    uint64_t minThroughput = 32768;  // bytes/s over stallWindowSeconds, 0 disables
+    int stallWindowSeconds = 60;
+
+    int BudgetSeconds(uint64_t size) const {
+        return budgetBaseSeconds + static_cast<int>(budgetRate > 0 ? size / budgetRate : 0);
+    }
+};
+
+// State shared by all clients: configuration, the server's upload_chunk_size (GET /info
+// once per process) and a curl share handle, so DNS results, TLS sessions and idle
+// keep-alive connections are reused across workers.
+class FileSenderSession {
+public:
+    explicit FileSenderSession(const FileSenderConfig& config);
+    ~FileSenderSession();
+
+    const FileSenderConfig& Config() const { return config_; }
+    CURLSH* Share() const { return share_; }
+
+    // 0 until a client has fetched it
+    size_t ChunkSize() const;
+    void SetChunkSize(size_t size);
+
+private:
+    static void Lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr);
+    static void Unlock(CURL* handle, curl_lock_data data, void* userptr);
+
+    FileSenderConfig config_;
+    CURLSH* share_ = nullptr;
+    std::mutex locks_[CURL_LOCK_DATA_LAST];
+    mutable std::mutex mutex_;
+    size_t chunkSize_ = 0;
+};
+
+// Signed FileSender REST client, one per upload thread. Speaks the protocol of
+// filesender.py (postTransfer, putChunk, fileComplete, transferComplete, deleteTransfer
+// on failure) over reused easy handles; chunks go up through a curl multi handle with
+// a sliding window of chunkWindow PUTs, each with its own buffer.
+class FileSenderClient {
+public:
+    // Kind of the error that ended the last upload, for the failure metrics
+    enum Failure {
+        Failure_None,
+        Failure_Local,    // configuration, file or curl setup on this side
+        Failure_Network,  // connection error or request timeout
+        Failure_Server,   // 5xx, 408, 429 or an unusable answer
+        Failure_Refused,  // other 4xx, the transfer is deleted
+        Failure_Stalled,
+        Failure_Budget
+    };
+
+    static const char* FailureName(Failure failure) {
+        static const char* const NAMES[] = { "none", "local", "network", "server", "refused", "stalled", "budget" };
+        return NAMES[failure];
+    }
+
+    explicit FileSenderClient(FileSenderSession& session);
+    ~FileSenderClient();
+
+    FileSenderClient(const FileSenderClient&) = delete;
+    FileSenderClient& operator=(const FileSenderClient&) = delete;
+
+    // Uploads path as a single-file transfer; error describes the first failure. Progress
+    // is kept in checkpointPath (none if empty), a later call for the same archive resumes
+    // from it. The checkpoint is left in place on success, marked complete.
+    bool UploadFile(const std::string& path, const std::string& checkpointPath,
+                    const std::vector<std::string>& recipients, std::string& error);
+
+    // Bytes already on the server when the last upload was resumed, and chunk bytes
+    // sent by it, retries included
+    uint64_t ResumedBytes() const { return resumedBytes_; }
+    uint64_t SentBytes() const { return sentBytes_; }
+
+    // Chunks the server acknowledged during the last upload, the progress it made on the
+    // checkpoint
+    uint64_t AckedChunks() const { return ackedChunks_; }
+
+    // Requests made, connections opened and chunks sent again by this client, for the logs
+    uint64_t Requests() const { return requests_; }
+    uint64_t Connects() const { return connects_; }
+    uint64_t ChunkRetries() const { return chunkRetries_; }
+    Failure LastFailure() const { return failure_; }
+
+private:
+    struct Response {
+        long code = 0;
+        std::string body;
+    };
+
+    // One chunk PUT of the window
+    struct ChunkSlot {
+        CURL* curl = nullptr;
+        std::vector<char> buffer;
+        std::string url;
+        Response response;
+        uint64_t offset = 0;
+        size_t length = 0;
+        int attempt = 0;
+        curl_off_t uploaded = 0;     // of this request, from the progress callback
+        uint64_t* sent = nullptr;    // the client's sentBytes_
+    };
+
+    static int OnProgress(void* userp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
+    CURL* NewHandle() const;
+    bool FetchChunkSize(std::string& error);
+    bool Call(const char* method, const std::string& path, std::vector<std::string> args,
+              const char* content, size_t contentSize, const char* contentType,
+              Json::Value& result, std::string& error);
+    bool PostTransfer(const std::string& name, uint64_t size, const std::vector<std::string>& recipients,
+                      TransferCheckpoint::Header& header, std::string& error);
+    bool PutChunks(int fd, uint64_t size, size_t chunkSize, const std::string& fileId,
+                   const std::vector<std::string>& args, TransferCheckpoint* checkpoint, std::string& error);
+    bool StartChunk(ChunkSlot& slot, int fd, uint64_t offset, int attempt, size_t chunkSize,
+                    const std::string& fileId, const std::vector<std::string>& args, std::string& error);
+    bool Perform(const char* method, const std::string& url, const char* content, size_t contentSize,
+                 const char* contentType, Response& response, std::string& error);
+    bool CheckResponse(const char* method, const std::string& path, const Response& response,
+                       Json::Value& result, std::string& error);
+    void CountRequest(CURL* curl);
+    bool TimeLeft(long& timeoutMs, std::string& error);
+    std::string SignedUrl(const char* method, const std::string& path, std::vector<std::string> args,
+                          const char* content, size_t contentSize) const;
+    std::string Sign(const std::string& prefix, const char* content, size_t contentSize) const;
+
+    FileSenderSession& session_;
+    CURL* curl_ = nullptr;
+    CURLM* multi_ = nullptr;
+    std::vector<std::unique_ptr<ChunkSlot>> slots_;
+    struct curl_slist* jsonHeaders_ = nullptr;
+    struct curl_slist* chunkHeaders_ = nullptr;
+    std::unique_ptr<Json::CharReader> reader_;
+    int64_t deadline_ = 0;  // steady clock ms, 0 when unbounded
+    int budgetSeconds_ = 0;
+    uint64_t requests_ = 0;
+    uint64_t connects_ = 0;
+    uint64_t chunkRetries_ = 0;
+    uint64_t resumedBytes_ = 0;
+    uint64_t sentBytes_ = 0;
+    uint64_t ackedChunks_ = 0;
+    long lastHttpError_ = 0;  // status of the last refused request of the current upload
+    Failure failure_ = Failure_None;
+};
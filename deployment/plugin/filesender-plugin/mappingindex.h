@@ -0,0 +1,119 @@
+#pragma once
+
+#include <json/json.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MappingEntry {
+    std::vector<std::string> emails;  // distinct, in order of the StudyDescription
+    int64_t stableAt = 0;  // ms since epoch, 0 if unknown
+    std::string cls;       // scheduling class chosen by the export, empty if none
+    std::string trace;     // trace id assigned by the export, empty for older records
+};
+
+// In-memory index over the append-only mapping log written by ExportPlugin. Refresh
+// only parses records appended since the last call; the log is re-read from the
+// start when ExportPlugin has compacted it (new inode) or it shrank.
+class MappingIndex {
+public:
+    explicit MappingIndex(const std::string& path) : path_(path), reader_(Json::CharReaderBuilder().newCharReader()) {}
+
+    void Refresh() {
+        int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return;
+        }
+        if (st.st_ino != inode_ || static_cast<uint64_t>(st.st_size) < offset_) {
+            entries_.clear();
+            inode_ = st.st_ino;
+            offset_ = 0;
+        }
+
+        std::vector<char> buffer(static_cast<size_t>(st.st_size) - offset_);
+        ssize_t n = buffer.empty() ? 0 : pread(fd, buffer.data(), buffer.size(), offset_);
+        close(fd);
+        if (n <= 0) {
+            return;
+        }
+
+        // Only complete lines; a record still being written is picked up next time
+        const char* begin = buffer.data();
+        const char* end = begin + n;
+        for (const char* line = begin; line < end;) {
+            const char* eol = static_cast<const char*>(memchr(line, '\n', end - line));
+            if (!eol) {
+                break;
+            }
+            Parse(line, eol);
+            offset_ += eol + 1 - line;
+            line = eol + 1;
+        }
+    }
+
+    const MappingEntry* Find(const std::string& file) const {
+        auto it = entries_.find(file);
+        return it == entries_.end() ? nullptr : &it->second;
+    }
+
+private:
+    void Parse(const char* begin, const char* end) {
+        Json::Value entry;
+        std::string errs;
+        if (begin == end || !reader_->parse(begin, end, &entry, &errs) || !entry.isObject()) {
+            return;
+        }
+        std::string zip_file = entry.get("file", "").asString();
+        if (zip_file.empty()) {
+            return;
+        }
+
+        // One record per archive, or one per recipient in logs written before
+        std::vector<std::string> emails;
+        if (entry["emails"].isArray()) {
+            for (const auto& email : entry["emails"]) {
+                emails.push_back(email.asString());
+            }
+        } else {
+            emails.push_back(entry.get("email", "").asString());
+        }
+        MappingEntry& mapped = entries_[zip_file];
+        for (const auto& email : emails) {
+            if (!email.empty() && std::find(mapped.emails.begin(), mapped.emails.end(), email) == mapped.emails.end()) {
+                mapped.emails.push_back(email);
+            }
+        }
+        if (mapped.emails.empty()) {
+            entries_.erase(zip_file);
+            return;
+        }
+        if (mapped.stableAt == 0) {
+            mapped.stableAt = entry.get("stable_at", 0).asInt64();
+        }
+        if (mapped.cls.empty()) {
+            mapped.cls = entry.get("class", "").asString();
+        }
+        if (mapped.trace.empty()) {
+            mapped.trace = entry.get("trace", "").asString();
+        }
+    }
+
+    std::string path_;
+    std::unique_ptr<Json::CharReader> reader_;
+    std::unordered_map<std::string, MappingEntry> entries_;
+    ino_t inode_ = 0;
+    uint64_t offset_ = 0;
+};
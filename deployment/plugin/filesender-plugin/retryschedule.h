@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+// Failed uploads wait with exponential backoff before they are submitted again; an attempt
+// that moved the checkpoint forward starts the backoff over. Only with maxAttempts set is an
+// archive given up on, after that many attempts that the server refused or that failed on
+// this side without any progress. Network, server, stall and budget failures are retried
+// for as long as it takes. Counted in memory, so a restart starts over. Shared by the
+// workers and the watcher thread.
+class RetrySchedule {
+public:
+    // maxAttempts 0: never give up
+    void Configure(int maxAttempts, int64_t baseMs, int64_t maxDelayMs) {
+        maxAttempts_ = std::max(0, maxAttempts);
+        baseMs_ = std::max<int64_t>(1, baseMs);
+        maxDelayMs_ = std::max(baseMs_, maxDelayMs);
+    }
+
+    int MaxAttempts() const {
+        return maxAttempts_;
+    }
+
+    // Records a failed attempt. permanent: refused or local, waiting will not help by itself.
+    // The delay before the next attempt in ms, -1 to give the archive up; strikes are the
+    // permanent failures without progress so far.
+    int64_t Failed(const std::string& file, bool progressed, bool permanent, int& strikes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Pending& pending = pending_[file];
+        pending.failures = progressed ? 1 : pending.failures + 1;
+        if (permanent && !progressed) {
+            pending.strikes++;
+        } else if (progressed) {
+            pending.strikes = 0;
+        }
+        strikes = pending.strikes;
+        if (maxAttempts_ > 0 && strikes >= maxAttempts_) {
+            pending_.erase(file);
+            return -1;
+        }
+        int64_t delay = baseMs_;
+        for (int i = 1; i < pending.failures && delay < maxDelayMs_; ++i) {
+            delay *= 2;
+        }
+        delay = std::min(delay, maxDelayMs_);
+        pending.dueAt = NowMs() + delay;
+        return delay;
+    }
+
+    void Forget(const std::string& file) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.erase(file);
+    }
+
+    // False while file waits for its next attempt
+    bool Due(const std::string& file) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = pending_.find(file);
+        return it == pending_.end() || it->second.dueAt <= NowMs();
+    }
+
+    // Adds the archives whose next attempt is due to ready; ms until the next one is, -1 if none waits
+    int64_t TakeDue(std::set<std::string>& ready) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t now = NowMs();
+        int64_t next = -1;
+        for (const auto& entry : pending_) {
+            if (entry.second.dueAt <= now) {
+                ready.insert(entry.first);
+            } else if (next < 0 || entry.second.dueAt - now < next) {
+                next = entry.second.dueAt - now;
+            }
+        }
+        return next;
+    }
+
+    size_t Waiting() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_.size();
+    }
+
+private:
+    struct Pending {
+        int failures = 0;   // in a row, sets the backoff
+        int strikes = 0;    // permanent failures without progress
+        int64_t dueAt = 0;  // steady clock ms
+    };
+
+    static int64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Pending> pending_;
+    int maxAttempts_ = 0;
+    int64_t baseMs_ = 60000;
+    int64_t maxDelayMs_ = 3600000;
+};
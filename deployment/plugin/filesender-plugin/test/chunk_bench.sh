@@ -0,0 +1,56 @@
+#!/bin/bash
+# Per-chunk overhead of FileSenderClient against filesender.py, one process per upload as
+# the plugin used to run it, against the mock server without emulated latency. A file of
+# one chunk gives the fixed cost (process start, GET /info, postTransfer, fileComplete,
+# transferComplete), a file of CHUNKS chunks the cost of each further chunk. Best of
+# ROUNDS runs each.
+#   chunk_bench.sh <upload_driver> [filesender.py]
+DRIVER=$(realpath "$1")
+REFERENCE=${2:+$(realpath "$2")}
+CHUNK=262144
+CHUNKS=64
+ROUNDS=5
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+head -c $((CHUNK / 2)) /dev/urandom > one.zip
+head -c $((CHUNK * CHUNKS - 1)) /dev/urandom > many.zip
+mkdir out
+start_mock --chunk-size $CHUNK --log requests.log --out-dir out
+
+# best_ms <command...>: the fastest of ROUNDS runs in ms
+best_ms() {
+    local best= start ms
+    for _ in $(seq $ROUNDS); do
+        start=$(date +%s%N)
+        "$@" > /dev/null || { echo "FAIL: $*" >&2; exit 1; }
+        ms=$((($(date +%s%N) - start) / 1000000))
+        [ -z "$best" ] || [ "$ms" -lt "$best" ] && best=$ms
+    done
+    echo "$best"
+}
+
+# row <label> <upload command taking the file last...>
+row() {
+    local label=$1 one many
+    shift
+    one=$(best_ms "$@" one.zip) || exit 1
+    many=$(best_ms "$@" many.zip) || exit 1
+    printf "%-22s %10s %12s %14s\n" "$label" "$one" "$many" \
+        "$(awk -v a="$one" -v b="$many" -v n=$CHUNKS 'BEGIN { printf "%.2f", (b - a) / (n - 1) }')"
+}
+
+echo "$CHUNKS chunks of $((CHUNK / 1024)) KB, best of $ROUNDS"
+printf "%-22s %10s %12s %14s\n" client "1 chunk ms" "$CHUNKS chunks ms" "ms/extra chunk"
+if reference_available "$REFERENCE"; then
+    row filesender.py run_reference "$REFERENCE" a@example.org
+else
+    echo "filesender.py: not run (needs the script and python3 requests)"
+fi
+row "native, window 1" "$DRIVER" --window 1 --no-checkpoint "$MOCK_URL"
+row "native, window 4" "$DRIVER" --window 4 --no-checkpoint "$MOCK_URL"
+cmp -s many.zip out/many.zip || { echo "FAIL: many.zip arrived corrupted"; exit 1; }
+grep -q "sig=BAD" requests.log && { echo "FAIL: bad signatures"; exit 1; }
+exit 0
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Per-chunk retry in the chunk window: the mock answers 500 to the first PUT of two chunks.
+# Each is sent again on its own, no other chunk is sent twice, fileComplete only goes out
+# once every offset is acknowledged, and the file arrives unchanged.
+#   chunk_retry_test.sh <upload_driver>
+DRIVER=$(realpath "$1")
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+CHUNK=65536
+CHUNKS=16
+head -c $((CHUNK * CHUNKS - 100)) /dev/urandom > study.zip
+mkdir out
+# The second failure is in the last window, so its retry is the last chunk sent
+start_mock --chunk-size $CHUNK --log requests.log --out-dir out \
+    --fail-chunk $((CHUNK * 2)) --fail-chunk $((CHUNK * (CHUNKS - 1)))
+
+"$DRIVER" --window 4 --no-checkpoint "$MOCK_URL" study.zip > run.out 2>&1 || { cat run.out; fail "upload failed"; }
+stop_mock
+cat run.out
+
+cmp -s study.zip out/study.zip || fail "study.zip arrived corrupted"
+grep -q "sig=BAD" requests.log && fail "bad signatures"
+grep -q " retries 2 " run.out || fail "expected 2 chunk retries"
+for ((offset = 0; offset < CHUNK * CHUNKS; offset += CHUNK)); do
+    count=$(grep -c "^PUT /file/1/chunk/$offset " requests.log)
+    if [ $offset -eq $((CHUNK * 2)) ] || [ $offset -eq $((CHUNK * (CHUNKS - 1))) ]; then
+        [ "$count" -eq 2 ] || fail "chunk $offset sent $count times instead of once more after its failure"
+    else
+        [ "$count" -eq 1 ] || fail "chunk $offset sent $count times"
+    fi
+done
+[ "$(grep -c '^PUT /file/1/chunk/' requests.log)" -eq $((CHUNKS + 2)) ] || fail "unexpected chunk requests"
+last_chunk=$(grep -n '^PUT /file/1/chunk/' requests.log | tail -1 | cut -d: -f1)
+complete=$(grep -n '^PUT /file/1 .*{"complete": true}' requests.log | cut -d: -f1)
+[ -n "$complete" ] && [ "$complete" -gt "$last_chunk" ] || fail "fileComplete sent before every chunk was acknowledged"
+
+echo "Chunk retry: ok"
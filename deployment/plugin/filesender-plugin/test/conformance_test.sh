@@ -0,0 +1,66 @@
+#!/bin/bash
+# FileSenderClient speaks the protocol of filesender.py: the same requests in the same
+# order, signatures the server accepts, a trailing empty chunk at offset == size when the
+# size is a multiple of the chunk size, then fileComplete and transferComplete. The
+# expected requests are also checked against filesender.py itself when python3 has
+# requests installed.
+#   conformance_test.sh <upload_driver> [filesender.py]
+DRIVER=$(realpath "$1")
+REFERENCE=${2:+$(realpath "$2")}
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+# Chunk size 1024: a partial last chunk, an exact multiple, a single chunk, an empty file
+head -c 2500 /dev/urandom > partial.zip
+head -c 2048 /dev/urandom > multiple.zip
+head -c 1024 /dev/urandom > single.zip
+: > empty.zip
+FILES=(partial.zip multiple.zip single.zip empty.zip)
+RECIPIENTS='["a@example.org"]'
+
+id=1
+for file in "${FILES[@]}"; do
+    expected_requests $id "$file" 1024 "$RECIPIENTS"
+    id=$((id + 1))
+done > expected.log
+
+# One request at a time, so the chunks arrive in order
+mkdir native
+start_mock --chunk-size 1024 --log native.log --out-dir native
+"$DRIVER" --window 1 --no-checkpoint "$MOCK_URL" "${FILES[@]}" || fail "native upload failed"
+stop_mock
+for file in "${FILES[@]}"; do
+    cmp -s "$file" "native/$file" || fail "$file arrived corrupted"
+done
+diff -u expected.log native.log || fail "FileSenderClient requests differ from filesender.py's"
+
+if reference_available "$REFERENCE"; then
+    mkdir reference
+    start_mock --chunk-size 1024 --log reference.log --out-dir reference
+    for file in "${FILES[@]}"; do
+        run_reference "$REFERENCE" a@example.org "$file" || fail "filesender.py upload of $file failed"
+    done
+    stop_mock
+    diff -u expected.log reference.log || fail "filesender.py requests differ from the expected ones"
+else
+    echo "filesender.py or python3 requests not available, expected requests not checked against it"
+fi
+
+# The sliding window sends chunks out of order but must deliver the same content
+mkdir window
+start_mock --chunk-size 1024 --log window.log --out-dir window
+head -c 20000 /dev/urandom > window.zip
+"$DRIVER" --window 4 --no-checkpoint "$MOCK_URL" window.zip || fail "windowed upload failed"
+stop_mock
+cmp -s window.zip window/window.zip || fail "windowed upload arrived corrupted"
+grep -q "sig=BAD" window.log && fail "windowed upload sent bad signatures"
+[ "$(grep -c '/chunk/' window.log)" -eq 20 ] || fail "windowed upload did not send 20 chunks"
+
+echo "FileSenderClient conforms to filesender.py on ${#FILES[@]} files"
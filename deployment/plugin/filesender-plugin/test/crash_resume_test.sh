@@ -0,0 +1,61 @@
+#!/bin/bash
+# Crash injection: the uploader is killed with SIGKILL at random points of a transfer and
+# started again until one run completes. The transfer must be resumed from its checkpoint
+# every time (a single postTransfer), a kill may only cost the chunks that were in flight,
+# and the file must arrive unchanged.
+#   crash_resume_test.sh <upload_driver> [seed]
+DRIVER=$(realpath "$1")
+RANDOM=${2:-1}
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+CHUNK=262144
+CHUNKS=32
+WINDOW=4
+head -c $((CHUNK * CHUNKS - 1000)) /dev/urandom > study.zip
+mkdir out
+# About 1.5 s for the whole file with four chunks in flight
+start_mock --chunk-size $CHUNK --log requests.log --out-dir out --rtt-ms 5 --rate 1048576
+
+kills=0
+runs=0
+while :; do
+    runs=$((runs + 1))
+    [ $runs -le 40 ] || fail "no run completed in 40 attempts"
+    "$DRIVER" --window $WINDOW "$MOCK_URL" study.zip > run.out 2>&1 &
+    pid=$!
+    # The first run is killed once it is surely past postTransfer
+    if [ $runs -eq 1 ]; then
+        sleep 0.4
+    else
+        sleep "0.$((RANDOM % 6 + 1))$((RANDOM % 10))"
+    fi
+    if kill -9 $pid 2>/dev/null; then
+        wait $pid 2>/dev/null
+        kills=$((kills + 1))
+    else
+        wait $pid || { cat run.out; fail "run $runs failed"; }
+        break
+    fi
+done
+stop_mock
+cat run.out
+
+cmp -s study.zip out/study.zip || fail "study.zip arrived corrupted"
+[ $kills -gt 0 ] || fail "the upload was never interrupted"
+[ "$(grep -c '^POST /transfer' requests.log)" -eq 1 ] || fail "the transfer was started over instead of resumed"
+grep -q "sig=BAD" requests.log && fail "bad signatures"
+grep -q " resumed [1-9]" run.out || fail "the last run did not resume"
+# Chunks the checkpoint had acked are not sent again, only the window in flight at a kill
+sent=$(grep -c '/chunk/.* sig=ok' requests.log)
+[ "$sent" -le $((CHUNKS + kills * WINDOW)) ] || fail "$sent chunk requests for $CHUNKS chunks after $kills kills"
+[ ! -e study.zip.transfer ] || fail "checkpoint left behind"
+
+echo "Delivered after $kills kills, $sent chunk requests for $CHUNKS chunks"
@@ -0,0 +1,56 @@
+# Helpers for the FileSenderClient tests, sourced by the test scripts. The mock server
+# listens on a free port; MOCK_URL is its rest.php endpoint.
+MOCK_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+MOCK_PID=
+
+# start_mock <mock_filesender.py options>
+start_mock() {
+    rm -f mock.port
+    python3 "$MOCK_DIR/mock_filesender.py" --port-file mock.port "$@" &
+    MOCK_PID=$!
+    for _ in $(seq 100); do
+        [ -s mock.port ] && break
+        sleep 0.05
+    done
+    [ -s mock.port ] || { echo "mock server did not start"; exit 1; }
+    MOCK_URL="http://127.0.0.1:$(cat mock.port)/rest.php"
+}
+
+stop_mock() {
+    if [ -n "$MOCK_PID" ]; then
+        kill "$MOCK_PID" 2>/dev/null
+        wait "$MOCK_PID" 2>/dev/null
+        MOCK_PID=
+    fi
+}
+
+# expected_requests <transfer id> <file> <chunk size> <recipients as JSON list>
+# The log lines of filesender.py uploading file as that transfer: postTransfer, a chunk
+# for every offset in range(0, size + 1, chunk size), so a trailing empty one when the
+# size is a multiple of the chunk size, then fileComplete and transferComplete
+expected_requests() {
+    local id=$1 file=$2 chunk=$3 recipients=$4
+    local size offset length
+    size=$(stat -c %s "$file")
+    echo "POST /transfer remote_user=user@example.org sig=ok {\"aup_checked\": 1, \"files\": [{\"name\": \"$(basename "$file")\", \"size\": $size}], \"from\": \"user@example.org\", \"message\": null, \"options\": {\"get_a_link\": 0}, \"recipients\": $recipients, \"subject\": null}"
+    for ((offset = 0; offset <= size; offset += chunk)); do
+        length=$((size - offset < chunk ? size - offset : chunk))
+        echo "PUT /file/$id/chunk/$offset key=uid$id&remote_user=user@example.org&roundtriptoken=rtt$id sig=ok <$length bytes sha1 $(tail -c +$((offset + 1)) "$file" | head -c "$length" | sha1sum | cut -c1-12)>"
+    done
+    echo "PUT /file/$id key=uid$id&remote_user=user@example.org&roundtriptoken=rtt$id sig=ok {\"complete\": true}"
+    echo "PUT /transfer/$id key=uid$id&remote_user=user@example.org sig=ok {\"complete\": true}"
+}
+
+# reference_available <filesender.py>: true if the reference client can run here
+reference_available() {
+    [ -n "$1" ] && [ -f "$1" ] && python3 -c "import requests, urllib3" 2>/dev/null
+}
+
+# run_reference <filesender.py> <recipients> <file>: one transfer per call, like the plugin
+run_reference() {
+    local home
+    home=$(pwd)/reference-home
+    mkdir -p "$home/.filesender"
+    printf '[system]\nbase_url = %s\n' "$MOCK_URL" > "$home/.filesender/filesender.py.ini"
+    HOME=$home python3 "$1" "$3" -u user@example.org -a secretkey -r "$2" > /dev/null
+}
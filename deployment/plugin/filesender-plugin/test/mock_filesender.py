@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Mock FileSender REST server for the FileSenderClient tests.
+
+Checks every request's signature the way filesender.py call() builds it and the server
+verifies it, and writes one line per request to the log, with the volatile parts
+(timestamp, signature, expires) left out so that runs of two clients can be compared.
+Completed transfers are written to --out-dir under the file name.
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import os
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qsl, urlsplit
+
+APIKEY = b'secretkey'
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--port', type=int, default=0, help='0 picks a free port')
+parser.add_argument('--port-file', help='written with the port once listening')
+parser.add_argument('--chunk-size', type=int, default=1024)
+parser.add_argument('--log', required=True)
+parser.add_argument('--out-dir', default='.')
+parser.add_argument('--rtt-ms', type=float, default=0, help='added to every request')
+parser.add_argument('--rate', type=float, default=0, help='bytes/s per request body, 0 unlimited')
+parser.add_argument('--fail-chunk', type=int, action='append', default=[], metavar='OFFSET',
+                    help='answer 500 to the first PUT of the chunk at OFFSET, in every transfer')
+args = parser.parse_args()
+
+lock = threading.Lock()
+log = open(args.log, 'a')
+transfers = {}  # id -> {'name', 'chunks': {offset: bytes}, 'complete'}
+failed = set()  # (id, offset) answered 500 for --fail-chunk
+
+
+def signed_string(method, host, path, query, body):
+    # filesender.py call(): method&host+path?sorted args[&body], where body is the
+    # compact JSON content or the raw chunk, also when the chunk is empty
+    rest = sorted(k + '=' + v for k, v in query if k != 'signature')
+    signed = (method.lower() + '&' + host + path + '?' + '&'.join(rest)).encode('ascii')
+    if method in ('POST', 'PUT'):
+        signed += b'&' + body
+    return signed
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+    # Headers and body go out as two writes; with Nagle the body would wait for the
+    # client's delayed ACK, 40 ms per request on a kept-alive connection
+    disable_nagle_algorithm = True
+
+    def log_message(self, *unused):
+        pass
+
+    def do_GET(self):
+        self.handle_call('GET')
+
+    def do_PUT(self):
+        self.handle_call('PUT')
+
+    def do_POST(self):
+        self.handle_call('POST')
+
+    def do_DELETE(self):
+        self.handle_call('DELETE')
+
+    def handle_call(self, method):
+        url = urlsplit(self.path)
+        length = int(self.headers.get('Content-Length') or 0)
+        body = self.rfile.read(length)
+        if len(body) < length:
+            # The client went away in the middle of the request, e.g. killed by a test
+            with lock:
+                log.write('%s %s cut off after %d of %d bytes\n' % (method, url.path.split('rest.php', 1)[-1], len(body), length))
+                log.flush()
+            self.close_connection = True
+            return
+        time.sleep(args.rtt_ms / 1000 + (len(body) / args.rate if args.rate else 0))
+        if url.path.endswith('/info'):
+            return self.reply(200, {'upload_chunk_size': args.chunk_size})
+
+        query = parse_qsl(url.query, keep_blank_values=True)
+        expected = hmac.new(APIKEY, signed_string(method, self.headers['Host'], url.path, query, body), hashlib.sha1).hexdigest()
+        valid = dict(query).get('signature') == expected
+        path = url.path.split('rest.php', 1)[1]
+        shown_args = '&'.join(sorted(k + '=' + v for k, v in query if k not in ('signature', 'timestamp')))
+        if self.headers.get('Content-Type') == 'application/json':
+            content = json.loads(body) if body else None
+            if path == '/transfer' and isinstance(content, dict):
+                content.pop('expires', None)
+            shown = json.dumps(content, sort_keys=True)
+        else:
+            shown = '<%d bytes sha1 %s>' % (len(body), hashlib.sha1(body).hexdigest()[:12])
+        with lock:
+            log.write('%s %s %s sig=%s %s\n' % (method, path, shown_args, 'ok' if valid else 'BAD', shown))
+            log.flush()
+        if not valid:
+            return self.reply(403, {'message': 'signature_invalid'})
+
+        parts = path.strip('/').split('/')
+        if method == 'POST' and parts == ['transfer']:
+            request = json.loads(body)
+            with lock:
+                tid = len(transfers) + 1
+                transfers[tid] = {'name': request['files'][0]['name'], 'chunks': {}, 'complete': False}
+            f = request['files'][0]
+            return self.reply(201, {'id': tid, 'roundtriptoken': 'rtt%d' % tid,
+                                    'files': [{'id': tid, 'uid': 'uid%d' % tid, 'name': f['name'], 'size': f['size']}]},
+                              {'Location': '/transfer/%d' % tid})
+        if parts[0] in ('file', 'transfer') and (len(parts) < 2 or int(parts[1]) not in transfers):
+            return self.reply(404, {'message': 'transfer_not_found'})
+        if method == 'PUT' and parts[0] == 'file' and len(parts) == 4 and parts[2] == 'chunk':
+            chunk = (int(parts[1]), int(parts[3]))
+            with lock:
+                fail = chunk[1] in args.fail_chunk and chunk not in failed
+                if fail:
+                    failed.add(chunk)
+                else:
+                    transfers[chunk[0]]['chunks'][chunk[1]] = body
+            if fail:
+                return self.reply(500, {'message': 'chunk_write_failed'})
+            return self.reply(200, True)
+        if method == 'GET' and parts[0] == 'transfer':
+            transfer = transfers[int(parts[1])]
+            return self.reply(200, {'id': int(parts[1]), 'status': 'available' if transfer['complete'] else 'uploading'})
+        if method == 'PUT' and parts[0] == 'transfer':
+            with lock:
+                transfer = transfers[int(parts[1])]
+                transfer['complete'] = True
+                data = b''.join(transfer['chunks'][offset] for offset in sorted(transfer['chunks']))
+            with open(os.path.join(args.out_dir, transfer['name']), 'wb') as out:
+                out.write(data)
+        return self.reply(200, True)
+
+    def reply(self, code, content, headers={}):
+        data = json.dumps(content).encode()
+        self.send_response(code)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(data)))
+        for name, value in headers.items():
+            self.send_header(name, value)
+        self.end_headers()
+        self.wfile.write(data)
+
+
+server = ThreadingHTTPServer(('127.0.0.1', args.port), Handler)
+if args.port_file:
+    with open(args.port_file + '.tmp', 'w') as f:
+        f.write(str(server.server_address[1]))
+    os.rename(args.port_file + '.tmp', args.port_file)
+server.serve_forever()
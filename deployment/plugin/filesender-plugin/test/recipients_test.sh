@@ -0,0 +1,50 @@
+#!/bin/bash
+# One archive for 1, 5 and 20 recipients: a single transfer listing all of them, and the
+# same chunks whatever their number, so the upload bytes stay constant. The requests must
+# also be those filesender.py sends for its comma separated --recipients list, which is
+# how FilesenderPlugin's python fallback passes them.
+#   recipients_test.sh <upload_driver> [filesender.py]
+DRIVER=$(realpath "$1")
+REFERENCE=${2:+$(realpath "$2")}
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+head -c 100000 /dev/urandom > study.zip
+bytes=
+for count in 1 5 20; do
+    list=
+    json=
+    for ((r = 1; r <= count; r++)); do
+        list+="${list:+,}r$r@example.org"
+        json+="${json:+, }\"r$r@example.org\""
+    done
+    expected_requests 1 study.zip 16384 "[$json]" > expected$count.log
+
+    mkdir out$count
+    start_mock --chunk-size 16384 --log native$count.log --out-dir out$count
+    "$DRIVER" --window 1 --no-checkpoint --recipients "$list" "$MOCK_URL" study.zip > run.out || { cat run.out; fail "upload to $count recipients failed"; }
+    stop_mock
+    cmp -s study.zip out$count/study.zip || fail "study.zip arrived corrupted for $count recipients"
+    diff -u expected$count.log native$count.log || fail "requests for $count recipients differ from filesender.py's"
+
+    sent=$(sed -n 's/.* sent \([0-9]*\)$/\1/p' run.out)
+    [ "$sent" -eq 100000 ] || fail "$sent bytes uploaded for $count recipients"
+    [ -z "$bytes" ] || [ "$sent" -eq "$bytes" ] || fail "upload bytes change with the number of recipients"
+    bytes=$sent
+
+    if reference_available "$REFERENCE"; then
+        start_mock --chunk-size 16384 --log reference$count.log --out-dir out$count
+        run_reference "$REFERENCE" "$list" study.zip || fail "filesender.py upload to $count recipients failed"
+        stop_mock
+        diff -u expected$count.log reference$count.log || fail "filesender.py requests for $count recipients differ from the expected ones"
+    fi
+    echo "$count recipients: 1 transfer, $sent bytes"
+done
+reference_available "$REFERENCE" || echo "filesender.py or python3 requests not available, expected requests not checked against it"
@@ -0,0 +1,71 @@
+// RetrySchedule: the backoff doubles up to its cap, progress starts it over, an outage of
+// any length never gives an archive up, and only with maxAttempts set are archives the
+// server keeps refusing given up, counting attempts without progress only.
+#include "retryschedule.h"
+
+#include <chrono>
+#include <iostream>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace {
+    int failures = 0;
+
+    void Expect(bool condition, const std::string& what) {
+        if (!condition) {
+            std::cerr << "FAIL: " << what << "\n";
+            failures++;
+        }
+    }
+}
+
+int main() {
+    int strikes;
+
+    // Defaults: never give up, backoff 60 s doubling to 3600 s
+    RetrySchedule retries;
+    retries.Configure(0, 60000, 3600000);
+    const int64_t expected[] = { 60000, 120000, 240000, 480000, 960000, 1920000, 3600000, 3600000 };
+    for (int64_t delay : expected) {
+        Expect(retries.Failed("a.zip", false, false, strikes) == delay, "backoff " + std::to_string(delay) + " ms");
+    }
+    // A day of network failures, and refusals too, without a limit
+    bool gaveUp = false;
+    for (int i = 0; i < 48; ++i) {
+        gaveUp = gaveUp || retries.Failed("a.zip", false, i % 2 == 0, strikes) < 0;
+    }
+    Expect(!gaveUp, "no limit by default");
+    Expect(!retries.Due("a.zip") && retries.Due("b.zip"), "waiting archive not due, unknown one due");
+    Expect(retries.Failed("a.zip", true, false, strikes) == 60000, "progress starts the backoff over");
+    retries.Forget("a.zip");
+    Expect(retries.Waiting() == 0 && retries.Due("a.zip"), "uploaded archive forgotten");
+
+    // With a limit, only refusals or local failures without progress count
+    RetrySchedule limited;
+    limited.Configure(3, 1, 4);
+    for (int i = 0; i < 100; ++i) {
+        Expect(limited.Failed("slow.zip", i % 3 != 0, true, strikes) >= 0, "attempts with progress never count");
+        Expect(limited.Failed("down.zip", false, false, strikes) >= 0, "network, server and stall failures never count");
+    }
+    Expect(limited.Failed("bad.zip", false, true, strikes) >= 0 && strikes == 1, "first refusal");
+    Expect(limited.Failed("bad.zip", true, true, strikes) >= 0 && strikes == 0, "progress clears the refusals");
+    Expect(limited.Failed("bad.zip", false, true, strikes) >= 0 && strikes == 1, "refusal after progress");
+    Expect(limited.Failed("bad.zip", false, true, strikes) >= 0 && strikes == 2, "second refusal in a row");
+    Expect(limited.Failed("bad.zip", false, true, strikes) < 0 && strikes == 3, "given up after the third");
+    Expect(limited.Due("bad.zip"), "given up archive no longer scheduled");
+
+    // TakeDue hands back archives whose backoff has passed, with the wait until the next one
+    RetrySchedule due;
+    due.Configure(0, 20, 1000);
+    due.Failed("x.zip", false, false, strikes);
+    std::set<std::string> ready;
+    int64_t next = due.TakeDue(ready);
+    Expect(ready.empty() && next > 0 && next <= 20, "x.zip waits, next in " + std::to_string(next) + " ms");
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    next = due.TakeDue(ready);
+    Expect(ready.count("x.zip") == 1 && next == -1, "x.zip due after its backoff");
+
+    if (failures == 0) std::cout << "RetrySchedule: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+// Aggregate upload throughput with a pool of workers, as in FilesenderPlugin's UploadPool:
+// one FileSenderSession, a FileSenderClient per worker, each taking the next file.
+//   upload_bench <workers> <rest.php url> <file>...
+#include "filesenderclient.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::cerr << "usage: upload_bench <workers> <url> <file>...\n";
+        return 2;
+    }
+    size_t workers = std::max(1, std::atoi(argv[1]));
+    FileSenderConfig config;
+    config.baseUrl = argv[2];
+    config.username = "user@example.org";
+    config.apikey = "secretkey";
+    std::vector<std::string> files(argv + 3, argv + argc);
+    uint64_t bytes = 0;
+    for (const auto& file : files) {
+        struct stat st;
+        if (stat(file.c_str(), &st) == 0) bytes += static_cast<uint64_t>(st.st_size);
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    std::atomic<size_t> next{0};
+    std::atomic<int> failed{0};
+    std::vector<double> done(files.size());  // ms until each file was delivered
+    auto start = std::chrono::steady_clock::now();
+    {
+        FileSenderSession session(config);
+        std::vector<std::thread> pool;
+        for (size_t w = 0; w < workers; ++w) {
+            pool.emplace_back([&] {
+                FileSenderClient client(session);
+                for (size_t i; (i = next++) < files.size();) {
+                    std::string error;
+                    if (!client.UploadFile(files[i], "", { "a@example.org" }, error)) {
+                        std::cerr << files[i] << ": " << error << "\n";
+                        failed++;
+                    }
+                    done[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                }
+            });
+        }
+        for (auto& thread : pool) thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    curl_global_cleanup();
+
+    std::vector<double> sorted(done);
+    std::sort(sorted.begin(), sorted.end());
+    std::cout << workers << " workers: " << files.size() << " files, " << bytes / 1048576 << " MB in " << seconds << " s, "
+              << bytes / 1048576.0 / seconds << " MB/s, median file done after " << sorted[sorted.size() / 2] / 1000 << " s"
+              << (failed ? ", " + std::to_string(failed.load()) + " failed" : "") << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#!/bin/bash
+# Aggregate upload throughput at 1, 4 and 8 workers against the mock server. Every
+# request pays a round trip and every chunk is limited to the bandwidth of one
+# connection, like a distant FileSender; the queue is one large study ahead of many
+# small ones, the case a single worker handled worst.
+#   upload_bench.sh <upload_bench> [workers...]
+BENCH=$(realpath "$1")
+shift
+WORKERS=("$@")
+[ ${#WORKERS[@]} -gt 0 ] || WORKERS=(1 4 8)
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+head -c $((64 << 20)) /dev/urandom > large.zip
+FILES=(large.zip)
+for i in $(seq 24); do
+    head -c $((4 << 20)) /dev/urandom > small$i.zip
+    FILES+=(small$i.zip)
+done
+
+mkdir out
+start_mock --chunk-size 1048576 --log requests.log --out-dir out --rtt-ms 20 --rate 8388608
+for workers in "${WORKERS[@]}"; do
+    "$BENCH" "$workers" "$MOCK_URL" "${FILES[@]}" || exit 1
+done
@@ -0,0 +1,68 @@
+// Uploads files with FileSenderClient, one after another, and prints one line per file
+// with the client's counters. Checkpoints are kept next to each file as <file>.transfer
+// and removed after a successful upload, like FilesenderPlugin does.
+//   upload_driver [--window N] [--recipients a@x,b@y] [--no-checkpoint] <rest.php url> <file>...
+#include "filesenderclient.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+    FileSenderConfig config;
+    config.username = "user@example.org";
+    config.apikey = "secretkey";
+    std::vector<std::string> recipients{ "a@example.org" };
+    bool checkpoints = true;
+    int arg = 1;
+    for (; arg < argc && std::string(argv[arg]).compare(0, 2, "--") == 0; ++arg) {
+        std::string option = argv[arg];
+        if (option == "--window" && arg + 1 < argc) {
+            config.chunkWindow = std::atoi(argv[++arg]);
+        } else if (option == "--recipients" && arg + 1 < argc) {
+            recipients.clear();
+            std::string list = argv[++arg];
+            for (size_t start = 0; start <= list.size();) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                recipients.push_back(list.substr(start, end - start));
+                start = end + 1;
+            }
+        } else if (option == "--no-checkpoint") {
+            checkpoints = false;
+        } else {
+            std::cerr << "unknown option " << option << "\n";
+            return 2;
+        }
+    }
+    if (arg + 1 >= argc) {
+        std::cerr << "usage: upload_driver [--window N] [--recipients a,b] [--no-checkpoint] <url> <file>...\n";
+        return 2;
+    }
+    config.baseUrl = argv[arg++];
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    int rc = 0;
+    {
+        FileSenderSession session(config);
+        FileSenderClient client(session);
+        for (; arg < argc; ++arg) {
+            std::string path = argv[arg];
+            std::string checkpoint = checkpoints ? path + ".transfer" : "";
+            std::string error;
+            auto start = std::chrono::steady_clock::now();
+            bool ok = client.UploadFile(path, checkpoint, recipients, error);
+            if (ok && checkpoints) std::remove(checkpoint.c_str());
+            std::cout << path << " " << (ok ? "ok" : "FAIL " + error) << " "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                      << " ms, requests " << client.Requests() << " connects " << client.Connects() << " retries "
+                      << client.ChunkRetries() << " resumed " << client.ResumedBytes() << " sent " << client.SentBytes() << std::endl;
+            if (!ok) rc = 1;
+        }
+    }
+    curl_global_cleanup();
+    return rc;
+}
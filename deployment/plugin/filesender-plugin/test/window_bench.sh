@@ -0,0 +1,36 @@
+#!/bin/bash
+# One large file with 1, 2, 4 and 8 chunk PUTs in flight (FileSenderConfig::chunkWindow)
+# against the mock server with a round trip of RTT_MS added to every request and each
+# request body limited to RATE bytes/s, standing in for a single TCP stream's window on
+# a distant link. Best of ROUNDS runs each.
+#   window_bench.sh <upload_driver> [rtt ms]
+DRIVER=$(realpath "$1")
+RTT_MS=${2:-50}
+RATE=4194304
+CHUNK=1048576
+CHUNKS=32
+ROUNDS=3
+source "$(dirname "$0")/mock.sh"
+WORK=$(mktemp -d)
+trap 'stop_mock; rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+head -c $((CHUNK * CHUNKS - 1)) /dev/urandom > study.zip
+mkdir out
+start_mock --chunk-size $CHUNK --log requests.log --out-dir out --rtt-ms "$RTT_MS" --rate $RATE
+
+echo "$CHUNKS chunks of $((CHUNK / 1048576)) MB, ${RTT_MS} ms per request, $((RATE / 1048576)) MB/s per request, best of $ROUNDS"
+printf "%-8s %10s %10s\n" window ms "MB/s"
+for window in 1 2 4 8; do
+    best=
+    for _ in $(seq $ROUNDS); do
+        start=$(date +%s%N)
+        "$DRIVER" --window $window --no-checkpoint "$MOCK_URL" study.zip > /dev/null || { echo "FAIL: window $window"; exit 1; }
+        ms=$((($(date +%s%N) - start) / 1000000))
+        [ -z "$best" ] || [ "$ms" -lt "$best" ] && best=$ms
+    done
+    printf "%-8s %10s %10s\n" $window "$best" "$(awk -v ms="$best" -v mb=$CHUNKS 'BEGIN { printf "%.1f", mb * 1000 / ms }')"
+done
+cmp -s study.zip out/study.zip || { echo "FAIL: study.zip arrived corrupted"; exit 1; }
+grep -q "sig=BAD" requests.log && { echo "FAIL: bad signatures"; exit 1; }
+exit 0
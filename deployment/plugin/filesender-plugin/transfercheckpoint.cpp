@@ -0,0 +1,190 @@
+#include "transfercheckpoint.h"
+
+#include <json/json.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    bool WriteAll(int fd, const std::string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            done += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool SyncParent(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+        int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) return false;
+        bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+}
+
+TransferCheckpoint::TransferCheckpoint(const std::string& path)
+    : path_(path) {
+}
+
+TransferCheckpoint::~TransferCheckpoint() {
+    if (fd_ >= 0) close(fd_);
+}
+
+bool TransferCheckpoint::Load() {
+    std::ifstream in(path_);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+    std::string text = content.str();
+
+    size_t eol = text.find('\n');
+    if (eol == std::string::npos) {
+        return false;
+    }
+    Json::Value header;
+    std::string errs;
+    std::unique_ptr<Json::CharReader> reader(Json::CharReaderBuilder().newCharReader());
+    if (!reader->parse(text.data(), text.data() + eol, &header, &errs) || !header.isObject()) {
+        return false;
+    }
+    header_.transferId = header.get("transfer_id", "").asString();
+    header_.transferKey = header.get("transfer_key", "").asString();
+    header_.fileId = header.get("file_id", "").asString();
+    header_.fileUid = header.get("file_uid", "").asString();
+    header_.roundtripToken = header.get("roundtriptoken", "").asString();
+    header_.size = header.get("size", 0).asUInt64();
+    header_.mtime = header.get("mtime", 0).asInt64();
+    header_.chunkSize = header.get("chunk_size", 0).asUInt64();
+    header_.expires = header.get("expires", 0).asInt64();
+    if (header_.transferId.empty() || header_.fileId.empty() || header_.chunkSize == 0) {
+        return false;
+    }
+
+    // Events; a line without its newline was torn by a crash and is cut off before
+    // the next append, "ack 2097152" torn to "ack 209715" must not become an event
+    acked_.clear();
+    fileComplete_ = completing_ = complete_ = false;
+    validLength_ = eol + 1;
+    for (size_t line = eol + 1; line < text.size();) {
+        size_t end = text.find('\n', line);
+        if (end == std::string::npos) {
+            break;
+        }
+        validLength_ = end + 1;
+        std::string event = text.substr(line, end - line);
+        if (event.compare(0, 4, "ack ") == 0) {
+            acked_.insert(std::strtoull(event.c_str() + 4, nullptr, 10));
+        } else if (event == "file_complete") {
+            fileComplete_ = true;
+        } else if (event == "completing") {
+            completing_ = true;
+        } else if (event == "complete") {
+            complete_ = true;
+        }
+        line = end + 1;
+    }
+    return true;
+}
+
+bool TransferCheckpoint::Create(const Header& header) {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    header_ = header;
+    acked_.clear();
+    fileComplete_ = completing_ = complete_ = false;
+
+    Json::Value json(Json::objectValue);
+    json["transfer_id"] = header.transferId;
+    json["transfer_key"] = header.transferKey;
+    json["file_id"] = header.fileId;
+    json["file_uid"] = header.fileUid;
+    json["roundtriptoken"] = header.roundtripToken;
+    json["size"] = static_cast<Json::UInt64>(header.size);
+    json["mtime"] = static_cast<Json::Int64>(header.mtime);
+    json["chunk_size"] = static_cast<Json::UInt64>(header.chunkSize);
+    json["expires"] = static_cast<Json::Int64>(header.expires);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    std::string line = Json::writeString(builder, json) + "\n";
+
+    // Written aside and renamed, a crash leaves either the old or the new checkpoint
+    std::string tempPath = path_ + ".tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = WriteAll(fd, line) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tempPath.c_str(), path_.c_str()) != 0) {
+        unlink(tempPath.c_str());
+        return false;
+    }
+    validLength_ = line.size();
+    return SyncParent(path_);
+}
+
+bool TransferCheckpoint::Append(const std::string& line) {
+    if (fd_ < 0) {
+        fd_ = open(path_.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd_ < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd_, &st) == 0 && static_cast<uint64_t>(st.st_size) > validLength_ && ftruncate(fd_, validLength_) != 0) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+    }
+    return WriteAll(fd_, line + "\n");
+}
+
+bool TransferCheckpoint::Ack(uint64_t offset) {
+    acked_.insert(offset);
+    return Append("ack " + std::to_string(offset));
+}
+
+bool TransferCheckpoint::MarkFileComplete() {
+    fileComplete_ = true;
+    return Append("file_complete");
+}
+
+// fsync'd before transferComplete is sent; an attempt that finds it without "complete"
+// asks the server whether the transfer went through instead of completing it again
+bool TransferCheckpoint::MarkCompleting() {
+    completing_ = true;
+    return Append("completing") && fdatasync(fd_) == 0;
+}
+
+// fsync'd: a transfer completed twice would notify the recipients twice
+bool TransferCheckpoint::MarkComplete() {
+    complete_ = true;
+    return Append("complete") && fdatasync(fd_) == 0;
+}
+
+void TransferCheckpoint::Remove() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    unlink(path_.c_str());
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+
+// Progress of one FileSender transfer, kept next to the archive so an upload cut off by
+// an error, a timeout or a restart continues with the chunks the server has not
+// acknowledged yet. The first line is a JSON header written durably before any chunk
+// is sent; every later line is one event ("ack <offset>", "file_complete", "completing",
+// "complete") appended without fsync: a lost ack only means that chunk is sent again.
+class TransferCheckpoint {
+public:
+    struct Header {
+        std::string transferId;
+        std::string transferKey;  // uid of the first file, the key of transfer calls
+        std::string fileId;
+        std::string fileUid;
+        std::string roundtripToken;
+        uint64_t size = 0;
+        int64_t mtime = 0;       // ns, with size identifies the archive content
+        uint64_t chunkSize = 0;  // offsets are only valid for the same chunk size
+        int64_t expires = 0;     // s since epoch, the server drops the transfer after
+    };
+
+    explicit TransferCheckpoint(const std::string& path);
+    ~TransferCheckpoint();
+
+    TransferCheckpoint(const TransferCheckpoint&) = delete;
+    TransferCheckpoint& operator=(const TransferCheckpoint&) = delete;
+
+    // False if there is no readable checkpoint; a torn last line is ignored
+    bool Load();
+
+    // Replaces any previous checkpoint; returns once the header is durable
+    bool Create(const Header& header);
+
+    bool Ack(uint64_t offset);
+    bool MarkFileComplete();
+    bool MarkCompleting();
+    bool MarkComplete();
+    void Remove();
+
+    const Header& GetHeader() const { return header_; }
+    bool Acked(uint64_t offset) const { return acked_.count(offset) > 0; }
+    size_t AckedCount() const { return acked_.size(); }
+    bool FileComplete() const { return fileComplete_; }
+    bool Completing() const { return completing_; }
+    bool Complete() const { return complete_; }
+
+private:
+    bool Append(const std::string& line);
+
+    std::string path_;
+    int fd_ = -1;
+    uint64_t validLength_ = 0;  // up to the last complete line
+    Header header_;
+    std::unordered_set<uint64_t> acked_;
+    bool fileComplete_ = false;
+    bool completing_ = false;
+    bool complete_ = false;
+};
@@ -1,66 +1,177 @@
 #include <OrthancCPlugin.h>
+#include "pipelinemetrics.h"
+#include "tracing.h"
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <cerrno>
+#include <cstring>
+#include <vector>
 #include <map>
 #include <sstream>
 #include <iomanip>
-#include <chrono>
-#include <thread>
 
 OrthancPluginContext* globalContext = NULL;
 
+// The tests build the plugin with QUEUE_PLUGIN_ROOT set to a directory of their own
+#ifndef QUEUE_PLUGIN_ROOT
+#define QUEUE_PLUGIN_ROOT ""
+#endif
+const std::string EXPORTS_DIR = QUEUE_PLUGIN_ROOT "/exports";
+const std::string MAILQUEUE_DIR = QUEUE_PLUGIN_ROOT "/mailqueue";
+
+// Queue stage of the pipeline metrics, published by OnRefreshMetrics
+struct QueueMetrics {
+  LatencyHistogram move;    // /exports -> /mailqueue, fsyncs included
+  MetricCounter queued;
+  MetricCounter queuedBytes;
+  MetricCounter copied;     // moves that had to copy the data instead of renaming
+  MetricCounter alreadyQueued;
+  MetricCounter failedNotFound;
+  MetricCounter failedMove;
+};
+QueueMetrics queueMetrics;
+
+// Spans of the queue stage, the trace id comes with the /send request
+TraceLog tracer("QueuePlugin");
+
 bool FileExists(const std::string& path) {
   struct stat buffer;
   return (stat(path.c_str(), &buffer) == 0);
 }
 
-bool CopyFileAtomic(const std::string& from, const std::string& to) {
-  if (!FileExists(from)) {
+bool SyncDirectoryOf(const std::string& path) {
+  std::string dir = path.substr(0, path.find_last_of('/'));
+  int fd = open(dir.empty() ? "/" : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
     return false;
   }
-  
-  std::string tempTo = to + ".tmp";
-  
-  std::ifstream src(from, std::ios::binary);
-  std::ofstream dst(tempTo, std::ios::binary);
-  
-  if (!src || !dst) {
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+// Errors meaning "not supported between these files", as opposed to an I/O failure
+bool IsUnsupported(int error) {
+  return error == EXDEV || error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY || error == EINVAL;
+}
+
+// Copies size bytes from the current offsets, in the kernel when possible
+bool CopyData(int in, int out, off_t size, std::string& method) {
+  off_t done = 0;
+
+  method = "copy_file_range";
+  while (done < size) {
+    ssize_t n = copy_file_range(in, nullptr, out, nullptr, size - done, 0);
+    if (n > 0) {
+      done += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (done == 0 && n < 0 && IsUnsupported(errno)) {
+      break;
+    } else {
+      return false;
+    }
+  }
+  if (done == size) {
+    return true;
+  }
+
+  method = "sendfile";
+  while (done < size) {
+    ssize_t n = sendfile(out, in, nullptr, size - done);
+    if (n > 0) {
+      done += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (done == 0 && n < 0 && IsUnsupported(errno)) {
+      break;
+    } else {
+      return false;
+    }
+  }
+  if (done == size) {
+    return true;
+  }
+
+  method = "buffered copy";
+  std::vector<char> buffer(1 << 20);
+  while (done < size) {
+    ssize_t n = read(in, buffer.data(), buffer.size());
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    for (ssize_t written = 0; written < n;) {
+      ssize_t w = write(out, buffer.data() + written, n - written);
+      if (w < 0 && errno == EINTR) {
+        continue;
+      }
+      if (w <= 0) {
+        return false;
+      }
+      written += w;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// Moves an archive into the queue with the cheapest method the filesystems allow:
+// rename, then a reflink (FICLONE), then an in-kernel or buffered copy. Copies go to
+// a .tmp file that is fsync'd and renamed; only the affected files and directories
+// are synced. After a copy the source is left to the caller.
+bool MoveFileToQueue(const std::string& from, const std::string& to, std::string& method) {
+  if (!FileExists(from)) {
     return false;
   }
-  
-  dst << src.rdbuf();
-  
-  if (src.bad() || dst.bad()) {
-    dst.close();
-    src.close();
-    std::remove(tempTo.c_str());
+
+  method = "rename";
+  if (rename(from.c_str(), to.c_str()) == 0) {
+    SyncDirectoryOf(to);
+    SyncDirectoryOf(from);
+    return true;
+  }
+  if (errno != EXDEV) {
     return false;
   }
-  
-  dst.close();
-  src.close();
-  
-  struct stat srcStat, dstStat;
-  if (stat(from.c_str(), &srcStat) != 0 || stat(tempTo.c_str(), &dstStat) != 0) {
-    std::remove(tempTo.c_str());
+
+  std::string tempTo = to + ".tmp";
+  int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
     return false;
   }
-  
-  if (srcStat.st_size != dstStat.st_size) {
-    std::remove(tempTo.c_str());
+  int out = open(tempTo.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    close(in);
     return false;
   }
-  
-  if (rename(tempTo.c_str(), to.c_str()) != 0) {
+
+  struct stat srcStat, dstStat;
+  bool ok = fstat(in, &srcStat) == 0;
+  if (ok) {
+    method = "reflink";
+    if (ioctl(out, FICLONE, in) != 0) {
+      ok = IsUnsupported(errno) && CopyData(in, out, srcStat.st_size, method);
+    }
+  }
+  ok = ok && fsync(out) == 0 && fstat(out, &dstStat) == 0 && dstStat.st_size == srcStat.st_size;
+  close(in);
+  ok = close(out) == 0 && ok;
+
+  if (!ok || rename(tempTo.c_str(), to.c_str()) != 0) {
     std::remove(tempTo.c_str());
     return false;
   }
-  
-  sync();
-  
+  SyncDirectoryOf(to);
   return true;
 }
 
@@ -109,6 +220,19 @@ std::string URLDecode(const std::string& value)
   return result.str();
 }
 
+// Wakes the FilesenderPlugin watcher so the upload starts now instead of on its next sweep
+void NotifyUploader(const std::string& file)
+{
+  OrthancPluginMemoryBuffer answer;
+  OrthancPluginErrorCode code = OrthancPluginRestApiPostAfterPlugins(globalContext, &answer, "/filesender/notify",
+                                                                     file.c_str(), static_cast<uint32_t>(file.size()));
+  if (code == OrthancPluginErrorCode_Success) {
+    OrthancPluginFreeMemoryBuffer(globalContext, &answer);
+  } else {
+    OrthancPluginLogWarning(globalContext, ("Uploader not notified, " + file + " waits for the next sweep").c_str());
+  }
+}
+
 OrthancPluginErrorCode OnSendRoute(OrthancPluginRestOutput* output,
                                    const char* url,
                                    const OrthancPluginHttpRequest* request)
@@ -163,25 +287,43 @@ OrthancPluginErrorCode OnSendRoute(OrthancPluginRestOutput* output,
     return OrthancPluginErrorCode_Success;
   }
 
-  std::string source = "/exports/" + file;
-  std::string dest   = "/mailqueue/" + file;
+  std::string source = EXPORTS_DIR + "/" + file;
+  std::string dest   = MAILQUEUE_DIR + "/" + file;
+  TraceScope span(tracer, params.count("trace") ? URLDecode(params["trace"]) : "", "move", file);
 
   OrthancPluginLogInfo(globalContext, ("Attempting to move: " + source + " -> " + dest).c_str());
 
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // The export renames the archive into place before calling /send, no settle delay needed
+  // Idempotent: a repeated call for an archive that is already queued succeeds. This is
+  // also the normal case when ExportPlugin writes straight into /mailqueue.
+  if (!FileExists(source) && FileExists(dest)) {
+    OrthancPluginLogInfo(globalContext, ("Already queued: " + dest).c_str());
+    queueMetrics.alreadyQueued.Add();
+    span.Finish("already queued");
+    NotifyUploader(file);
+    OrthancPluginAnswerBuffer(globalContext, output, "OK", 2, "text/plain");
+    return OrthancPluginErrorCode_Success;
+  }
 
   if (!FileExists(source)) {
     std::string error = "File not found: " + source;
     OrthancPluginLogError(globalContext, error.c_str());
+    queueMetrics.failedNotFound.Add();
+    span.Finish("not found");
     OrthancPluginSendHttpStatusCode(globalContext, output, 404);
     return OrthancPluginErrorCode_Success;
   }
 
-  system("mkdir -p /mailqueue");
+  mkdir(MAILQUEUE_DIR.c_str(), 0755);
 
-  if (!CopyFileAtomic(source, dest)) {
-    std::string error = "Failed to copy file atomically: " + source + " -> " + dest;
+  std::string method;
+  StageTimer moveTimer(queueMetrics.move);
+  bool moved = MoveFileToQueue(source, dest, method);
+  moveTimer.Stop();
+  if (!moved) {
+    std::string error = "Failed to move file atomically: " + source + " -> " + dest + " (" + method + ")";
     OrthancPluginLogError(globalContext, error.c_str());
+    queueMetrics.failedMove.Add();
     OrthancPluginSendHttpStatusCode(globalContext, output, 500);
     return OrthancPluginErrorCode_Success;
   }
@@ -189,17 +331,30 @@ OrthancPluginErrorCode OnSendRoute(OrthancPluginRestOutput* output,
   if (!FileExists(dest)) {
     std::string error = "Destination file verification failed: " + dest;
     OrthancPluginLogError(globalContext, error.c_str());
+    queueMetrics.failedMove.Add();
     OrthancPluginSendHttpStatusCode(globalContext, output, 500);
     return OrthancPluginErrorCode_Success;
   }
 
-  if (unlink(source.c_str()) != 0) {
+  if (FileExists(source) && unlink(source.c_str()) != 0) {
     std::string warning = "Failed to delete original file (but copy succeeded): " + source;
     OrthancPluginLogWarning(globalContext, warning.c_str());
   }
 
-  std::string success = "File moved successfully: " + source + " -> " + dest;
+  struct stat queued;
+  uint64_t bytes = stat(dest.c_str(), &queued) == 0 ? static_cast<uint64_t>(queued.st_size) : 0;
+  queueMetrics.queued.Add();
+  queueMetrics.queuedBytes.Add(bytes);
+  if (method != "rename") {
+    queueMetrics.copied.Add();
+  }
+  span.SetBytes(bytes);
+  span.Finish(method == "rename" ? "ok" : "ok (" + method + ")");
+
+  std::string success = "File moved successfully: " + source + " -> " + dest + " (" + method + ")";
   OrthancPluginLogInfo(globalContext, success.c_str());
+
+  NotifyUploader(file);
   
   const char* successMsg = "OK";
   OrthancPluginAnswerBuffer(globalContext, output, successMsg, strlen(successMsg), "text/plain");
@@ -207,16 +362,36 @@ OrthancPluginErrorCode OnSendRoute(OrthancPluginRestOutput* output,
   return OrthancPluginErrorCode_Success;
 }
 
+// Called by Orthanc before it answers /tools/metrics and /tools/metrics-prometheus
+void OnRefreshMetrics()
+{
+  queueMetrics.move.Publish(globalContext, "queue_stage_move_ms");
+  queueMetrics.queued.Publish(globalContext, "queue_archives_total");
+  queueMetrics.queuedBytes.Publish(globalContext, "queue_archive_bytes_total");
+  queueMetrics.copied.Publish(globalContext, "queue_copied_total");
+  queueMetrics.alreadyQueued.Publish(globalContext, "queue_already_queued_total");
+  queueMetrics.failedNotFound.Publish(globalContext, "queue_failures_not_found_total");
+  queueMetrics.failedMove.Publish(globalContext, "queue_failures_move_total");
+}
+
 extern "C"
 {
   ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
   {
     globalContext = context;
     
-    system("mkdir -p /exports");
-    system("mkdir -p /mailqueue");
+    for (const std::string& dir : {EXPORTS_DIR, MAILQUEUE_DIR})
+    {
+      if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      {
+        OrthancPluginLogError(context, ("Cannot create " + dir + ": " + strerror(errno)).c_str());
+      }
+    }
     
+    // Called in-process by ExportPlugin and over HTTP by external clients
+    tracer.ConfigureFromEnvironment();
     OrthancPluginRegisterRestCallback(context, "/send", OnSendRoute);
+    OrthancPluginRegisterRefreshMetricsCallback(context, OnRefreshMetrics);
     OrthancPluginLogInfo(context, "QueuePlugin initialized with atomic operations.");
     return 0;
   }